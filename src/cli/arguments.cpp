@@ -32,8 +32,8 @@ namespace UserIdentificationManager::Cli
         {
             Glib::OptionEntry entry;
             Glib::ustring description =
-                "Print users identified since start of daemon (max " +
-                std::to_string(UIM_CONFIG_DAEMON_MAX_SAVED_IDENTIFIED_USERS) + ")";
+                "Print users identified since start of daemon (max history capacity, default " +
+                std::to_string(UIM_CONFIG_DAEMON_DEFAULT_HISTORY_CAPACITY) + ")";
             entry.set_short_name('i');
             entry.set_long_name("identified-users");
             entry.set_description(description);
@@ -48,6 +48,14 @@ namespace UserIdentificationManager::Cli
             main_group.add_entry(entry, arguments.print_sources);
         }
 
+        {
+            Glib::OptionEntry entry;
+            entry.set_short_name('S');
+            entry.set_long_name("statistics");
+            entry.set_description("Print statistics counters");
+            main_group.add_entry(entry, arguments.print_statistics);
+        }
+
         {
             Glib::OptionEntry entry;
             entry.set_short_name('m');
@@ -22,6 +22,7 @@ namespace UserIdentificationManager::Cli
 
         bool print_identified_users = false;
         bool print_sources = false;
+        bool print_statistics = false;
 
         bool monitor = false;
     };
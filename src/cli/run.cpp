@@ -32,33 +32,43 @@ namespace UserIdentificationManager::Cli
 
         void print_identified_user_line(const std::string &prefix,
                                         const std::string &user_identification_id,
-                                        guint16 seat_id)
+                                        guint16 seat_id,
+                                        guint64 sequence_number,
+                                        gint64 timestamp)
         {
             std::cout << prefix << user_identification_id << ", 0x" << std::setfill('0')
-                      << std::setw(4) << std::hex << seat_id << '\n';
+                      << std::setw(4) << std::hex << seat_id << std::dec << ", "
+                      << sequence_number << ", " << timestamp << '\n';
         }
 
         bool print_identified_users(const Glib::RefPtr<ManagerProxy> &manager_proxy)
         {
-            std::vector<std::tuple<Glib::ustring, guint16>> users;
+            std::vector<std::tuple<Glib::ustring, guint16, guint64, gint64>> users;
 
             try {
-                users = manager_proxy->GetIdentifiedUsers_sync();
+                // Unlike GetIdentifiedUsers, includes sequence numbers and timestamps.
+                std::tie(users, std::ignore, std::ignore) =
+                    manager_proxy->GetIdentifiedUsersSince_sync(0);
             } catch (const Glib::Error &e) {
                 std::cout << "Failed to get identified users: " << e.what() << '\n';
                 return false;
             }
 
-            std::cout << "Identified users (user identification id, seat id):\n";
+            std::cout << "Identified users (user identification id, seat id, sequence number, "
+                         "timestamp):\n";
 
             if (users.empty()) {
                 std::cout << "  None\n";
             } else {
                 for (const auto &user : users) {
-                    const Glib::ustring &user_identification_id = std::get<0>(user);
-                    guint16 seat_id = std::get<1>(user);
-
-                    print_identified_user_line("  ", user_identification_id.raw(), seat_id);
+                    const auto &[user_identification_id, seat_id, sequence_number, timestamp] =
+                        user;
+
+                    print_identified_user_line("  ",
+                                               user_identification_id.raw(),
+                                               seat_id,
+                                               sequence_number,
+                                               timestamp);
                 }
             }
 
@@ -100,6 +110,30 @@ namespace UserIdentificationManager::Cli
             return true;
         }
 
+        bool print_statistics(const Glib::RefPtr<ManagerProxy> &manager_proxy)
+        {
+            std::vector<std::tuple<Glib::ustring, guint64>> statistics;
+
+            try {
+                statistics = manager_proxy->GetStatistics_sync();
+            } catch (const Glib::Error &e) {
+                std::cout << "Failed to get statistics: " << e.what() << '\n';
+                return false;
+            }
+
+            std::cout << "Statistics:\n";
+
+            if (statistics.empty()) {
+                std::cout << "  None\n";
+            } else {
+                for (const auto &[name, value] : statistics) {
+                    std::cout << "  " << name << ": " << value << '\n';
+                }
+            }
+
+            return true;
+        }
+
         bool monitor_until_ctrl_c(const Glib::RefPtr<ManagerProxy> &manager_proxy)
         {
             Glib::RefPtr<Glib::MainLoop> main_loop = Glib::MainLoop::create();
@@ -112,9 +146,13 @@ namespace UserIdentificationManager::Cli
 
             std::cout << "Waiting for users to be identified, press Ctrl-C to quit.\n";
 
-            manager_proxy->UserIdentified_signal.connect(
-                [](const Glib::ustring &user_identification_id, guint16 seat_id) {
-                    print_identified_user_line("", user_identification_id.raw(), seat_id);
+            manager_proxy->UserIdentifiedWithSequence_signal.connect(
+                [](const Glib::ustring &user_identification_id,
+                   guint16 seat_id,
+                   guint64 sequence_number,
+                   gint64 timestamp) {
+                    print_identified_user_line(
+                        "", user_identification_id.raw(), seat_id, sequence_number, timestamp);
                 });
 
             main_loop->run();
@@ -139,6 +177,12 @@ namespace UserIdentificationManager::Cli
             }
         }
 
+        if (arguments.print_statistics) {
+            if (!print_statistics(manager_proxy)) {
+                return EXIT_FAILURE;
+            }
+        }
+
         if (arguments.monitor) {
             if (!monitor_until_ctrl_c(manager_proxy)) {
                 return EXIT_FAILURE;
@@ -0,0 +1,327 @@
+// Copyright (C) 2019 Luxoft Sweden AB
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+//
+// SPDX-License-Identifier: MPL-2.0
+
+#ifndef UIM_DAEMON_ATR_H
+#define UIM_DAEMON_ATR_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <string_view>
+
+#include "daemon/inline_bytes.h"
+
+namespace UserIdentificationManager::Daemon
+{
+    // Answer To Reset parsing and classification of cards by ATR.
+    //
+    // Everything is constexpr so that the card table is checked and indexed at compile time and
+    // classification in the card present path is bounded by the maximum ATR size plus a table
+    // lookup. See:
+    // - ISO/IEC 7816-3 and https://en.wikipedia.org/wiki/Answer_to_reset for the ATR structure.
+    // - "3.1.3.2.3  ATR" in https://muscle.apdu.fr/www.pcscworkgroup.com/PCSC/V2/pcsc3_v2.01.09.pdf
+    //   for the ATR PC/SC readers build for contactless cards.
+    // - "PC/SC Part 3 Supplemental Document" for standard and card name bytes.
+    namespace Atr
+    {
+        constexpr std::size_t MAX_SIZE = 33;
+
+        using Bytes = InlineBytes<MAX_SIZE>;
+
+        struct Parsed
+        {
+            bool valid = false;
+            // Bit n set if T=n is indicated. T=0 is implicit if no protocol is indicated.
+            std::uint16_t protocols = 0;
+            // TD1 and TD2, 0 if not present.
+            std::uint8_t td1 = 0;
+            std::uint8_t td2 = 0;
+            std::size_t historical_bytes_offset = 0;
+            std::size_t historical_bytes_size = 0;
+        };
+
+        // Parse the interface bytes and locate the historical bytes. The ATR is only valid if its
+        // size matches what T0 and TDi indicate and TCK, if present, is correct.
+        constexpr Parsed parse(const std::uint8_t *atr, std::size_t size)
+        {
+            constexpr std::uint8_t TS_DIRECT = 0x3b;
+            constexpr std::uint8_t TS_INVERSE = 0x3f;
+            constexpr std::uint8_t TA_PRESENT = 0x1;
+            constexpr std::uint8_t TB_PRESENT = 0x2;
+            constexpr std::uint8_t TC_PRESENT = 0x4;
+            constexpr std::uint8_t TD_PRESENT = 0x8;
+
+            Parsed parsed;
+
+            if (size < 2 || size > MAX_SIZE || (atr[0] != TS_DIRECT && atr[0] != TS_INVERSE)) {
+                return parsed;
+            }
+
+            std::uint8_t indicator = atr[1] >> 4;
+            std::size_t pos = 2;
+            bool tck_present = false;
+
+            for (unsigned int i = 1;; i++) {
+                pos += (indicator & TA_PRESENT ? 1 : 0) + (indicator & TB_PRESENT ? 1 : 0) +
+                       (indicator & TC_PRESENT ? 1 : 0);
+
+                if (!(indicator & TD_PRESENT)) {
+                    break;
+                }
+
+                if (pos >= size) {
+                    return parsed;
+                }
+
+                std::uint8_t td = atr[pos++];
+                std::uint8_t protocol = td & 0x0f;
+
+                if (i == 1) {
+                    parsed.td1 = td;
+                } else if (i == 2) {
+                    parsed.td2 = td;
+                }
+
+                parsed.protocols |= 1U << protocol;
+                tck_present = tck_present || protocol != 0;
+                indicator = td >> 4;
+            }
+
+            if (parsed.protocols == 0) {
+                parsed.protocols = 1U << 0;
+            }
+
+            parsed.historical_bytes_offset = pos;
+            parsed.historical_bytes_size = atr[1] & 0x0f;
+            pos += parsed.historical_bytes_size;
+
+            if (tck_present) {
+                std::uint8_t check = 0;
+
+                for (std::size_t i = 1; i <= pos && i < size; i++) {
+                    check ^= atr[i];
+                }
+
+                if (check != 0) {
+                    return parsed;
+                }
+
+                pos++;
+            }
+
+            parsed.valid = pos == size;
+
+            return parsed;
+        }
+
+        // Ways to read an ID from a card. See UIDExtractor.
+        enum class UIDStrategy
+        {
+            NONE,
+            // PC/SC Get Data pseudo APDU handled by the reader, FF CA 00 00 00.
+            GET_DATA,
+            // Select the NFC Forum Type 4 Tag application and read the NDEF message, for
+            // ISO 14443-4 cards with a random UID. Never tried unless suggested by an entry in the
+            // card table since anyone holding the card can write the message.
+            ISO_14443_4_SELECT_READ,
+            // InListPassiveTarget sent to the PN532 of ACS readers with a direct transmit escape
+            // APDU, for reader firmware without Get Data. Only tried on ACS readers with a
+            // PN532, identified by reader name.
+            ACS_DIRECT_TRANSMIT
+        };
+
+        enum class CardType
+        {
+            // Not a contactless card, or an invalid ATR. No ID is read from it.
+            UNKNOWN,
+            // Contactless memory card, e.g. MIFARE Classic, identified by standard and card name.
+            CONTACTLESS_STORAGE,
+            // Contactless ISO 14443-4 card, e.g. MIFARE DESFire. The historical bytes are taken
+            // from ATS (type A) or ATQB (type B).
+            CONTACTLESS_ISO_14443_4
+        };
+
+        struct Classification
+        {
+            CardType type = CardType::UNKNOWN;
+            // Name for logging, empty if not known.
+            std::string_view name;
+            // Strategy to try first, NONE if the card is not in the table and the default order of
+            // UIDExtractor is to be used.
+            UIDStrategy uid_strategy = UIDStrategy::NONE;
+        };
+
+        namespace Detail
+        {
+            struct StorageCard
+            {
+                std::uint16_t card_name;
+                std::string_view name;
+                UIDStrategy uid_strategy;
+            };
+
+            // Card name bytes NN NN from PC/SC part 3 supplemental document. The reader knows
+            // the UID of all contactless memory cards it has detected, so Get Data is used for
+            // all of them.
+            constexpr StorageCard STORAGE_CARDS[] = {
+                {0x0001, "MIFARE Classic 1K", UIDStrategy::GET_DATA},
+                {0x0002, "MIFARE Classic 4K", UIDStrategy::GET_DATA},
+                {0x0003, "MIFARE Ultralight", UIDStrategy::GET_DATA},
+                {0x0004, "SLE55R", UIDStrategy::GET_DATA},
+                {0x0006, "SR176", UIDStrategy::GET_DATA},
+                {0x0007, "SRI X4K", UIDStrategy::GET_DATA},
+                {0x0012, "Tag-it", UIDStrategy::GET_DATA},
+                {0x0013, "LRI512", UIDStrategy::GET_DATA},
+                {0x0014, "ICODE SLI", UIDStrategy::GET_DATA},
+                {0x0016, "ICODE1", UIDStrategy::GET_DATA},
+                {0x0017, "PicoPass 2K", UIDStrategy::GET_DATA},
+                {0x0018, "PicoPass 2KS", UIDStrategy::GET_DATA},
+                {0x0019, "PicoPass 16K", UIDStrategy::GET_DATA},
+                {0x001a, "PicoPass 16KS", UIDStrategy::GET_DATA},
+                {0x0021, "LRI64", UIDStrategy::GET_DATA},
+                {0x0022, "ICODE UID", UIDStrategy::GET_DATA},
+                {0x0023, "ICODE EPC", UIDStrategy::GET_DATA},
+                {0x0026, "MIFARE Mini", UIDStrategy::GET_DATA},
+                {0x002f, "Jewel", UIDStrategy::GET_DATA},
+                {0x0030, "Topaz", UIDStrategy::GET_DATA},
+                {0x0036, "MIFARE Plus SL1 2K", UIDStrategy::GET_DATA},
+                {0x0037, "MIFARE Plus SL1 4K", UIDStrategy::GET_DATA},
+                {0x0038, "MIFARE Plus SL2 2K", UIDStrategy::GET_DATA},
+                {0x0039, "MIFARE Plus SL2 4K", UIDStrategy::GET_DATA},
+                {0x003a, "MIFARE Ultralight C", UIDStrategy::GET_DATA},
+                {0x003b, "FeliCa", UIDStrategy::GET_DATA},
+                {0x003d, "MIFARE Ultralight EV1", UIDStrategy::GET_DATA}};
+
+            constexpr std::size_t STORAGE_CARD_INDEX_SIZE = 0x100;
+
+            // Maps card name to 1 + index in STORAGE_CARDS, 0 if not in table.
+            constexpr std::array<std::uint8_t, STORAGE_CARD_INDEX_SIZE> make_storage_card_index()
+            {
+                std::array<std::uint8_t, STORAGE_CARD_INDEX_SIZE> index{};
+
+                for (std::size_t i = 0; i < std::size(STORAGE_CARDS); i++) {
+                    index[STORAGE_CARDS[i].card_name] = i + 1;
+                }
+
+                return index;
+            }
+
+            constexpr bool storage_card_table_valid()
+            {
+                std::array<bool, STORAGE_CARD_INDEX_SIZE> seen{};
+
+                for (const StorageCard &card : STORAGE_CARDS) {
+                    if (card.card_name >= STORAGE_CARD_INDEX_SIZE || seen[card.card_name]) {
+                        return false;
+                    }
+                    seen[card.card_name] = true;
+                }
+
+                return std::size(STORAGE_CARDS) < 0xff;
+            }
+
+            static_assert(storage_card_table_valid(),
+                          "Card names must be unique and fit the card name index");
+
+            constexpr std::array<std::uint8_t, STORAGE_CARD_INDEX_SIZE> STORAGE_CARD_INDEX =
+                make_storage_card_index();
+
+            struct Iso14443Part4Card
+            {
+                // Historical bytes of the ATR, taken from ATS or ATQB, matched exactly.
+                std::string_view historical_bytes;
+                std::string_view name;
+                UIDStrategy uid_strategy;
+            };
+
+            // Only cards that need a particular strategy or are worth naming in logs. There is
+            // no card name in the historical bytes of ISO 14443-4 cards, so the table is small and
+            // searched linearly.
+            constexpr Iso14443Part4Card ISO_14443_4_CARDS[] = {
+                // Phones emulating a card send no historical bytes. Their UID is random on every
+                // tap, so the NDEF message is the only stable ID.
+                {{}, "ISO 14443-4 card emulation", UIDStrategy::ISO_14443_4_SELECT_READ},
+                // ATS of MIFARE DESFire EV1, only the category indicator.
+                {"\x80", "MIFARE DESFire", UIDStrategy::GET_DATA}};
+
+            constexpr bool historical_bytes_equal(const std::uint8_t *historical_bytes,
+                                                  std::size_t size,
+                                                  std::string_view expected)
+            {
+                if (size != expected.size()) {
+                    return false;
+                }
+
+                for (std::size_t i = 0; i < size; i++) {
+                    if (historical_bytes[i] != static_cast<std::uint8_t>(expected[i])) {
+                        return false;
+                    }
+                }
+
+                return true;
+            }
+
+            // Interface bytes of the ATR PC/SC readers build for contactless cards, T=0 then T=1.
+            constexpr std::uint8_t CONTACTLESS_TD1 = 0x80;
+            constexpr std::uint8_t CONTACTLESS_TD2 = 0x01;
+
+            // Historical bytes for storage cards: category indicator, application identifier
+            // presence tag, length, PC/SC RID, standard SS, card name NN NN and 4 RFU bytes.
+            constexpr std::uint8_t STORAGE_CARD_PREFIX[] = {
+                0x80, 0x4f, 0x0c, 0xa0, 0x00, 0x00, 0x03, 0x06};
+            constexpr std::size_t STORAGE_CARD_HISTORICAL_BYTES_SIZE = 15;
+            constexpr std::size_t STORAGE_CARD_NAME_OFFSET = 9;
+        }
+
+        constexpr Classification classify(const std::uint8_t *atr, std::size_t size)
+        {
+            using namespace Detail;
+
+            Parsed parsed = parse(atr, size);
+
+            if (!parsed.valid || parsed.td1 != CONTACTLESS_TD1 || parsed.td2 != CONTACTLESS_TD2) {
+                return {};
+            }
+
+            const std::uint8_t *historical_bytes = atr + parsed.historical_bytes_offset;
+            bool storage_card = parsed.historical_bytes_size == STORAGE_CARD_HISTORICAL_BYTES_SIZE;
+
+            for (std::size_t i = 0; storage_card && i < std::size(STORAGE_CARD_PREFIX); i++) {
+                storage_card = historical_bytes[i] == STORAGE_CARD_PREFIX[i];
+            }
+
+            if (!storage_card) {
+                for (const Iso14443Part4Card &card : ISO_14443_4_CARDS) {
+                    if (historical_bytes_equal(historical_bytes,
+                                               parsed.historical_bytes_size,
+                                               card.historical_bytes)) {
+                        return {CardType::CONTACTLESS_ISO_14443_4, card.name, card.uid_strategy};
+                    }
+                }
+
+                return {CardType::CONTACTLESS_ISO_14443_4, {}, UIDStrategy::NONE};
+            }
+
+            std::uint16_t card_name = historical_bytes[STORAGE_CARD_NAME_OFFSET] << 8 |
+                                      historical_bytes[STORAGE_CARD_NAME_OFFSET + 1];
+            std::uint8_t index =
+                card_name < STORAGE_CARD_INDEX_SIZE ? STORAGE_CARD_INDEX[card_name] : 0;
+
+            if (index == 0) {
+                return {CardType::CONTACTLESS_STORAGE, {}, UIDStrategy::NONE};
+            }
+
+            const StorageCard &card = STORAGE_CARDS[index - 1];
+
+            return {CardType::CONTACTLESS_STORAGE, card.name, card.uid_strategy};
+        }
+    }
+}
+
+#endif // UIM_DAEMON_ATR_H
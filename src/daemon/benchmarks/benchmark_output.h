@@ -0,0 +1,49 @@
+// Copyright (C) 2019 Luxoft Sweden AB
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+//
+// SPDX-License-Identifier: MPL-2.0
+
+#ifndef UIM_DAEMON_BENCHMARKS_BENCHMARK_OUTPUT_H
+#define UIM_DAEMON_BENCHMARKS_BENCHMARK_OUTPUT_H
+
+#include <iostream>
+#include <sstream>
+#include <string>
+
+namespace UserIdentificationManager::Daemon::Benchmarks
+{
+    // Prints one benchmark result as a JSON object on a single line, e.g.:
+    //
+    // {"benchmark": "idle_queue_push_throughput", "producers": 4, "values_per_second": 1.2e+07}
+    //
+    // One object per line makes output easy to both read and process by scripts comparing runs.
+    // Names are expected to not need escaping.
+    class Output
+    {
+    public:
+        explicit Output(const std::string &benchmark)
+        {
+            stream_ << std::boolalpha << R"({"benchmark": ")" << benchmark << '"';
+        }
+
+        template <typename T>
+        Output &add(const std::string &name, T value)
+        {
+            stream_ << R"(, ")" << name << R"(": )" << value;
+            return *this;
+        }
+
+        void print()
+        {
+            std::cout << stream_.str() << "}\n" << std::flush;
+        }
+
+    private:
+        std::ostringstream stream_;
+    };
+}
+
+#endif // UIM_DAEMON_BENCHMARKS_BENCHMARK_OUTPUT_H
@@ -0,0 +1,245 @@
+// Copyright (C) 2019 Luxoft Sweden AB
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+//
+// SPDX-License-Identifier: MPL-2.0
+
+#include <glibmm.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "daemon/benchmarks/benchmark_output.h"
+#include "daemon/idle_queue.h"
+
+// Count all allocations made through operator new. Only the count is of interest, allocation is
+// forwarded to malloc().
+namespace
+{
+    std::atomic<std::uint64_t> allocation_count{0};
+}
+
+void *operator new(std::size_t size)
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+
+    void *ptr = std::malloc(size == 0 ? 1 : size); // NOLINT(cppcoreguidelines-no-malloc)
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+    std::free(ptr); // NOLINT(cppcoreguidelines-no-malloc)
+}
+
+void operator delete(void *ptr, std::size_t /*size*/) noexcept
+{
+    std::free(ptr); // NOLINT(cppcoreguidelines-no-malloc)
+}
+
+namespace UserIdentificationManager::Daemon::Benchmarks
+{
+    namespace
+    {
+        using Clock = std::chrono::steady_clock;
+
+        constexpr unsigned int VALUES_PER_PRODUCER = 200000;
+        constexpr unsigned int LATENCY_SAMPLES = 2000;
+        constexpr unsigned int ALLOCATION_SAMPLES = 10000;
+
+        double to_seconds(Clock::duration duration)
+        {
+            return std::chrono::duration<double>(duration).count();
+        }
+
+        std::uint64_t to_nanoseconds(Clock::duration duration)
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+        }
+
+        // Producers push as fast as they can while the main loop pops. A full queue is retried
+        // so that every value passes through the queue.
+        void push_throughput(unsigned int num_producers)
+        {
+            const unsigned int num_values = num_producers * VALUES_PER_PRODUCER;
+            Glib::RefPtr<Glib::MainLoop> main_loop = Glib::MainLoop::create();
+            IdleQueue<unsigned int> idle_queue;
+            std::vector<std::thread> producers;
+            std::atomic<std::uint64_t> full_count{0};
+            unsigned int num_popped = 0;
+
+            idle_queue.set_batch_callback([&](IdleQueue<unsigned int>::Batch batch) {
+                num_popped += batch.size();
+
+                if (num_popped == num_values) {
+                    main_loop->quit();
+                }
+            });
+
+            Clock::time_point start = Clock::now();
+
+            for (unsigned int p = 0; p < num_producers; p++) {
+                producers.emplace_back([&] {
+                    for (unsigned int i = 0; i < VALUES_PER_PRODUCER; i++) {
+                        unsigned int value = i;
+
+                        while (!idle_queue.push(std::move(value))) {
+                            full_count.fetch_add(1, std::memory_order_relaxed);
+                            std::this_thread::yield();
+                        }
+                    }
+                });
+            }
+
+            main_loop->run();
+
+            Clock::duration duration = Clock::now() - start;
+
+            for (std::thread &producer : producers) {
+                producer.join();
+            }
+
+            Output("idle_queue_push_throughput")
+                .add("producers", num_producers)
+                .add("values", num_values)
+                .add("seconds", to_seconds(duration))
+                .add("values_per_second", num_values / to_seconds(duration))
+                .add("full_retries", full_count.load())
+                .print();
+        }
+
+        // Time from push() in another thread until callback is invoked in main thread. If busy, the
+        // main loop always has something to do at default priority, e.g. steady D-Bus traffic.
+        void push_to_callback_latency(bool busy)
+        {
+            Glib::RefPtr<Glib::MainLoop> main_loop = Glib::MainLoop::create();
+            IdleQueue<Clock::time_point> idle_queue;
+            std::vector<Clock::duration> latencies;
+
+            latencies.reserve(LATENCY_SAMPLES);
+
+            idle_queue.set_callback([&](Clock::time_point push_time) {
+                latencies.emplace_back(Clock::now() - push_time);
+
+                if (latencies.size() == LATENCY_SAMPLES) {
+                    main_loop->quit();
+                }
+            });
+
+            auto busy_function = [](void * /*unused*/) -> gboolean {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                return G_SOURCE_CONTINUE;
+            };
+            guint busy_source_id =
+                busy ? g_idle_add_full(G_PRIORITY_DEFAULT, busy_function, nullptr, nullptr) : 0;
+
+            std::thread producer([&] {
+                for (unsigned int i = 0; i < LATENCY_SAMPLES; i++) {
+                    idle_queue.push(Clock::now());
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+                }
+            });
+
+            main_loop->run();
+            producer.join();
+
+            if (busy_source_id != 0) {
+                g_source_remove(busy_source_id);
+            }
+
+            std::sort(latencies.begin(), latencies.end());
+
+            Output("idle_queue_push_to_callback_latency")
+                .add("main_loop_busy", busy)
+                .add("samples", LATENCY_SAMPLES)
+                .add("p50_ns", to_nanoseconds(latencies[latencies.size() / 2]))
+                .add("p99_ns", to_nanoseconds(latencies[latencies.size() * 99 / 100]))
+                .add("max_ns", to_nanoseconds(latencies.back()))
+                .print();
+        }
+
+        // Allocations per value pushed and popped, after a warm up round. Expected to be 0.
+        void allocations_per_event()
+        {
+            Glib::RefPtr<Glib::MainLoop> main_loop = Glib::MainLoop::create();
+            IdleQueue<unsigned int> idle_queue;
+            unsigned int num_popped = 0;
+            unsigned int num_expected = 0;
+
+            idle_queue.set_batch_callback([&](IdleQueue<unsigned int>::Batch batch) {
+                num_popped += batch.size();
+
+                if (num_popped == num_expected) {
+                    main_loop->quit();
+                }
+            });
+
+            auto push_and_pop = [&](unsigned int num_values) {
+                for (unsigned int i = 0; i < num_values; i++) {
+                    unsigned int value = i;
+
+                    if (idle_queue.push(std::move(value))) {
+                        num_expected++;
+                    }
+
+                    if (i % (idle_queue.capacity() / 2) == 0) {
+                        g_main_context_iteration(nullptr, FALSE);
+                    }
+                }
+
+                if (num_popped != num_expected) {
+                    main_loop->run();
+                }
+            };
+
+            push_and_pop(ALLOCATION_SAMPLES);
+
+            std::uint64_t count_before = allocation_count.load();
+            push_and_pop(ALLOCATION_SAMPLES);
+            std::uint64_t count_after = allocation_count.load();
+
+            Output("idle_queue_allocations_per_event")
+                .add("values", ALLOCATION_SAMPLES)
+                .add("allocations", count_after - count_before)
+                .add("allocations_per_event",
+                     double(count_after - count_before) / ALLOCATION_SAMPLES)
+                .print();
+        }
+    }
+
+    void run_idle_queue_benchmarks()
+    {
+        const unsigned int max_producers = std::max(2U, std::thread::hardware_concurrency());
+
+        for (unsigned int num_producers = 1; num_producers <= max_producers; num_producers *= 2) {
+            push_throughput(num_producers);
+        }
+
+        push_to_callback_latency(false);
+        push_to_callback_latency(true);
+        allocations_per_event();
+    }
+}
+
+int main()
+{
+    Glib::init();
+
+    UserIdentificationManager::Daemon::Benchmarks::run_idle_queue_benchmarks();
+
+    return EXIT_SUCCESS;
+}
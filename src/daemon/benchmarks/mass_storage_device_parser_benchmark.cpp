@@ -0,0 +1,176 @@
+// Copyright (C) 2019 Luxoft Sweden AB
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+//
+// SPDX-License-Identifier: MPL-2.0
+
+#include <glibmm.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "common/scoped_silent_log_handler.h"
+#include "daemon/benchmarks/benchmark_output.h"
+#include "daemon/benchmarks/mass_storage_device_parser_reference.h"
+#include "daemon/id_sources/mass_storage_device_id_source.h"
+
+// Count all allocations made through operator new. Only the count is of interest, allocation is
+// forwarded to malloc().
+namespace
+{
+    std::atomic<std::uint64_t> allocation_count{0};
+}
+
+void *operator new(std::size_t size)
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+
+    void *ptr = std::malloc(size == 0 ? 1 : size); // NOLINT(cppcoreguidelines-no-malloc)
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+    std::free(ptr); // NOLINT(cppcoreguidelines-no-malloc)
+}
+
+void operator delete(void *ptr, std::size_t /*size*/) noexcept
+{
+    std::free(ptr); // NOLINT(cppcoreguidelines-no-malloc)
+}
+
+namespace UserIdentificationManager::Daemon::Benchmarks
+{
+    namespace
+    {
+        using Clock = std::chrono::steady_clock;
+
+        constexpr unsigned int ITERATIONS = 1000000;
+        const std::string PATH = "pelux-user-id";
+
+        // Valid files, as written by hand and with ids to copy paste below, and invalid files
+        // rejected early and late.
+        const std::vector<std::pair<std::string, std::string>> FILES = {
+            {"valid", "ID 1234\nSEAT 0x5678\n"},
+            {"valid_long_id", "ID 12345678901234567890123456789012\nSEAT 0xffff\n"},
+            {"valid_trailing_lines", "ID 1\nSEAT 0x2345\nID 2\nSEAT 0x0\nID 3\nSEAT 0x1\n"},
+            {"invalid_id", "ID 12a4\nSEAT 0x5678\n"},
+            {"invalid_seat", "ID 1234\nSEAT 0x15678\n"}};
+
+        // Edge cases of the format, in addition to FILES. The fuzzer covers the rest.
+        const std::vector<std::string> EQUIVALENCE_INPUTS = {
+            "",
+            "\n",
+            "\n\n",
+            "ID 1\n",
+            "ID 1\nSEAT 0x1",
+            "ID 1\r\nSEAT 0x1\r\n",
+            "ID \nSEAT 0x1",
+            "ID 1\nSEAT 0x",
+            "ID 1\nSEAT 0x0x1",
+            "ID 1\nSEAT 0X1",
+            "ID 1\nSEAT 0x+1",
+            "ID 1\nSEAT 0x-0",
+            "ID 1\nSEAT 0x 1",
+            "ID 1\nSEAT 0xAbCd",
+            "ID 1\nSEAT 0x000000000000000000001",
+            "ID 1\nSEAT 0x10000",
+            "ID 1\nSEAT 0xffffffffffffffffffff",
+            std::string("ID 1\nSEAT 0x12\0zz", 17),
+            std::string("ID 1\0\nSEAT 0x12", 15),
+            std::string("\0ID 1\nSEAT 0x12", 15)};
+
+        double to_nanoseconds(Clock::duration duration)
+        {
+            return std::chrono::duration<double, std::nano>(duration).count();
+        }
+
+        bool check_equivalence()
+        {
+            Common::ScopedSilentLogHandler log_handler;
+            std::vector<std::string> inputs = EQUIVALENCE_INPUTS;
+            bool equivalent = true;
+
+            for (const auto &[name, contents] : FILES) {
+                inputs.emplace_back(contents);
+            }
+
+            for (const std::string &input : inputs) {
+                if (!same_result(reference_parse(input),
+                                 MassStorageDeviceIdSource::Parser::parse(PATH, input))) {
+                    std::cerr << "Parsers differ for input: \"" << input << "\"\n";
+                    equivalent = false;
+                }
+            }
+
+            return equivalent;
+        }
+
+        template <typename Parse>
+        void parse(const std::string &parser, const std::string &file, Parse &&parse_contents)
+        {
+            Common::ScopedSilentLogHandler log_handler;
+            unsigned int num_parsed = 0;
+            std::uint64_t count_before = allocation_count.load();
+            Clock::time_point start = Clock::now();
+
+            for (unsigned int i = 0; i < ITERATIONS; i++) {
+                if (parse_contents()) {
+                    num_parsed++;
+                }
+            }
+
+            Clock::duration duration = Clock::now() - start;
+            std::uint64_t count_after = allocation_count.load();
+
+            Output("mass_storage_device_parser")
+                .add("parser", '"' + parser + '"')
+                .add("file", '"' + file + '"')
+                .add("iterations", ITERATIONS)
+                .add("parsed", num_parsed)
+                .add("ns_per_parse", to_nanoseconds(duration) / ITERATIONS)
+                .add("allocations_per_parse", double(count_after - count_before) / ITERATIONS)
+                .print();
+        }
+    }
+
+    int run_mass_storage_device_parser_benchmarks()
+    {
+        if (!check_equivalence()) {
+            return EXIT_FAILURE;
+        }
+
+        for (const auto &[name, contents] : FILES) {
+            parse("reference", name, [&contents = contents] {
+                return reference_parse(contents).has_value();
+            });
+            parse("string_view", name, [&contents = contents] {
+                return MassStorageDeviceIdSource::Parser::parse(PATH, contents).has_value();
+            });
+        }
+
+        return EXIT_SUCCESS;
+    }
+}
+
+int main()
+{
+    Glib::init();
+
+    return UserIdentificationManager::Daemon::Benchmarks::
+        run_mass_storage_device_parser_benchmarks();
+}
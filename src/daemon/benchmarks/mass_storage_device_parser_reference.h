@@ -0,0 +1,105 @@
+// Copyright (C) 2019 Luxoft Sweden AB
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+//
+// SPDX-License-Identifier: MPL-2.0
+
+#ifndef UIM_DAEMON_BENCHMARKS_MASS_STORAGE_DEVICE_PARSER_REFERENCE_H
+#define UIM_DAEMON_BENCHMARKS_MASS_STORAGE_DEVICE_PARSER_REFERENCE_H
+
+#include <glib.h>
+
+#include <optional>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "daemon/id_source.h"
+
+namespace UserIdentificationManager::Daemon::Benchmarks
+{
+    // The MassStorageDeviceIdSource::Parser implementation that reads lines into strings and
+    // uses g_ascii_string_to_unsigned(), minus logging. Kept as reference for the benchmark and
+    // fuzzer comparing it with the current implementation.
+    inline std::optional<IdSource::IdentifiedUser> reference_parse(const std::string &contents)
+    {
+        std::istringstream stream(contents);
+        std::vector<std::string> lines;
+
+        for (unsigned int i = 0; i < 2; i++) {
+            std::string line;
+
+            if (!std::getline(stream, line)) {
+                return {};
+            }
+
+            lines.emplace_back(std::move(line));
+        }
+
+        auto string_starts_with = [](const std::string &str, const std::string &start) {
+            return str.compare(0, start.size(), start) == 0;
+        };
+        auto string_is_numeric = [](const std::string &str) {
+            for (char c : str) {
+                if (c < '0' || c > '9') {
+                    return false;
+                }
+            }
+            return true;
+        };
+
+        const std::string id_prefix = "ID ";
+        const std::string seat_prefix = "SEAT ";
+        const std::string &id_line = lines[0];
+        const std::string &seat_line = lines[1];
+
+        if (!string_starts_with(id_line, id_prefix) ||
+            !string_starts_with(seat_line, seat_prefix)) {
+            return {};
+        }
+
+        const std::string id_str = id_line.substr(id_prefix.size());
+        const std::string seat_str = seat_line.substr(seat_prefix.size());
+
+        if (id_str.empty() || !string_is_numeric(id_str)) {
+            return {};
+        }
+
+        constexpr unsigned int SEAT_ID_BASE = 16;
+        const std::string seat_id_hex_prefix = "0x";
+        guint64 seat_id = 0;
+
+        if (!string_starts_with(seat_str, seat_id_hex_prefix) ||
+            !g_ascii_string_to_unsigned(seat_str.c_str() + seat_id_hex_prefix.size(),
+                                        SEAT_ID_BASE,
+                                        IdSource::SEAT_ID_MIN,
+                                        IdSource::SEAT_ID_MAX,
+                                        &seat_id,
+                                        nullptr)) {
+            return {};
+        }
+
+        IdSource::IdentifiedUser identified_user;
+
+        identified_user.user_identification_id = std::string("MSD-") + id_str;
+        identified_user.seat_id = seat_id;
+
+        return identified_user;
+    }
+
+    inline bool same_result(const std::optional<IdSource::IdentifiedUser> &a,
+                            const std::optional<IdSource::IdentifiedUser> &b)
+    {
+        if (!a || !b) {
+            return !a && !b;
+        }
+
+        return a->user_identification_id == b->user_identification_id &&
+               a->seat_id == b->seat_id;
+    }
+}
+
+#endif // UIM_DAEMON_BENCHMARKS_MASS_STORAGE_DEVICE_PARSER_REFERENCE_H
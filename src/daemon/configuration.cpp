@@ -11,6 +11,8 @@
 #include <glib.h>
 #include <glibmm.h>
 
+#include <cstddef>
+#include <cstdint>
 #include <utility>
 
 namespace UserIdentificationManager::Daemon
@@ -32,6 +34,34 @@ namespace UserIdentificationManager::Daemon
 
             return value;
         }
+
+        std::size_t get_history_capacity(const Glib::KeyFile &key_file,
+                                          const std::string &file_name,
+                                          std::size_t default_value)
+        {
+            if (!key_file.has_group("history") || !key_file.has_key("history", "capacity")) {
+                return default_value;
+            }
+
+            std::uint64_t value = 0;
+
+            try {
+                value = key_file.get_uint64("history", "capacity");
+            } catch (const Glib::Error &e) {
+                g_warning("%s: invalid history capacity: %s", file_name.c_str(), e.what().c_str());
+                return default_value;
+            }
+
+            if (value > Configuration::MAX_HISTORY_CAPACITY) {
+                g_warning("%s: history capacity %llu larger than %zu, ignored",
+                          file_name.c_str(),
+                          static_cast<unsigned long long>(value),
+                          Configuration::MAX_HISTORY_CAPACITY);
+                return default_value;
+            }
+
+            return value;
+        }
     }
 
     Configuration Configuration::from_file(const std::string &file_name)
@@ -55,6 +85,8 @@ namespace UserIdentificationManager::Daemon
         }
 
         config.sources_enable = get_string_list(key_file, "sources", "enable", {});
+        config.history_capacity =
+            get_history_capacity(key_file, file_name, config.history_capacity);
 
         return config;
     }
@@ -9,6 +9,7 @@
 #ifndef UIM_DAEMON_CONFIGURATION_H
 #define UIM_DAEMON_CONFIGURATION_H
 
+#include <cstddef>
 #include <optional>
 #include <string>
 #include <vector>
@@ -19,11 +20,16 @@ namespace UserIdentificationManager::Daemon
 {
     struct Configuration
     {
+        // Larger history capacities are ignored, users identified take about 100 bytes each.
+        static constexpr std::size_t MAX_HISTORY_CAPACITY = 100000;
+
         static Configuration from_file(const std::string &file_name);
 
         std::string config_file = UIM_CONFIG_DAEMON_DEFAULT_CONFIG_FILE;
 
         std::vector<std::string> sources_enable; // Empty means enable all.
+
+        std::size_t history_capacity = UIM_CONFIG_DAEMON_DEFAULT_HISTORY_CAPACITY;
     };
 }
 
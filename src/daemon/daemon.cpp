@@ -73,6 +73,7 @@ namespace UserIdentificationManager::Daemon
     {
         configuration_ = std::move(new_config);
 
+        id_source_group_.set_history_capacity(configuration_.history_capacity);
         id_source_group_.enable(configuration_.sources_enable);
     }
 
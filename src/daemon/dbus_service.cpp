@@ -11,6 +11,8 @@
 #include <giomm.h>
 #include <glibmm.h>
 
+#include <cstdint>
+#include <map>
 #include <string>
 #include <tuple>
 #include <vector>
@@ -19,6 +21,40 @@
 
 namespace UserIdentificationManager::Daemon
 {
+    namespace
+    {
+        std::vector<std::tuple<Glib::ustring, guint16>> to_dbus(
+            const IdSource::Group::IdentifiedUsers &identified_users)
+        {
+            std::vector<std::tuple<Glib::ustring, guint16>> result;
+
+            result.reserve(identified_users.size());
+
+            for (const IdSource::IdentifiedUser &user : identified_users) {
+                result.emplace_back(user.user_identification_id.c_str(), user.seat_id);
+            }
+
+            return result;
+        }
+
+        std::vector<std::tuple<Glib::ustring, guint16, guint64, gint64>> to_dbus_with_sequence(
+            const IdSource::Group::IdentifiedUsers &identified_users)
+        {
+            std::vector<std::tuple<Glib::ustring, guint16, guint64, gint64>> result;
+
+            result.reserve(identified_users.size());
+
+            for (const IdSource::IdentifiedUser &user : identified_users) {
+                result.emplace_back(user.user_identification_id.c_str(),
+                                    user.seat_id,
+                                    user.sequence_number,
+                                    user.timestamp_us);
+            }
+
+            return result;
+        }
+    }
+
     DBusService::DBusService(const Glib::RefPtr<Glib::MainLoop> &main_loop,
                              IdSource::Group &id_source_group) :
         main_loop_(main_loop),
@@ -97,33 +133,99 @@ namespace UserIdentificationManager::Daemon
 
     void DBusService::Manager::user_identified(const IdSource::IdentifiedUser &identified_user)
     {
-        UserIdentified_signal.emit(identified_user.user_identification_id, identified_user.seat_id);
+        UserIdentified_signal.emit(identified_user.user_identification_id.c_str(),
+                                   identified_user.seat_id);
+        UserIdentifiedWithSequence_signal.emit(identified_user.user_identification_id.c_str(),
+                                               identified_user.seat_id,
+                                               identified_user.sequence_number,
+                                               identified_user.timestamp_us);
+
+        // Emits PropertiesChanged.
+        CurrentUsers_set(CurrentUsers_get());
     }
 
     void DBusService::Manager::GetIdentifiedUsers(MethodInvocation &invocation)
     {
-        std::vector<std::tuple<Glib::ustring, guint16>> result;
+        std::uint64_t version = id_source_group_.history_version();
+
+        if (!identified_users_reply_ || identified_users_reply_version_ != version) {
+            using Users = std::vector<std::tuple<Glib::ustring, guint16>>;
 
-        for (const IdSource::IdentifiedUser &user : id_source_group_.identified_users()) {
-            result.emplace_back(user.user_identification_id, user.seat_id);
+            identified_users_reply_ = Glib::VariantContainerBase::create_tuple(
+                Glib::Variant<Users>::create(to_dbus(id_source_group_.identified_users())));
+            identified_users_reply_version_ = version;
         }
 
-        invocation.ret(result);
+        invocation.getMessage()->return_value(identified_users_reply_);
+    }
+
+    void DBusService::Manager::GetIdentifiedUsersSince(guint64 sequence_number,
+                                                       MethodInvocation &invocation)
+    {
+        std::vector<std::tuple<Glib::ustring, guint16, guint64, gint64>> identified_users =
+            to_dbus_with_sequence(id_source_group_.identified_users_since(sequence_number));
+
+        invocation.ret(identified_users,
+                       id_source_group_.last_sequence_number(),
+                       id_source_group_.identified_users_lost_since(sequence_number));
     }
 
     void DBusService::Manager::GetSources(MethodInvocation &invocation)
     {
-        std::vector<Glib::ustring> enabled;
-        std::vector<Glib::ustring> disabled;
+        std::uint64_t version = id_source_group_.sources_version();
+
+        if (!sources_reply_ || sources_reply_version_ != version) {
+            using Names = std::vector<Glib::ustring>;
 
-        for (const std::string &name : id_source_group_.enabled_names()) {
-            enabled.emplace_back(name);
+            Names enabled;
+            Names disabled;
+
+            for (const std::string &name : id_source_group_.enabled_names()) {
+                enabled.emplace_back(name);
+            }
+
+            for (const std::string &name : id_source_group_.disabled_names()) {
+                disabled.emplace_back(name);
+            }
+
+            std::vector<Glib::VariantBase> reply = {Glib::Variant<Names>::create(enabled),
+                                                    Glib::Variant<Names>::create(disabled)};
+
+            sources_reply_ = Glib::VariantContainerBase::create_tuple(reply);
+            sources_reply_version_ = version;
+        }
+
+        invocation.getMessage()->return_value(sources_reply_);
+    }
+
+    DBusService::Manager::CurrentUsers DBusService::Manager::CurrentUsers_get()
+    {
+        CurrentUsers result;
+
+        for (const auto &[seat_id, user] : id_source_group_.current_users()) {
+            result.emplace(seat_id,
+                           std::make_tuple(Glib::ustring(user.user_identification_id.c_str()),
+                                           user.sequence_number,
+                                           user.timestamp_us));
         }
 
-        for (const std::string &name : id_source_group_.disabled_names()) {
-            disabled.emplace_back(name);
+        return result;
+    }
+
+    bool DBusService::Manager::CurrentUsers_setHandler(const CurrentUsers & /*value*/)
+    {
+        // Read only, the value is always taken from the group.
+        return true;
+    }
+
+    void DBusService::Manager::GetStatistics(MethodInvocation &invocation)
+    {
+        std::vector<std::tuple<Glib::ustring, guint64>> result;
+
+        for (const auto &[name, value] : id_source_group_.statistics()) {
+            result.emplace_back(name, value);
         }
 
-        invocation.ret(enabled, disabled);
+        invocation.ret(result);
     }
 }
@@ -12,6 +12,10 @@
 #include <glibmm.h>
 #include <sigc++/sigc++.h>
 
+#include <cstdint>
+#include <map>
+#include <tuple>
+
 #include "daemon/id_source.h"
 #include "generated/dbus/user_identification_manager_common.h"
 #include "generated/dbus/user_identification_manager_stub.h"
@@ -46,10 +50,25 @@ namespace UserIdentificationManager::Daemon
             void user_identified(const IdSource::IdentifiedUser &identified_user);
 
             void GetIdentifiedUsers(MethodInvocation &invocation) override;
+            void GetIdentifiedUsersSince(guint64 sequence_number,
+                                         MethodInvocation &invocation) override;
             void GetSources(MethodInvocation &invocation) override;
+            void GetStatistics(MethodInvocation &invocation) override;
+
+            using CurrentUsers = std::map<guint16, std::tuple<Glib::ustring, guint64, gint64>>;
+
+            CurrentUsers CurrentUsers_get() override;
+            bool CurrentUsers_setHandler(const CurrentUsers &value) override;
 
             IdSource::Group &id_source_group_;
             sigc::connection user_identified_connection_;
+
+            // Serialized replies, reused until the version of what they were built from
+            // changes.
+            Glib::VariantContainerBase identified_users_reply_;
+            std::uint64_t identified_users_reply_version_ = 0;
+            Glib::VariantContainerBase sources_reply_;
+            std::uint64_t sources_reply_version_ = 0;
         };
 
         void bus_acquired(const Glib::RefPtr<Gio::DBus::Connection> &connection,
@@ -0,0 +1,48 @@
+// Copyright (C) 2019 Luxoft Sweden AB
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+//
+// SPDX-License-Identifier: MPL-2.0
+
+#include <glib.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+
+#include "daemon/benchmarks/mass_storage_device_parser_reference.h"
+#include "daemon/id_sources/mass_storage_device_id_source.h"
+
+// libFuzzer target checking that MassStorageDeviceIdSource::Parser accepts exactly the files the
+// reference implementation does, with the same results.
+namespace
+{
+    void silent_handler(const gchar * /*log_domain*/,
+                        GLogLevelFlags /*log_level*/,
+                        const gchar * /*message*/,
+                        gpointer /*unused_data*/)
+    {
+    }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t *data, std::size_t size)
+{
+    using namespace UserIdentificationManager::Daemon;
+
+    static const GLogFunc original_handler = g_log_set_default_handler(silent_handler, nullptr);
+    static_cast<void>(original_handler);
+
+    std::string contents(reinterpret_cast<const char *>(data), size);
+
+    if (!Benchmarks::same_result(
+            Benchmarks::reference_parse(contents),
+            MassStorageDeviceIdSource::Parser::parse("pelux-user-id", contents))) {
+        std::abort();
+    }
+
+    return 0;
+}
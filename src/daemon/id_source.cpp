@@ -47,6 +47,24 @@ namespace UserIdentificationManager::Daemon
 
     IdSource::~IdSource() = default;
 
+    Statistics IdSource::statistics() const
+    {
+        return {};
+    }
+
+    void IdSource::set_enabled(bool enabled)
+    {
+        if (enabled == enabled_) {
+            return;
+        }
+
+        enabled_ = enabled;
+
+        if (listener_) {
+            listener_->enabled_changed(*this);
+        }
+    }
+
     void IdSource::user_identified(const IdentifiedUser &identified_user) const
     {
         if (listener_) {
@@ -125,24 +143,52 @@ namespace UserIdentificationManager::Daemon
         }
     }
 
-    std::vector<IdSource::IdentifiedUser> IdSource::Group::identified_users() const
+    Statistics IdSource::Group::statistics() const
     {
-        return {identified_users_.cbegin(), identified_users_.cend()};
+        Statistics statistics;
+
+        for (auto &source : sources_) {
+            for (auto &[name, value] : source->statistics()) {
+                statistics.emplace_back(source->name() + "." + name, value);
+            }
+        }
+
+        return statistics;
+    }
+
+    IdSource::Group::IdentifiedUsers IdSource::Group::identified_users_since(
+        std::uint64_t sequence_number) const
+    {
+        return identified_users_.view().last(identified_since(sequence_number));
+    }
+
+    bool IdSource::Group::identified_users_lost_since(std::uint64_t sequence_number) const
+    {
+        return identified_since(sequence_number) > identified_users_.size();
     }
 
     void IdSource::Group::user_identified(const IdentifiedUser &identified_user)
     {
-        g_message("User identified, user identification id: %s, seat id: 0x%04x",
-                  identified_user.user_identification_id.c_str(),
-                  identified_user.seat_id);
+        IdentifiedUser numbered_user = identified_user;
 
-        if (identified_users_.size() >= MAX_SAVED_IDENTIFIED_USERS) {
-            identified_users_.pop_front();
-        }
+        numbered_user.sequence_number = ++last_sequence_number_;
+
+        g_message("User identified, user identification id: %s, seat id: 0x%04x, sequence "
+                  "number: %llu",
+                  numbered_user.user_identification_id.c_str(),
+                  numbered_user.seat_id,
+                  static_cast<unsigned long long>(numbered_user.sequence_number));
 
-        identified_users_.push_back(identified_user);
+        identified_users_.push(numbered_user);
+        history_version_++;
+        current_users_.insert_or_assign(numbered_user.seat_id, numbered_user);
 
-        user_identified_signal_.emit(identified_user);
+        user_identified_signal_.emit(numbered_user);
+    }
+
+    void IdSource::Group::enabled_changed(const IdSource & /*source*/)
+    {
+        sources_version_++;
     }
 
     IdSource *IdSource::Group::find_source(const std::string &name) const
@@ -154,4 +200,13 @@ namespace UserIdentificationManager::Daemon
         }
         return nullptr;
     }
+
+    std::uint64_t IdSource::Group::identified_since(std::uint64_t sequence_number) const
+    {
+        if (sequence_number > last_sequence_number_) {
+            return last_sequence_number_;
+        }
+
+        return last_sequence_number_ - sequence_number;
+    }
 }
@@ -11,13 +11,17 @@
 
 #include <sigc++/sigc++.h>
 
+#include <cstddef>
 #include <cstdint>
-#include <deque>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "config.h"
+#include "daemon/ring_buffer.h"
+#include "daemon/small_string.h"
+#include "daemon/statistics.h"
 
 namespace UserIdentificationManager::Daemon
 {
@@ -35,6 +39,11 @@ namespace UserIdentificationManager::Daemon
     // with identification sources. It groups sources together and has methods for enabling and
     // disabling sources, getting names of enabled/disabled sources, a signal for listening for when
     // a user is identified by any of its sources and stores the most recent users identified.
+    // The number of users stored is set with set_history_capacity(), storage for them is
+    // allocated up front.
+    //
+    // Sources may override statistics() to expose counters for debugging purposes. They are
+    // collected, prefixed with the source name, by IdSource::Group::statistics().
     class IdSource
     {
     public:
@@ -44,6 +53,10 @@ namespace UserIdentificationManager::Daemon
 
         using SeatId = std::uint16_t;
 
+        // Fits the IDs of all sources, e.g. "SCARD-NDEF-" followed by an up to 26 byte NDEF
+        // message in hex, without allocating memory.
+        using UserIdentificationId = SmallString<63>;
+
         static constexpr SeatId SEAT_ID_MIN = 0;
         static constexpr SeatId SEAT_ID_MAX = 0xffff;
         static constexpr SeatId SEAT_ID_MAIN_USER = 0x0000;
@@ -75,11 +88,11 @@ namespace UserIdentificationManager::Daemon
         virtual void enable() = 0;
         virtual void disable() = 0;
 
+        virtual Statistics statistics() const;
+
     protected:
-        void set_enabled(bool enabled)
-        {
-            enabled_ = enabled;
-        }
+        // Tells the listener if changed.
+        void set_enabled(bool enabled);
 
         void user_identified(const IdentifiedUser &identified_user) const;
 
@@ -91,8 +104,16 @@ namespace UserIdentificationManager::Daemon
 
     struct IdSource::IdentifiedUser
     {
-        std::string user_identification_id;
+        UserIdentificationId user_identification_id;
         SeatId seat_id = SEAT_ID_UNDEFINED;
+
+        // Assigned by IdSource::Group, starting at 1 and increasing by one for every user
+        // identified. A gap means that events were missed.
+        std::uint64_t sequence_number = 0;
+
+        // CLOCK_MONOTONIC time in microseconds, see g_get_monotonic_time(), of the event the user
+        // was identified from, e.g. a card being detected. Set by the source.
+        std::int64_t timestamp_us = 0;
     };
 
     class IdSource::Listener
@@ -101,15 +122,21 @@ namespace UserIdentificationManager::Daemon
         virtual ~Listener() = default;
 
         virtual void user_identified(const IdentifiedUser &identified_user) = 0;
+
+        virtual void enabled_changed(const IdSource & /*source*/)
+        {
+        }
     };
 
     class IdSource::Group : public IdSource::Listener
     {
     public:
         using Sources = std::vector<std::unique_ptr<IdSource>>;
+        using IdentifiedUsers = RingBuffer<IdentifiedUser>::View;
+        using CurrentUsers = std::unordered_map<SeatId, IdentifiedUser>;
 
-        static constexpr unsigned int MAX_SAVED_IDENTIFIED_USERS =
-            UIM_CONFIG_DAEMON_MAX_SAVED_IDENTIFIED_USERS;
+        static constexpr std::size_t DEFAULT_HISTORY_CAPACITY =
+            UIM_CONFIG_DAEMON_DEFAULT_HISTORY_CAPACITY;
 
         Group();
         explicit Group(Sources &&sources);
@@ -126,16 +153,74 @@ namespace UserIdentificationManager::Daemon
             return user_identified_signal_;
         }
 
-        std::vector<IdentifiedUser> identified_users() const;
+        // Oldest first. Not copied, only valid until the next user is identified.
+        IdentifiedUsers identified_users() const
+        {
+            return identified_users_.view();
+        }
+
+        // The users identified after the one with sequence_number, oldest first. Not copied, only
+        // valid until the next user is identified. A sequence_number after the last one, e.g.
+        // from before the daemon was restarted, is treated as 0.
+        IdentifiedUsers identified_users_since(std::uint64_t sequence_number) const;
+
+        // Whether users identified after the one with sequence_number are no longer in the
+        // history, i.e. are missing in identified_users_since().
+        bool identified_users_lost_since(std::uint64_t sequence_number) const;
+
+        // The last user identified for each seat, only seats with a user identified are included.
+        // Updated before user_identified_signal() is emitted.
+        const CurrentUsers &current_users() const
+        {
+            return current_users_;
+        }
+
+        // Of the last user identified, 0 if none.
+        std::uint64_t last_sequence_number() const
+        {
+            return last_sequence_number_;
+        }
+
+        // Keeps the most recent users identified that fit.
+        void set_history_capacity(std::size_t capacity)
+        {
+            if (capacity != identified_users_.capacity()) {
+                identified_users_.set_capacity(capacity);
+                history_version_++;
+            }
+        }
+
+        // Changes whenever identified_users() does, for caching what is derived from it.
+        std::uint64_t history_version() const
+        {
+            return history_version_;
+        }
+
+        // Changes whenever a source is enabled or disabled, for caching what is derived from
+        // enabled_names() and disabled_names().
+        std::uint64_t sources_version() const
+        {
+            return sources_version_;
+        }
+
+        Statistics statistics() const;
 
     private:
         void user_identified(const IdentifiedUser &identified_user) override;
+        void enabled_changed(const IdSource &source) override;
 
         IdSource *find_source(const std::string &name) const;
 
+        // Number of users identified after the one with sequence_number.
+        std::uint64_t identified_since(std::uint64_t sequence_number) const;
+
         const Sources sources_;
 
-        std::deque<IdentifiedUser> identified_users_;
+        std::uint64_t sources_version_ = 0;
+        std::uint64_t history_version_ = 0;
+        std::uint64_t last_sequence_number_ = 0;
+        RingBuffer<IdentifiedUser> identified_users_{DEFAULT_HISTORY_CAPACITY};
+        CurrentUsers current_users_;
         sigc::signal<void, const IdentifiedUser &> user_identified_signal_;
     };
 }
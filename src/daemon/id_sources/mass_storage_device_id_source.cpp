@@ -12,9 +12,16 @@
 #include <glib.h>
 #include <glibmm.h>
 
-#include <fstream>
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
+#include <system_error>
 #include <utility>
 #include <vector>
 
@@ -25,48 +32,80 @@ namespace UserIdentificationManager::Daemon
         constexpr char MASS_STORAGE_DEVICE_SOURCE_NAME[] = "MSD";
         constexpr char USER_ID_FILE_NAME[] = "pelux-user-id";
 
-        std::optional<std::vector<std::string>> read_lines_from_file(const std::string &path,
-                                                                     unsigned int num_lines)
-        {
-            std::ifstream stream(path);
+        // Attributes needed for FileKey.
+        constexpr char FILE_KEY_ATTRIBUTES[] =
+            G_FILE_ATTRIBUTE_UNIX_DEVICE "," G_FILE_ATTRIBUTE_UNIX_INODE
+            "," G_FILE_ATTRIBUTE_TIME_MODIFIED "," G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC
+            "," G_FILE_ATTRIBUTE_STANDARD_SIZE;
+
+        constexpr std::string_view ID_PREFIX = "ID ";
+        constexpr std::string_view SEAT_PREFIX = "SEAT ";
+        constexpr std::string_view SEAT_ID_HEX_PREFIX = "0x";
+        constexpr int SEAT_ID_BASE = 16;
+
+        // Whole range of SeatId is valid, so from_chars() range checks it.
+        static_assert(IdSource::SEAT_ID_MIN == std::numeric_limits<IdSource::SeatId>::min() &&
+                      IdSource::SEAT_ID_MAX == std::numeric_limits<IdSource::SeatId>::max());
 
-            if (!stream.is_open()) {
+        // Take the next line from contents. Like std::getline(), a last line without newline
+        // counts but nothing after a last newline does.
+        std::optional<std::string_view> take_line(std::string_view &contents)
+        {
+            if (contents.empty()) {
                 return {};
             }
 
-            std::vector<std::string> lines;
-
-            for (unsigned int i = 0; i < num_lines; i++) {
-                std::string line;
+            std::size_t end = contents.find('\n');
+            std::string_view line = contents.substr(0, end);
 
-                if (!std::getline(stream, line)) {
-                    return {};
-                }
+            contents.remove_prefix(end == std::string_view::npos ? contents.size() : end + 1);
 
-                lines.emplace_back(std::move(line));
-            }
+            return line;
+        }
 
-            return lines;
+        bool string_starts_with(std::string_view str, std::string_view start)
+        {
+            return str.substr(0, start.size()) == start;
         }
 
-        bool string_starts_with(const std::string &str, const std::string &start)
+        bool string_is_numeric(std::string_view str)
         {
-            return str.compare(0, start.size(), start) == 0;
+            return std::all_of(
+                str.cbegin(), str.cend(), [](char c) { return c >= '0' && c <= '9'; });
         }
 
-        bool string_is_numeric(const std::string &str)
+        // Same checks as g_ascii_string_to_unsigned(), which ends at a NUL character, previously
+        // used: no sign, whitespace or second hex prefix and the whole string must be digits.
+        std::optional<IdSource::SeatId> parse_seat_id(std::string_view str)
         {
-            for (char c : str) {
-                if (c < '0' || c > '9') {
-                    return false;
-                }
+            str = str.substr(0, str.find('\0'));
+
+            IdSource::SeatId seat_id = 0;
+            const char *end = str.data() + str.size();
+            auto [ptr, error] = std::from_chars(str.data(), end, seat_id, SEAT_ID_BASE);
+
+            if (error != std::errc() || ptr != end) {
+                return {};
             }
-            return true;
+
+            return seat_id;
+        }
+
+        Glib::RefPtr<Gio::File> user_id_file(const std::string &root)
+        {
+            return Gio::File::create_for_path(root)->get_child(USER_ID_FILE_NAME);
         }
     }
 
     MassStorageDeviceIdSource::MassStorageDeviceIdSource() :
-        IdSource(MASS_STORAGE_DEVICE_SOURCE_NAME)
+        MassStorageDeviceIdSource(&MountWatcher::create)
+    {
+    }
+
+    MassStorageDeviceIdSource::MassStorageDeviceIdSource(
+        MountWatcherFactory &&mount_watcher_factory) :
+        IdSource(MASS_STORAGE_DEVICE_SOURCE_NAME),
+        mount_watcher_factory_(std::move(mount_watcher_factory))
     {
     }
 
@@ -78,10 +117,12 @@ namespace UserIdentificationManager::Daemon
 
         set_enabled(true);
 
-        mount_added_connection_ = volume_monitor_->signal_mount_added().connect(
+        mount_watcher_ = mount_watcher_factory_();
+
+        mount_added_connection_ = mount_watcher_->signal_mount_added().connect(
             sigc::mem_fun(*this, &MassStorageDeviceIdSource::mount_added));
 
-        mount_removed_connection_ = volume_monitor_->signal_mount_removed().connect(
+        mount_removed_connection_ = mount_watcher_->signal_mount_removed().connect(
             sigc::mem_fun(*this, &MassStorageDeviceIdSource::mount_removed));
 
         check_existing_mounts();
@@ -93,39 +134,113 @@ namespace UserIdentificationManager::Daemon
             return;
         }
 
+        // Nothing more is emitted, do not let cancelled reads deliver held back results.
+        mount_scan_ = {};
+
+        while (!pending_reads_.empty()) {
+            cancel_read(pending_reads_.begin()->first);
+        }
+
+        for (auto &[path, timeout_connection] : change_timeout_connections_) {
+            timeout_connection.disconnect();
+        }
+
+        change_timeout_connections_.clear();
+        read_file_keys_.clear();
         file_monitors_.clear();
 
         mount_added_connection_.disconnect();
         mount_removed_connection_.disconnect();
+        mount_watcher_.reset();
 
         set_enabled(false);
     }
 
+    Statistics MassStorageDeviceIdSource::statistics() const
+    {
+        return {{"file.reads", reads_},
+                {"file.unchanged_skipped", unchanged_skipped_},
+                {"file.changes_coalesced", changes_coalesced_},
+                {"mount_scan.mounts", mount_scan_mounts_},
+                {"mount_scan.duration_us", mount_scan_duration_us_}};
+    }
+
     void MassStorageDeviceIdSource::check_existing_mounts()
     {
-        std::vector<Glib::RefPtr<Gio::Mount>> mounts = volume_monitor_->get_mounts();
+        std::vector<std::string> mounts = mount_watcher_->mounts();
+
+        mount_scan_ = {};
+        mount_scan_.start_time_us = g_get_monotonic_time();
+        mount_scan_.mounts.reserve(mounts.size());
 
-        for (auto &mount : mounts) {
-            mount_added(mount);
+        for (const std::string &root : mounts) {
+            Glib::RefPtr<Gio::File> file = user_id_file(root);
+
+            if (mount_scan_.indices.emplace(file->get_path(), mount_scan_.mounts.size()).second) {
+                mount_scan_.mounts.push_back({file, false, std::nullopt});
+            }
         }
+
+        mount_scan_continue();
     }
 
-    void MassStorageDeviceIdSource::mount_added(const Glib::RefPtr<Gio::Mount> &mount)
+    void MassStorageDeviceIdSource::mount_scan_continue()
     {
-        Glib::RefPtr<Gio::File> file = mount->get_root()->get_child(USER_ID_FILE_NAME);
+        MountScan &scan = mount_scan_;
+
+        while (scan.in_flight < MOUNT_SCAN_PARALLELISM && scan.started < scan.mounts.size()) {
+            ScannedMount &mount = scan.mounts[scan.started++];
+
+            // Removed before its turn.
+            if (mount.done) {
+                continue;
+            }
+
+            // Copied, scan.mounts is not to be referred to across calls.
+            Glib::RefPtr<Gio::File> file = mount.file;
+
+            scan.in_flight++;
+            read_file_and_notify(file, true, scan.start_time_us);
+        }
 
-        if (!file->query_exists()) {
+        while (scan.delivered < scan.mounts.size() && scan.mounts[scan.delivered].done) {
+            const ScannedMount &mount = scan.mounts[scan.delivered++];
+
+            if (mount.identified_user) {
+                user_identified(*mount.identified_user);
+            }
+        }
+
+        if (scan.delivered < scan.mounts.size()) {
             return;
         }
 
-        start_monitoring_file(file);
-        read_file_and_notify(file->get_path());
+        mount_scan_mounts_ = scan.mounts.size();
+        mount_scan_duration_us_ = g_get_monotonic_time() - scan.start_time_us;
+
+        g_debug("Read user ID files of %zu mounts in %llu us",
+                scan.mounts.size(),
+                static_cast<unsigned long long>(mount_scan_duration_us_));
+
+        mount_scan_ = {};
+    }
+
+    void MassStorageDeviceIdSource::mount_added(const std::string &root)
+    {
+        Glib::RefPtr<Gio::File> file = user_id_file(root);
+
+        // Whether the file exists is known when reading it, no separate blocking check.
+        read_file_and_notify(file, true, g_get_monotonic_time());
     }
 
-    void MassStorageDeviceIdSource::mount_removed(const Glib::RefPtr<Gio::Mount> &mount)
+    void MassStorageDeviceIdSource::mount_removed(const std::string &root)
     {
-        Glib::RefPtr<Gio::File> file = mount->get_root()->get_child(USER_ID_FILE_NAME);
+        Glib::RefPtr<Gio::File> file = user_id_file(root);
+        const std::string path = file->get_path();
 
+        cancel_read(path);
+        // Also ends the read of a mount a mount scan has not got to yet.
+        read_ended(path, {});
         stop_monitoring_file(file);
     }
 
@@ -141,82 +256,333 @@ namespace UserIdentificationManager::Daemon
 
     void MassStorageDeviceIdSource::stop_monitoring_file(const Glib::RefPtr<Gio::File> &file)
     {
-        file_monitors_.erase(file->get_path());
+        const std::string path = file->get_path();
+        auto it = change_timeout_connections_.find(path);
+
+        if (it != change_timeout_connections_.end()) {
+            it->second.disconnect();
+            change_timeout_connections_.erase(it);
+        }
+
+        read_file_keys_.erase(path);
+        file_monitors_.erase(path);
     }
 
     void MassStorageDeviceIdSource::file_changed(const Glib::RefPtr<Gio::File> &file,
                                                  const Glib::RefPtr<Gio::File> & /*other_file*/,
-                                                 Gio::FileMonitorEvent event) const
+                                                 Gio::FileMonitorEvent event)
+    {
+        if (event != Gio::FILE_MONITOR_EVENT_CHANGES_DONE_HINT) {
+            return;
+        }
+
+        sigc::connection &timeout_connection = change_timeout_connections_[file->get_path()];
+
+        if (timeout_connection.connected()) {
+            timeout_connection.disconnect();
+            changes_coalesced_++;
+        }
+
+        // Time of the last change, the one whose contents will be read.
+        timeout_connection = Glib::signal_timeout().connect_once(
+            sigc::bind(sigc::mem_fun(*this, &MassStorageDeviceIdSource::file_changes_done),
+                       file,
+                       g_get_monotonic_time()),
+            CHANGE_COALESCE_WINDOW.count());
+    }
+
+    void MassStorageDeviceIdSource::file_changes_done(const Glib::RefPtr<Gio::File> &file,
+                                                      std::int64_t timestamp_us)
+    {
+        change_timeout_connections_.erase(file->get_path());
+
+        read_file_and_notify(file, false, timestamp_us);
+    }
+
+    void MassStorageDeviceIdSource::read_file_and_notify(const Glib::RefPtr<Gio::File> &file,
+                                                         bool mounted,
+                                                         std::int64_t timestamp_us)
+    {
+        const std::string path = file->get_path();
+
+        // Only the latest contents are of interest. The new read ends in place of the cancelled
+        // one, so a read in a mount scan keeps its place.
+        cancel_read(path);
+
+        PendingRead &pending_read = pending_reads_[path];
+
+        pending_read.cancellable = Gio::Cancellable::create();
+        pending_read.timeout_connection = Glib::signal_timeout().connect_seconds(
+            sigc::bind_return(
+                sigc::bind(sigc::mem_fun(*this, &MassStorageDeviceIdSource::read_timed_out),
+                           path),
+                false),
+            READ_TIMEOUT.count());
+
+        // Bound to this as a sigc::trackable, results arriving after destruction are dropped.
+        file->query_info_async(
+            sigc::bind(sigc::mem_fun(*this, &MassStorageDeviceIdSource::file_info_queried),
+                       file,
+                       pending_read.cancellable,
+                       mounted,
+                       timestamp_us),
+            pending_read.cancellable,
+            FILE_KEY_ATTRIBUTES);
+    }
+
+    void MassStorageDeviceIdSource::file_info_queried(
+        const Glib::RefPtr<Gio::AsyncResult> &result,
+        const Glib::RefPtr<Gio::File> &file,
+        const Glib::RefPtr<Gio::Cancellable> &cancellable,
+        bool mounted,
+        std::int64_t timestamp_us)
+    {
+        const std::string path = file->get_path();
+        Glib::RefPtr<Gio::FileInfo> file_info;
+
+        try {
+            file_info = file->query_info_finish(result);
+        } catch (const Gio::Error &error) {
+            finish_read(path, cancellable, &error);
+            return;
+        }
+
+        if (cancellable->is_cancelled()) {
+            return;
+        }
+
+        FileKey file_key;
+
+        file_key.device = file_info->get_attribute_uint32(G_FILE_ATTRIBUTE_UNIX_DEVICE);
+        file_key.inode = file_info->get_attribute_uint64(G_FILE_ATTRIBUTE_UNIX_INODE);
+        file_key.modified = file_info->get_attribute_uint64(G_FILE_ATTRIBUTE_TIME_MODIFIED);
+        file_key.modified_usec =
+            file_info->get_attribute_uint32(G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC);
+        file_key.size = file_info->get_size();
+
+        auto it = read_file_keys_.find(path);
+
+        if (!mounted && it != read_file_keys_.end() && it->second == file_key) {
+            unchanged_skipped_++;
+            finish_read(path, cancellable, nullptr);
+            read_ended(path, {});
+            return;
+        }
+
+        auto read = std::make_shared<FileRead>();
+
+        read->file = file;
+        read->cancellable = cancellable;
+        read->mounted = mounted;
+        read->timestamp_us = timestamp_us;
+        read->file_key = file_key;
+
+        file->read_async(
+            sigc::bind(sigc::mem_fun(*this, &MassStorageDeviceIdSource::file_opened), read),
+            cancellable);
+    }
+
+    void MassStorageDeviceIdSource::file_opened(const Glib::RefPtr<Gio::AsyncResult> &result,
+                                                const std::shared_ptr<FileRead> &read)
     {
-        if (event == Gio::FILE_MONITOR_EVENT_CHANGES_DONE_HINT) {
-            read_file_and_notify(file->get_path());
+        try {
+            read->stream = read->file->read_finish(result);
+        } catch (const Gio::Error &error) {
+            finish_read(read->file->get_path(), read->cancellable, &error);
+            return;
+        }
+
+        if (read->cancellable->is_cancelled()) {
+            return;
         }
+
+        read_more(read);
+    }
+
+    void MassStorageDeviceIdSource::read_more(const std::shared_ptr<FileRead> &read)
+    {
+        read->stream->read_async(
+            read->contents.data() + read->length,
+            read->contents.size() - read->length,
+            sigc::bind(sigc::mem_fun(*this, &MassStorageDeviceIdSource::file_read), read),
+            read->cancellable);
     }
 
-    void MassStorageDeviceIdSource::read_file_and_notify(const std::string &path) const
+    void MassStorageDeviceIdSource::file_read(const Glib::RefPtr<Gio::AsyncResult> &result,
+                                              const std::shared_ptr<FileRead> &read)
     {
-        std::optional<IdentifiedUser> identified_user = Parser::read_file(path);
+        const std::string path = read->file->get_path();
+        gssize length = 0;
 
-        if (!identified_user) {
+        try {
+            length = read->stream->read_finish(result);
+        } catch (const Gio::Error &error) {
+            finish_read(path, read->cancellable, &error);
             return;
         }
 
-        user_identified(*identified_user);
+        const char *chunk = read->contents.data() + read->length;
+
+        read->length += length;
+        read->num_lines += std::count(chunk, chunk + length, '\n');
+
+        // Nothing after the second line is of interest.
+        bool complete = length == 0 || read->num_lines >= 2;
+
+        if (!complete && read->length < read->contents.size()) {
+            if (!read->cancellable->is_cancelled()) {
+                read_more(read);
+            }
+            return;
+        }
+
+        if (!finish_read(path, read->cancellable, nullptr)) {
+            return;
+        }
+
+        reads_++;
+        read_file_keys_[path] = read->file_key;
+
+        if (read->mounted) {
+            start_monitoring_file(read->file);
+        }
+
+        std::optional<IdentifiedUser> identified_user;
+
+        if (complete) {
+            // Parsed in place, not copied.
+            identified_user =
+                Parser::parse(path, std::string_view(read->contents.data(), read->length));
+        } else {
+            g_warning("%s: 2 first lines longer than %zu bytes", path.c_str(), MAX_READ_SIZE);
+        }
+
+        if (identified_user) {
+            identified_user->timestamp_us = read->timestamp_us;
+        }
+
+        read_ended(path, identified_user);
     }
 
-    std::optional<IdSource::IdentifiedUser> MassStorageDeviceIdSource::Parser::read_file(
-        const std::string &path)
+    bool MassStorageDeviceIdSource::finish_read(const std::string &path,
+                                                const Glib::RefPtr<Gio::Cancellable> &cancellable,
+                                                const Gio::Error *error)
     {
-        std::optional<std::vector<std::string>> lines = read_lines_from_file(path, 2);
+        // A late result of a cancelled read, a newer read may be pending.
+        if (cancellable->is_cancelled()) {
+            return false;
+        }
+
+        pending_reads_.at(path).timeout_connection.disconnect();
+        pending_reads_.erase(path);
+
+        if (error) {
+            if (error->code() != Gio::Error::NOT_FOUND) {
+                g_warning("%s: failed to read: %s", path.c_str(), error->what().c_str());
+            }
+            read_ended(path, {});
+            return false;
+        }
+
+        return true;
+    }
+
+    void MassStorageDeviceIdSource::read_timed_out(const std::string &path)
+    {
+        g_warning("%s: not read within %lld seconds, cancelled",
+                  path.c_str(),
+                  static_cast<long long>(READ_TIMEOUT.count()));
+
+        cancel_read(path);
+        read_ended(path, {});
+    }
+
+    void MassStorageDeviceIdSource::cancel_read(const std::string &path)
+    {
+        auto it = pending_reads_.find(path);
+
+        if (it == pending_reads_.end()) {
+            return;
+        }
+
+        it->second.cancellable->cancel();
+        it->second.timeout_connection.disconnect();
+        pending_reads_.erase(it);
+    }
 
-        if (!lines) {
+    void MassStorageDeviceIdSource::read_ended(const std::string &path,
+                                               const std::optional<IdentifiedUser> &identified_user)
+    {
+        auto it = mount_scan_.indices.find(path);
+
+        if (it == mount_scan_.indices.end()) {
+            if (identified_user) {
+                user_identified(*identified_user);
+            }
+            return;
+        }
+
+        std::size_t index = it->second;
+
+        mount_scan_.indices.erase(it);
+
+        if (index < mount_scan_.started) {
+            mount_scan_.in_flight--;
+        }
+
+        mount_scan_.mounts[index].done = true;
+        mount_scan_.mounts[index].identified_user = identified_user;
+
+        mount_scan_continue();
+    }
+
+    std::optional<IdSource::IdentifiedUser> MassStorageDeviceIdSource::Parser::parse(
+        const std::string &path,
+        std::string_view contents)
+    {
+        std::optional<std::string_view> id_line = take_line(contents);
+        std::optional<std::string_view> seat_line = take_line(contents);
+
+        if (!id_line || !seat_line) {
             g_warning("%s: failed to read 2 first lines", path.c_str());
             return {};
         }
 
-        const std::string id_prefix = "ID ";
-        const std::string seat_prefix = "SEAT ";
-        const std::string &id_line = (*lines)[0];
-        const std::string &seat_line = (*lines)[1];
-
-        if (!string_starts_with(id_line, id_prefix)) {
+        if (!string_starts_with(*id_line, ID_PREFIX)) {
             g_warning("%s: first line must start with \"ID \"", path.c_str());
             return {};
         }
 
-        if (!string_starts_with(seat_line, seat_prefix)) {
+        if (!string_starts_with(*seat_line, SEAT_PREFIX)) {
             g_warning("%s: second line must start with \"SEAT \"", path.c_str());
             return {};
         }
 
-        const std::string id_str = id_line.substr(id_prefix.size());
-        const std::string seat_str = seat_line.substr(seat_prefix.size());
+        std::string_view id_str = id_line->substr(ID_PREFIX.size());
+        std::string_view seat_str = seat_line->substr(SEAT_PREFIX.size());
 
         if (id_str.empty() || !string_is_numeric(id_str)) {
             g_warning("%s: ID must be followed by a numeric string", path.c_str());
             return {};
         }
 
-        constexpr unsigned int SEAT_ID_BASE = 16;
-        const std::string seat_id_hex_prefix = "0x";
-        guint64 seat_id = 0;
+        std::optional<SeatId> seat_id;
+
+        if (string_starts_with(seat_str, SEAT_ID_HEX_PREFIX)) {
+            seat_id = parse_seat_id(seat_str.substr(SEAT_ID_HEX_PREFIX.size()));
+        }
 
-        if (!string_starts_with(seat_str, seat_id_hex_prefix) ||
-            !g_ascii_string_to_unsigned(seat_str.c_str() + seat_id_hex_prefix.size(),
-                                        SEAT_ID_BASE,
-                                        SEAT_ID_MIN,
-                                        SEAT_ID_MAX,
-                                        &seat_id,
-                                        nullptr)) {
+        if (!seat_id) {
             g_warning("%s: SEAT must be followed by a hexadecimal 16 bit string", path.c_str());
             return {};
         }
 
         IdSource::IdentifiedUser identified_user;
 
-        identified_user.user_identification_id =
-            std::string(MASS_STORAGE_DEVICE_SOURCE_NAME) + "-" + id_str;
-        identified_user.seat_id = seat_id;
+        identified_user.user_identification_id = MASS_STORAGE_DEVICE_SOURCE_NAME;
+        identified_user.user_identification_id.append("-");
+        identified_user.user_identification_id.append(id_str);
+        identified_user.seat_id = *seat_id;
 
         return identified_user;
     }
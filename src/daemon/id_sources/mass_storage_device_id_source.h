@@ -13,11 +13,21 @@
 #include <glibmm.h>
 #include <sigc++/sigc++.h>
 
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <vector>
 
 #include "daemon/id_source.h"
+#include "daemon/mount_watcher.h"
+#include "daemon/statistics.h"
 
 namespace UserIdentificationManager::Daemon
 {
@@ -32,41 +42,170 @@ namespace UserIdentificationManager::Daemon
     // <id> must be a numeric string and <seat id> must be a 16-bit hexadecimal string. The file is
     // monitored for changes so it is possible to test emitting another user by just modifying the
     // file.
+    //
+    // Mounts are reported by the MountWatcher selected at build time, or the one made by the
+    // factory given to the constructor, created when enabled.
+    //
+    // The file is read asynchronously so that a slow or broken device does not block the main
+    // loop. Reads not done within READ_TIMEOUT are cancelled and their results ignored. Only the
+    // first two lines are read, into a buffer of MAX_READ_SIZE bytes, so a large file is neither
+    // read nor kept in memory. A file whose first two lines do not fit is rejected.
+    //
+    // Editors and file systems may report several changes for one save. Changes within
+    // CHANGE_COALESCE_WINDOW are handled once, and a changed file is only read again if its
+    // device, inode, modification time or size differ from when it was last read. A file is
+    // always read when its device is mounted.
+    //
+    // When enabled, the files of already mounted devices are read concurrently, at most
+    // MOUNT_SCAN_PARALLELISM at a time, and users identified are emitted in mount order. The time
+    // until all have been read is reported in the statistics.
     class MassStorageDeviceIdSource : public IdSource, public sigc::trackable
     {
     public:
         struct Parser;
 
+        using MountWatcherFactory = std::function<std::unique_ptr<MountWatcher>()>;
+
+        static constexpr std::chrono::seconds READ_TIMEOUT{5};
+        static constexpr std::chrono::milliseconds CHANGE_COALESCE_WINDOW{200};
+        static constexpr std::size_t MOUNT_SCAN_PARALLELISM = 4;
+        static constexpr std::size_t MAX_READ_SIZE = 256;
+
         MassStorageDeviceIdSource();
+        explicit MassStorageDeviceIdSource(MountWatcherFactory &&mount_watcher_factory);
 
         void enable() override;
         void disable() override;
 
+        Statistics statistics() const override;
+
     private:
+        // Identifies a version of a file without reading it.
+        struct FileKey
+        {
+            guint32 device = 0;
+            guint64 inode = 0;
+            guint64 modified = 0;
+            guint32 modified_usec = 0;
+            goffset size = 0;
+
+            bool operator==(const FileKey &other) const
+            {
+                return device == other.device && inode == other.inode &&
+                       modified == other.modified && modified_usec == other.modified_usec &&
+                       size == other.size;
+            }
+        };
+
+        // A file being read after its FileKey was queried. Owned by the callbacks of the read,
+        // since a cancelled read may still complete into contents.
+        struct FileRead
+        {
+            Glib::RefPtr<Gio::File> file;
+            Glib::RefPtr<Gio::Cancellable> cancellable;
+            bool mounted = false;
+            std::int64_t timestamp_us = 0;
+            FileKey file_key;
+            Glib::RefPtr<Gio::FileInputStream> stream;
+            std::array<char, MAX_READ_SIZE> contents;
+            std::size_t length = 0;
+            std::size_t num_lines = 0;
+        };
+
+        struct PendingRead
+        {
+            Glib::RefPtr<Gio::Cancellable> cancellable;
+            sigc::connection timeout_connection;
+        };
+
+        struct ScannedMount
+        {
+            Glib::RefPtr<Gio::File> file;
+            bool done = false;
+            std::optional<IdentifiedUser> identified_user;
+        };
+
+        // Reads of the files of the devices mounted when enabled.
+        struct MountScan
+        {
+            std::vector<ScannedMount> mounts;
+            std::unordered_map<std::string, std::size_t> indices;
+            std::size_t started = 0;
+            std::size_t delivered = 0;
+            std::size_t in_flight = 0;
+            std::int64_t start_time_us = 0;
+        };
+
         void check_existing_mounts();
+        void mount_scan_continue();
 
-        void mount_added(const Glib::RefPtr<Gio::Mount> &mount);
-        void mount_removed(const Glib::RefPtr<Gio::Mount> &mount);
+        void mount_added(const std::string &root);
+        void mount_removed(const std::string &root);
 
         void start_monitoring_file(const Glib::RefPtr<Gio::File> &file);
         void stop_monitoring_file(const Glib::RefPtr<Gio::File> &file);
 
         void file_changed(const Glib::RefPtr<Gio::File> &file,
                           const Glib::RefPtr<Gio::File> &other_file,
-                          Gio::FileMonitorEvent event) const;
-
-        void read_file_and_notify(const std::string &path) const;
-
-        Glib::RefPtr<Gio::VolumeMonitor> volume_monitor_ = Gio::VolumeMonitor::get();
+                          Gio::FileMonitorEvent event);
+        void file_changes_done(const Glib::RefPtr<Gio::File> &file, std::int64_t timestamp_us);
+
+        // Reading a file on mount starts monitoring it, if it exists, and skips the check for
+        // changes since last read. Unless the read is cancelled. timestamp_us is when the device
+        // was mounted or the file changed, see IdentifiedUser::timestamp_us.
+        void read_file_and_notify(const Glib::RefPtr<Gio::File> &file,
+                                  bool mounted,
+                                  std::int64_t timestamp_us);
+        void file_info_queried(const Glib::RefPtr<Gio::AsyncResult> &result,
+                               const Glib::RefPtr<Gio::File> &file,
+                               const Glib::RefPtr<Gio::Cancellable> &cancellable,
+                               bool mounted,
+                               std::int64_t timestamp_us);
+        void file_opened(const Glib::RefPtr<Gio::AsyncResult> &result,
+                         const std::shared_ptr<FileRead> &read);
+        // Read the next chunk. Reading goes on until the end of the second line, the end of the
+        // file or MAX_READ_SIZE bytes.
+        void read_more(const std::shared_ptr<FileRead> &read);
+        void file_read(const Glib::RefPtr<Gio::AsyncResult> &result,
+                       const std::shared_ptr<FileRead> &read);
+        // Returns true if the read is still wanted, false if cancelled. Handles errors.
+        bool finish_read(const std::string &path,
+                         const Glib::RefPtr<Gio::Cancellable> &cancellable,
+                         const Gio::Error *error);
+        void read_timed_out(const std::string &path);
+        // Cancel the pending read of path, if any. It does not end, see read_ended().
+        void cancel_read(const std::string &path);
+        // Called once for every read that ends, however it ends, except for a read cancelled to
+        // start a newer read of the same file. That one ends in its place. Users identified by
+        // reads in a mount scan are held back until all earlier mounts have been read.
+        void read_ended(const std::string &path,
+                        const std::optional<IdentifiedUser> &identified_user);
+
+        const MountWatcherFactory mount_watcher_factory_;
+
+        // Only exists while enabled.
+        std::unique_ptr<MountWatcher> mount_watcher_;
         sigc::connection mount_added_connection_;
         sigc::connection mount_removed_connection_;
 
         std::unordered_map<std::string, Glib::RefPtr<Gio::FileMonitor>> file_monitors_;
+        std::unordered_map<std::string, PendingRead> pending_reads_;
+        std::unordered_map<std::string, sigc::connection> change_timeout_connections_;
+        std::unordered_map<std::string, FileKey> read_file_keys_;
+        MountScan mount_scan_;
+
+        std::uint64_t reads_ = 0;
+        std::uint64_t unchanged_skipped_ = 0;
+        std::uint64_t changes_coalesced_ = 0;
+        std::uint64_t mount_scan_mounts_ = 0;
+        std::uint64_t mount_scan_duration_us_ = 0;
     };
 
     struct MassStorageDeviceIdSource::Parser
     {
-        static std::optional<IdentifiedUser> read_file(const std::string &path);
+        // Parse file contents without copying them. path is only used in warnings.
+        static std::optional<IdentifiedUser> parse(const std::string &path,
+                                                   std::string_view contents);
     };
 }
 
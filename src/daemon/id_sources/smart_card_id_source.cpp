@@ -8,9 +8,10 @@
 
 #include "daemon/id_sources/smart_card_id_source.h"
 
+#include <array>
+#include <cstddef>
 #include <cstdint>
-#include <string>
-#include <vector>
+#include <string_view>
 
 #include "daemon/pcsc_context.h"
 
@@ -19,52 +20,93 @@ namespace UserIdentificationManager::Daemon
     namespace
     {
         constexpr char SMART_CARD_SOURCE_NAME[] = "SCARD";
+        // IDs made from NDEF messages, which anyone holding the card can write, never collide
+        // with IDs made from UIDs.
+        constexpr char NDEF_MESSAGE_ID_PREFIX[] = "NDEF-";
 
-        char nibble_to_char(std::uint8_t nibble)
+        using HexTable = std::array<std::array<char, 2>, 256>;
+
+        constexpr HexTable make_hex_table()
         {
-            return nibble < 10 ? char(nibble + '0') : char(nibble - 10 + 'a');
+            constexpr char DIGITS[] = "0123456789abcdef";
+            HexTable table{};
+
+            for (std::size_t byte = 0; byte < table.size(); byte++) {
+                table[byte][0] = DIGITS[byte >> 4];
+                table[byte][1] = DIGITS[byte & 0x0f];
+            }
+
+            return table;
         }
 
-        std::string uid_to_string(const std::vector<std::uint8_t> &uid)
+        // Both hex digits of a byte with one lookup.
+        constexpr HexTable HEX_TABLE = make_hex_table();
+
+        void append_hex(const UIDExtractor::UID &uid, IdSource::UserIdentificationId &id)
         {
-            std::string ret;
+            std::array<char, 2 * UIDExtractor::UID::capacity()> hex;
+            std::size_t size = 0;
 
             for (std::uint8_t byte : uid) {
-                ret += nibble_to_char(byte >> 4);
-                ret += nibble_to_char(byte & 0x0f);
+                hex[size++] = HEX_TABLE[byte][0];
+                hex[size++] = HEX_TABLE[byte][1];
             }
 
-            return ret;
+            id.append(std::string_view(hex.data(), size));
         }
     }
 
-    SmartCardIdSource::SmartCardIdSource() : IdSource(SMART_CARD_SOURCE_NAME)
+    SmartCardIdSource::SmartCardIdSource() : SmartCardIdSource(PCSCContext::instance())
+    {
+    }
+
+    SmartCardIdSource::SmartCardIdSource(PCSCContext &pcsc_context) :
+        IdSource(SMART_CARD_SOURCE_NAME),
+        pcsc_context_(pcsc_context)
     {
     }
 
     void SmartCardIdSource::enable()
     {
-        PCSCContext::instance().uid_extract_enable(
-            [&](auto &extracted_uid) { uid_extracted(extracted_uid); });
+        pcsc_context_.uid_extract_enable(
+            [&](auto extracted_uids) { uids_extracted(extracted_uids); });
 
         set_enabled(true);
     }
 
     void SmartCardIdSource::disable()
     {
-        PCSCContext::instance().uid_extract_disable();
+        pcsc_context_.uid_extract_disable();
 
         set_enabled(false);
     }
 
+    Statistics SmartCardIdSource::statistics() const
+    {
+        return pcsc_context_.statistics();
+    }
+
+    void SmartCardIdSource::uids_extracted(PCSCContext::UIDQueue::Batch extracted_uids) const
+    {
+        for (const PCSCContext::ExtractedUID &extracted_uid : extracted_uids) {
+            uid_extracted(extracted_uid);
+        }
+    }
+
     void SmartCardIdSource::uid_extracted(const PCSCContext::ExtractedUID &extracted_uid) const
     {
         IdentifiedUser identified_user;
 
-        identified_user.user_identification_id =
-            std::string(SMART_CARD_SOURCE_NAME) + "-" + uid_to_string(extracted_uid.uid);
+        identified_user.user_identification_id = SMART_CARD_SOURCE_NAME;
+        identified_user.user_identification_id.append("-");
+
+        if (extracted_uid.ndef_message) {
+            identified_user.user_identification_id.append(NDEF_MESSAGE_ID_PREFIX);
+        }
+
+        append_hex(extracted_uid.uid, identified_user.user_identification_id);
 
-        // TODO: Make mapping to seat id dependant on extracted_uid.reader_name? If mapping is
+        // TODO: Make mapping to seat id dependant on extracted_uid.reader_id? If mapping is
         //       stored in Configuration, it probably should be, then Daemon::apply_config() needs
         //       to propagate configuration to IdSources. Perhaps replace call to
         //       IdSource::Group::enable() in Daemon::apply_config() with
@@ -72,6 +114,7 @@ namespace UserIdentificationManager::Daemon
         //       that method. Want to minimize logic in Daemon. Should not know about different
         //       sources etc. at that level.
         identified_user.seat_id = SEAT_ID_MAIN_USER;
+        identified_user.timestamp_us = extracted_uid.timestamp_us;
 
         user_identified(identified_user);
     }
@@ -21,12 +21,18 @@ namespace UserIdentificationManager::Daemon
     {
     public:
         SmartCardIdSource();
+        explicit SmartCardIdSource(PCSCContext &pcsc_context);
 
         void enable() override;
         void disable() override;
 
+        Statistics statistics() const override;
+
     private:
+        void uids_extracted(PCSCContext::UIDQueue::Batch extracted_uids) const;
         void uid_extracted(const PCSCContext::ExtractedUID &extracted_uid) const;
+
+        PCSCContext &pcsc_context_;
     };
 }
 
@@ -10,96 +10,393 @@
 #define UIM_DAEMON_IDLE_QUEUE_H
 
 #include <glibmm.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <mutex>
+#include <system_error>
 #include <utility>
 #include <vector>
 
+#include "config.h"
+#if UIM_CONFIG_DAEMON_IDLE_QUEUE_LOCK_FREE
+#    include "daemon/mpsc_ring_buffer.h"
+#endif
+
 namespace UserIdentificationManager::Daemon
 {
-    // Thread safe queue that notifies the main thread when it is idle.
+    // Thread safe queue that notifies the main thread through the main loop.
     //
     // Meant to isolate thread synchronization details as much as possible from the rest of the
     // program.
     //
     // Any thread can push values to the queue. A callback will be invoked in the main
-    // thread for each value popped from the queue. The main thread is expected to run a
-    // Glib::MainLoop with the default context. See g_idle_add() for more details.
+    // thread for each value popped from the queue. Alternatively, a batch callback can be set that
+    // is invoked once with all values popped at the same time. The main thread is expected to run
+    // a Glib::MainLoop with the default context.
+    //
+    // The main loop is woken up through an eventfd polled by a GSource attached with the priority
+    // passed to the constructor. Unlike g_idle_add() (G_PRIORITY_DEFAULT_IDLE) this means values
+    // are not starved by other sources as long as they do not have a higher priority. The name is
+    // kept for historical reasons.
+    //
+    // The queue is bounded. What happens when capacity() values are already waiting to be popped
+    // is decided by the OverflowPolicy passed to the constructor, see below. The number of dropped
+    // and coalesced values are counted. By default a lock-free ring buffer is used so that pushing
+    // threads never contend with the main thread on a lock. Build with -Didle_queue_lock_free=false
+    // to use a mutex protected vector instead. COALESCE_BY_KEY always uses the mutex protected
+    // vector since it needs to look at the values waiting to be popped.
+    //
+    // Values are popped into a buffer that is reserved up front and reused, the mutex protected
+    // vector is double-buffered with it. Pushing and popping does not allocate memory in steady
+    // state (apart from what moving T may do).
     template <typename T>
     class IdleQueue
     {
     public:
+        // Contiguous range of values popped in one go. Only valid during batch callback.
+        class Batch
+        {
+        public:
+            Batch(const T *data, std::size_t size) : data_(data), size_(size)
+            {
+            }
+
+            const T *begin() const
+            {
+                return data_;
+            }
+
+            const T *end() const
+            {
+                return data_ + size_;
+            }
+
+            std::size_t size() const
+            {
+                return size_;
+            }
+
+            bool empty() const
+            {
+                return size_ == 0;
+            }
+
+            const T &operator[](std::size_t index) const
+            {
+                return data_[index];
+            }
+
+        private:
+            const T *data_;
+            std::size_t size_;
+        };
+
+        enum class OverflowPolicy
+        {
+            // Pushed value is dropped and push() returns false.
+            DROP_NEWEST,
+            // Oldest value waiting to be popped is dropped to make room for pushed value.
+            DROP_OLDEST,
+            // If full, a value waiting to be popped with the same key (as decided by the SameKey
+            // function passed to the constructor) as the pushed value is replaced by it. Falls
+            // back to DROP_OLDEST if there is no such value. Nothing is coalesced while there is
+            // room for the pushed value.
+            COALESCE_BY_KEY
+        };
+
         using Callback = std::function<void(const T &)>;
+        using BatchCallback = std::function<void(Batch)>;
+        using SameKey = std::function<bool(const T &, const T &)>;
 
-        IdleQueue() = default;
+        static constexpr std::size_t DEFAULT_CAPACITY = 256;
 
-        ~IdleQueue()
+        explicit IdleQueue(std::size_t capacity = DEFAULT_CAPACITY,
+                           int priority = G_PRIORITY_DEFAULT,
+                           OverflowPolicy overflow_policy = OverflowPolicy::DROP_NEWEST,
+                           SameKey &&same_key = SameKey()) :
+#if UIM_CONFIG_DAEMON_IDLE_QUEUE_LOCK_FREE
+            // Not used for COALESCE_BY_KEY, smallest possible then.
+            ring_values_(overflow_policy == OverflowPolicy::COALESCE_BY_KEY ? 1 : capacity),
+#endif
+            capacity_(capacity),
+            overflow_policy_(overflow_policy),
+            same_key_(std::move(same_key)),
+            event_fd_(create_event_fd()),
+            source_(create_source(priority))
         {
-            std::lock_guard<std::mutex> lock(shared_.mutex);
+            popped_values_.reserve(this->capacity());
 
-            if (shared_.idle_source_id != 0) {
-                g_source_remove(shared_.idle_source_id);
+            if (!uses_ring_values()) {
+                shared_.values.reserve(capacity_);
             }
         }
 
+        ~IdleQueue()
+        {
+            g_source_destroy(source_);
+            g_source_unref(source_);
+            close(event_fd_);
+        }
+
         IdleQueue(const IdleQueue &other) = delete;
         IdleQueue(IdleQueue &&other) = delete;
         IdleQueue &operator=(const IdleQueue &other) = delete;
         IdleQueue &operator=(IdleQueue &&other) = delete;
 
-        void push(T &&value)
+        std::size_t capacity() const
         {
-            std::lock_guard<std::mutex> lock(shared_.mutex);
+#if UIM_CONFIG_DAEMON_IDLE_QUEUE_LOCK_FREE
+            if (uses_ring_values()) {
+                return ring_values_.capacity();
+            }
+#endif
+            return capacity_;
+        }
+
+        // Returns false if the pushed value is dropped. value is left untouched in that case.
+        bool push(T &&value)
+        {
+#if UIM_CONFIG_DAEMON_IDLE_QUEUE_LOCK_FREE
+            bool pushed = uses_ring_values() ? push_to_ring_values(std::move(value))
+                                             : push_to_shared_values(std::move(value));
+#else
+            bool pushed = push_to_shared_values(std::move(value));
+#endif
 
-            shared_.values.emplace_back(std::move(value));
+            if (!pushed) {
+                return false;
+            }
 
-            if (shared_.idle_source_id == 0) {
-                shared_.idle_source_id = g_idle_add(&idle_function, this);
+            // Only write to eventfd for first value pushed since last dispatch. Avoids a system
+            // call per value when several values are pushed before the main loop wakes up.
+            if (!wakeup_pending_.exchange(true, std::memory_order_acq_rel)) {
+                wake_up();
             }
+
+            return true;
         }
 
         void set_callback(Callback &&callback)
+        {
+            if (!callback) {
+                clear_callback();
+                return;
+            }
+
+            set_batch_callback([value_callback = std::move(callback)](Batch batch) {
+                for (const T &value : batch) {
+                    value_callback(value);
+                }
+            });
+        }
+
+        void set_batch_callback(BatchCallback &&callback)
         {
             callback_ = std::move(callback);
         }
 
         void clear_callback()
         {
-            set_callback(Callback());
+            set_batch_callback(BatchCallback());
+        }
+
+        // Number of values dropped due to the queue being full. Can be called from any thread.
+        std::uint64_t dropped_count() const
+        {
+            return dropped_count_.load(std::memory_order_relaxed);
+        }
+
+        // Number of values replaced by a value with the same key. Can be called from any thread.
+        std::uint64_t coalesced_count() const
+        {
+            return coalesced_count_.load(std::memory_order_relaxed);
         }
 
     private:
-        static int idle_function(void *data)
+        struct Source
+        {
+            GSource source;
+            IdleQueue *queue;
+        };
+
+        static int create_event_fd()
         {
-            static_cast<IdleQueue *>(data)->pop_and_invoke_callback();
-            return G_SOURCE_REMOVE;
+            int fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+            if (fd == -1) {
+                throw std::system_error(errno, std::generic_category(), "eventfd() failed");
+            }
+
+            return fd;
+        }
+
+        GSource *create_source(int priority)
+        {
+            static GSourceFuncs source_funcs = [] {
+                GSourceFuncs funcs = {};
+                funcs.dispatch = &dispatch;
+                return funcs;
+            }();
+
+            GSource *source = g_source_new(&source_funcs, sizeof(Source));
+
+            // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+            reinterpret_cast<Source *>(source)->queue = this;
+
+            g_source_add_unix_fd(source, event_fd_, G_IO_IN);
+            g_source_set_priority(source, priority);
+            g_source_set_name(source, "IdleQueue");
+            g_source_attach(source, nullptr);
+
+            return source;
+        }
+
+        static gboolean dispatch(GSource *source, GSourceFunc /*callback*/, gpointer /*data*/)
+        {
+            // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+            reinterpret_cast<Source *>(source)->queue->pop_and_invoke_callback();
+            return G_SOURCE_CONTINUE;
+        }
+
+        bool uses_ring_values() const
+        {
+#if UIM_CONFIG_DAEMON_IDLE_QUEUE_LOCK_FREE
+            return overflow_policy_ != OverflowPolicy::COALESCE_BY_KEY;
+#else
+            return false;
+#endif
+        }
+
+#if UIM_CONFIG_DAEMON_IDLE_QUEUE_LOCK_FREE
+        bool push_to_ring_values(T &&value)
+        {
+            while (!ring_values_.try_push(std::move(value))) {
+                if (overflow_policy_ == OverflowPolicy::DROP_NEWEST) {
+                    dropped_count_.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+
+                T dropped_value;
+                if (ring_values_.try_pop(dropped_value)) {
+                    dropped_count_.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+
+            return true;
+        }
+#endif
+
+        bool push_to_shared_values(T &&value)
+        {
+            std::lock_guard<std::mutex> lock(shared_.mutex);
+            std::vector<T> &values = shared_.values;
+
+            if (values.size() >= capacity_) {
+                if (overflow_policy_ == OverflowPolicy::COALESCE_BY_KEY) {
+                    for (T &queued_value : values) {
+                        if (same_key_(queued_value, value)) {
+                            queued_value = std::move(value);
+                            coalesced_count_.fetch_add(1, std::memory_order_relaxed);
+                            return true;
+                        }
+                    }
+                }
+
+                dropped_count_.fetch_add(1, std::memory_order_relaxed);
+
+                if (overflow_policy_ == OverflowPolicy::DROP_NEWEST) {
+                    return false;
+                }
+
+                values.erase(values.begin());
+            }
+
+            values.emplace_back(std::move(value));
+
+            return true;
+        }
+
+        void wake_up()
+        {
+            const std::uint64_t value = 1;
+            ssize_t ret;
+
+            do {
+                ret = write(event_fd_, &value, sizeof(value));
+            } while (ret == -1 && errno == EINTR);
+        }
+
+        void clear_wake_up()
+        {
+            std::uint64_t value = 0;
+            ssize_t ret;
+
+            do {
+                ret = read(event_fd_, &value, sizeof(value));
+            } while (ret == -1 && errno == EINTR);
         }
 
         void pop_and_invoke_callback()
         {
-            std::vector<T> popped_values;
+            // Clear eventfd and flag before popping. A value pushed after this point wakes up the
+            // main loop again. Acquire synchronizes with the exchange in push() so that all values
+            // pushed before it are visible below.
+            clear_wake_up();
+            wakeup_pending_.exchange(false, std::memory_order_acq_rel);
+
+#if UIM_CONFIG_DAEMON_IDLE_QUEUE_LOCK_FREE
+            if (uses_ring_values()) {
+                // Values still left after popping capacity() values were pushed after flag was
+                // cleared and will trigger another dispatch. Limit keeps popped_values_ within its
+                // capacity.
+                T popped_value;
+                while (popped_values_.size() < capacity() && ring_values_.try_pop(popped_value)) {
+                    popped_values_.emplace_back(std::move(popped_value));
+                }
+            } else
+#endif
             {
+                // popped_values_ is empty but keeps its capacity, swapping hands it to pushing
+                // threads as next buffer to fill.
                 std::lock_guard<std::mutex> lock(shared_.mutex);
-                popped_values = std::move(shared_.values);
-                shared_.idle_source_id = 0;
+                std::swap(popped_values_, shared_.values);
             }
 
-            for (const T &value : popped_values) {
-                if (callback_) {
-                    callback_(value);
-                }
+            if (callback_ && !popped_values_.empty()) {
+                callback_(Batch(popped_values_.data(), popped_values_.size()));
             }
+
+            popped_values_.clear();
         }
 
+#if UIM_CONFIG_DAEMON_IDLE_QUEUE_LOCK_FREE
+        MPSCRingBuffer<T> ring_values_;
+#endif
+        const std::size_t capacity_;
+
         struct
         {
             std::mutex mutex;
             std::vector<T> values;
-            guint idle_source_id = 0;
         } shared_;
 
-        Callback callback_;
+        const OverflowPolicy overflow_policy_;
+        const SameKey same_key_;
+        std::atomic<std::uint64_t> dropped_count_{0};
+        std::atomic<std::uint64_t> coalesced_count_{0};
+
+        std::atomic<bool> wakeup_pending_{false};
+        const int event_fd_;
+        GSource *const source_;
+
+        std::vector<T> popped_values_;
+        BatchCallback callback_;
     };
 }
 
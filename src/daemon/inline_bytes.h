@@ -0,0 +1,120 @@
+// Copyright (C) 2019 Luxoft Sweden AB
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+//
+// SPDX-License-Identifier: MPL-2.0
+
+#ifndef UIM_DAEMON_INLINE_BYTES_H
+#define UIM_DAEMON_INLINE_BYTES_H
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+
+namespace UserIdentificationManager::Daemon
+{
+    // Byte string with a fixed capacity, stored inline.
+    //
+    // Used for ATRs, UIDs and APDU responses so that handling a card never allocates memory.
+    // Copying is a plain copy of CAPACITY bytes. assign() refuses data that does not fit instead
+    // of truncating it.
+    template <std::size_t CAPACITY>
+    class InlineBytes
+    {
+    public:
+        using const_iterator = const std::uint8_t *;
+
+        InlineBytes() = default;
+
+        // For constants. Bytes that do not fit are ignored.
+        InlineBytes(std::initializer_list<std::uint8_t> bytes) :
+            size_(std::min(bytes.size(), CAPACITY))
+        {
+            std::copy_n(bytes.begin(), size_, bytes_.begin());
+        }
+
+        static constexpr std::size_t capacity()
+        {
+            return CAPACITY;
+        }
+
+        // Returns false, leaving the content unchanged, if size is larger than the capacity.
+        bool assign(const std::uint8_t *data, std::size_t size)
+        {
+            if (size > CAPACITY) {
+                return false;
+            }
+
+            std::copy_n(data, size, bytes_.begin());
+            size_ = size;
+
+            return true;
+        }
+
+        // Set the size after writing to data(), e.g. when receiving. Clamped to the capacity.
+        void resize(std::size_t size)
+        {
+            size_ = std::min(size, CAPACITY);
+        }
+
+        std::uint8_t *data()
+        {
+            return bytes_.data();
+        }
+
+        const std::uint8_t *data() const
+        {
+            return bytes_.data();
+        }
+
+        std::size_t size() const
+        {
+            return size_;
+        }
+
+        bool empty() const
+        {
+            return size_ == 0;
+        }
+
+        const_iterator begin() const
+        {
+            return bytes_.data();
+        }
+
+        const_iterator end() const
+        {
+            return bytes_.data() + size_;
+        }
+
+        std::uint8_t operator[](std::size_t i) const
+        {
+            return bytes_[i];
+        }
+
+        friend bool operator==(const InlineBytes &a, const InlineBytes &b)
+        {
+            return std::equal(a.begin(), a.end(), b.begin(), b.end());
+        }
+
+        friend bool operator!=(const InlineBytes &a, const InlineBytes &b)
+        {
+            return !(a == b);
+        }
+
+        friend bool operator<(const InlineBytes &a, const InlineBytes &b)
+        {
+            return std::lexicographical_compare(a.begin(), a.end(), b.begin(), b.end());
+        }
+
+    private:
+        std::array<std::uint8_t, CAPACITY> bytes_{};
+        std::size_t size_ = 0;
+    };
+}
+
+#endif // UIM_DAEMON_INLINE_BYTES_H
@@ -0,0 +1,93 @@
+// Copyright (C) 2019 Luxoft Sweden AB
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+//
+// SPDX-License-Identifier: MPL-2.0
+
+#include "daemon/mount_watcher.h"
+
+#include <giomm.h>
+#include <glibmm.h>
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "config.h"
+#include "daemon/mountinfo_mount_watcher.h"
+
+namespace UserIdentificationManager::Daemon
+{
+    namespace
+    {
+        class VolumeMonitorMountWatcher : public MountWatcher
+        {
+        public:
+            VolumeMonitorMountWatcher()
+            {
+                mount_added_connection_ = volume_monitor_->signal_mount_added().connect(
+                    [this](const Glib::RefPtr<Gio::Mount> &mount) {
+                        emit(mount_added_, mount);
+                    });
+
+                mount_removed_connection_ = volume_monitor_->signal_mount_removed().connect(
+                    [this](const Glib::RefPtr<Gio::Mount> &mount) {
+                        emit(mount_removed_, mount);
+                    });
+            }
+
+            ~VolumeMonitorMountWatcher() override
+            {
+                mount_added_connection_.disconnect();
+                mount_removed_connection_.disconnect();
+            }
+
+            VolumeMonitorMountWatcher(const VolumeMonitorMountWatcher &other) = delete;
+            VolumeMonitorMountWatcher(VolumeMonitorMountWatcher &&other) = delete;
+            VolumeMonitorMountWatcher &operator=(const VolumeMonitorMountWatcher &other) = delete;
+            VolumeMonitorMountWatcher &operator=(VolumeMonitorMountWatcher &&other) = delete;
+
+            std::vector<std::string> mounts() override
+            {
+                std::vector<std::string> roots;
+
+                for (const auto &mount : volume_monitor_->get_mounts()) {
+                    std::string root = mount->get_root()->get_path();
+
+                    if (!root.empty()) {
+                        roots.emplace_back(std::move(root));
+                    }
+                }
+
+                return roots;
+            }
+
+        private:
+            // Mounts without a local path, e.g. gvfs network mounts, are ignored.
+            static void emit(MountSignal &signal, const Glib::RefPtr<Gio::Mount> &mount)
+            {
+                std::string root = mount->get_root()->get_path();
+
+                if (!root.empty()) {
+                    signal.emit(root);
+                }
+            }
+
+            Glib::RefPtr<Gio::VolumeMonitor> volume_monitor_ = Gio::VolumeMonitor::get();
+            sigc::connection mount_added_connection_;
+            sigc::connection mount_removed_connection_;
+        };
+    }
+
+    std::unique_ptr<MountWatcher> MountWatcher::create()
+    {
+#if UIM_CONFIG_DAEMON_MOUNT_WATCHER_MOUNTINFO
+        return std::make_unique<MountinfoMountWatcher>();
+#else
+        return std::make_unique<VolumeMonitorMountWatcher>();
+#endif
+    }
+}
@@ -0,0 +1,59 @@
+// Copyright (C) 2019 Luxoft Sweden AB
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+//
+// SPDX-License-Identifier: MPL-2.0
+
+#ifndef UIM_DAEMON_MOUNT_WATCHER_H
+#define UIM_DAEMON_MOUNT_WATCHER_H
+
+#include <sigc++/sigc++.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace UserIdentificationManager::Daemon
+{
+    // Reports mounted file systems by the path of their root directory.
+    //
+    // create() returns the implementation selected at build time. By default Gio::VolumeMonitor
+    // is used. Build with -Dmount_watcher=mountinfo to watch /proc/self/mountinfo instead, which
+    // does not need gvfs, see MountinfoMountWatcher. Signals are emitted in the main thread.
+    class MountWatcher
+    {
+    public:
+        using MountSignal = sigc::signal<void, const std::string &>;
+
+        static std::unique_ptr<MountWatcher> create();
+
+        MountWatcher() = default;
+        virtual ~MountWatcher() = default;
+
+        MountWatcher(const MountWatcher &other) = delete;
+        MountWatcher(MountWatcher &&other) = delete;
+        MountWatcher &operator=(const MountWatcher &other) = delete;
+        MountWatcher &operator=(MountWatcher &&other) = delete;
+
+        // Root directories of the current mounts, in mount order.
+        virtual std::vector<std::string> mounts() = 0;
+
+        MountSignal &signal_mount_added()
+        {
+            return mount_added_;
+        }
+
+        MountSignal &signal_mount_removed()
+        {
+            return mount_removed_;
+        }
+
+    protected:
+        MountSignal mount_added_;
+        MountSignal mount_removed_;
+    };
+}
+
+#endif // UIM_DAEMON_MOUNT_WATCHER_H
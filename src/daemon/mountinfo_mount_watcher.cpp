@@ -0,0 +1,374 @@
+// Copyright (C) 2019 Luxoft Sweden AB
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+//
+// SPDX-License-Identifier: MPL-2.0
+
+#include "daemon/mountinfo_mount_watcher.h"
+
+#include <fcntl.h>
+#include <glib.h>
+#include <glibmm.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace UserIdentificationManager::Daemon
+{
+    namespace
+    {
+        // Fields before the optional fields, which are ended by a "-" field.
+        constexpr std::size_t DEVICE_FIELD = 2;
+        constexpr std::size_t MOUNT_POINT_FIELD = 4;
+        constexpr std::size_t MIN_FIELDS_BEFORE_SEPARATOR = 6;
+
+        constexpr std::string_view OPTIONAL_FIELDS_END = "-";
+        constexpr std::string_view BLOCK_DEVICE_PREFIX = "/dev/";
+        constexpr std::string_view USER_MOUNT_POINT_PREFIXES[] = {"/media/", "/run/media/"};
+        constexpr std::string_view HIDDEN_PATH_COMPONENT = "/.";
+
+        bool starts_with(std::string_view string, std::string_view prefix)
+        {
+            return string.substr(0, prefix.size()) == prefix;
+        }
+
+        // Take the next space separated field from line.
+        std::optional<std::string_view> take_field(std::string_view &line)
+        {
+            if (line.empty()) {
+                return {};
+            }
+
+            std::size_t end = line.find(' ');
+            std::string_view field = line.substr(0, end);
+
+            line.remove_prefix(end == std::string_view::npos ? line.size() : end + 1);
+
+            return field;
+        }
+
+        bool is_octal_digit(char c)
+        {
+            return c >= '0' && c <= '7';
+        }
+
+        std::unordered_map<std::uint64_t, const MountinfoMountWatcher::Mount *>
+        user_visible_by_id(const std::vector<MountinfoMountWatcher::Mount> &mounts)
+        {
+            std::unordered_map<std::uint64_t, const MountinfoMountWatcher::Mount *> by_id;
+
+            for (const MountinfoMountWatcher::Mount &mount : mounts) {
+                if (mount.user_visible) {
+                    by_id.emplace(mount.id, &mount);
+                }
+            }
+
+            return by_id;
+        }
+
+        // Whether the same mount is in by_id. Mount IDs are reused after unmounting, so the device
+        // and source must be the same too. Options may differ, e.g. after remounting read-only.
+        bool has_mount(
+            const std::unordered_map<std::uint64_t, const MountinfoMountWatcher::Mount *> &by_id,
+            const MountinfoMountWatcher::Mount &mount)
+        {
+            auto it = by_id.find(mount.id);
+
+            return it != by_id.end() && it->second->device == mount.device &&
+                   it->second->source == mount.source &&
+                   it->second->mount_point == mount.mount_point;
+        }
+    }
+
+    MountinfoMountWatcher::MountinfoMountWatcher(std::string path) : path_(std::move(path))
+    {
+        update(false);
+    }
+
+    MountinfoMountWatcher::~MountinfoMountWatcher()
+    {
+        retry_connection_.disconnect();
+        close_file();
+    }
+
+    std::vector<std::string> MountinfoMountWatcher::mounts()
+    {
+        std::vector<std::string> mount_points;
+
+        for (const Mount &mount : mounts_) {
+            if (mount.user_visible) {
+                mount_points.emplace_back(mount.mount_point);
+            }
+        }
+
+        return mount_points;
+    }
+
+    void MountinfoMountWatcher::poll()
+    {
+        update(true);
+    }
+
+    bool MountinfoMountWatcher::open_file()
+    {
+        if (fd_ != -1) {
+            return true;
+        }
+
+        fd_ = open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+
+        if (fd_ == -1) {
+            g_warning("%s: failed to open: %s", path_.c_str(), g_strerror(errno));
+            return false;
+        }
+
+        io_connection_ = Glib::signal_io().connect(
+            [this](Glib::IOCondition /*condition*/) {
+                poll();
+                return true;
+            },
+            fd_,
+            Glib::IO_PRI | Glib::IO_ERR);
+
+        return true;
+    }
+
+    void MountinfoMountWatcher::close_file()
+    {
+        if (fd_ == -1) {
+            return;
+        }
+
+        io_connection_.disconnect();
+        close(fd_);
+        fd_ = -1;
+    }
+
+    bool MountinfoMountWatcher::read_file()
+    {
+        if (!open_file()) {
+            return false;
+        }
+
+        if (lseek(fd_, 0, SEEK_SET) == -1) {
+            g_warning("%s: failed to seek: %s", path_.c_str(), g_strerror(errno));
+            close_file();
+            return false;
+        }
+
+        std::size_t size = 0;
+
+        while (true) {
+            if (buffer_.size() < size + READ_SIZE) {
+                buffer_.resize(size + READ_SIZE);
+            }
+
+            ssize_t bytes_read = read(fd_, &buffer_[size], buffer_.size() - size);
+
+            if (bytes_read == -1 && errno == EINTR) {
+                continue;
+            }
+
+            if (bytes_read == -1) {
+                g_warning("%s: failed to read: %s", path_.c_str(), g_strerror(errno));
+                close_file();
+                return false;
+            }
+
+            if (bytes_read == 0) {
+                break;
+            }
+
+            size += bytes_read;
+        }
+
+        buffer_.resize(size);
+
+        return true;
+    }
+
+    void MountinfoMountWatcher::update(bool emit)
+    {
+        if (!read_file()) {
+            if (!retry_connection_.connected()) {
+                retry_connection_ = Glib::signal_timeout().connect_seconds_once(
+                    [this] { poll(); }, RETRY_INTERVAL.count());
+            }
+            return;
+        }
+
+        if (buffer_ == contents_) {
+            return;
+        }
+
+        contents_.swap(buffer_);
+
+        std::unordered_map<std::uint64_t, const Mount *> previous_by_id;
+
+        for (const Mount &mount : mounts_) {
+            previous_by_id.emplace(mount.id, &mount);
+        }
+
+        std::vector<Mount> current;
+        std::string_view rest = contents_;
+
+        current.reserve(mounts_.size());
+
+        while (!rest.empty()) {
+            std::size_t end = rest.find('\n');
+            std::string_view line = rest.substr(0, end);
+
+            rest.remove_prefix(end == std::string_view::npos ? rest.size() : end + 1);
+
+            std::optional<std::uint64_t> id = Parser::parse_id(line);
+
+            if (!id) {
+                continue;
+            }
+
+            auto it = previous_by_id.find(*id);
+
+            if (it != previous_by_id.end() && it->second->line == line) {
+                current.emplace_back(*it->second);
+                continue;
+            }
+
+            std::optional<Mount> mount = Parser::parse_line(line);
+
+            if (mount) {
+                current.emplace_back(std::move(*mount));
+            }
+        }
+
+        std::vector<Mount> previous = std::exchange(mounts_, std::move(current));
+
+        if (!emit) {
+            return;
+        }
+
+        // E.g. a moved mount keeps its ID but is removed from the old mount point and added to the
+        // new.
+        auto previous_user_visible = user_visible_by_id(previous);
+        auto current_user_visible = user_visible_by_id(mounts_);
+
+        for (const Mount &mount : previous) {
+            if (mount.user_visible && !has_mount(current_user_visible, mount)) {
+                mount_removed_.emit(mount.mount_point);
+            }
+        }
+
+        for (const Mount &mount : mounts_) {
+            if (mount.user_visible && !has_mount(previous_user_visible, mount)) {
+                mount_added_.emit(mount.mount_point);
+            }
+        }
+    }
+
+    std::optional<std::uint64_t> MountinfoMountWatcher::Parser::parse_id(std::string_view line)
+    {
+        std::string_view field = line.substr(0, line.find(' '));
+        const char *end = field.data() + field.size();
+        std::uint64_t id = 0;
+
+        auto [ptr, error] = std::from_chars(field.data(), end, id);
+
+        if (error != std::errc() || ptr != end) {
+            return {};
+        }
+
+        return id;
+    }
+
+    std::optional<MountinfoMountWatcher::Mount> MountinfoMountWatcher::Parser::parse_line(
+        std::string_view line)
+    {
+        std::optional<std::uint64_t> id = parse_id(line);
+
+        if (!id) {
+            return {};
+        }
+
+        Mount mount;
+        std::string_view rest = line;
+        std::size_t index = 0;
+
+        mount.id = *id;
+        mount.line = line;
+
+        // Up to and including the end of the optional fields.
+        for (std::optional<std::string_view> field; (field = take_field(rest)); index++) {
+            if (index == DEVICE_FIELD) {
+                mount.device = *field;
+            }
+
+            if (index == MOUNT_POINT_FIELD) {
+                mount.mount_point = unescape(*field);
+            }
+
+            if (index >= MIN_FIELDS_BEFORE_SEPARATOR && *field == OPTIONAL_FIELDS_END) {
+                break;
+            }
+        }
+
+        std::optional<std::string_view> file_system_type = take_field(rest);
+        std::optional<std::string_view> source = take_field(rest);
+
+        if (index < MIN_FIELDS_BEFORE_SEPARATOR || !file_system_type || !source) {
+            g_warning("Malformed mountinfo line: %.*s", static_cast<int>(line.size()), line.data());
+            return {};
+        }
+
+        mount.source = *source;
+        mount.user_visible =
+            starts_with(*source, BLOCK_DEVICE_PREFIX) && is_user_visible(mount.mount_point);
+
+        return mount;
+    }
+
+    bool MountinfoMountWatcher::Parser::is_user_visible(std::string_view mount_point)
+    {
+        if (mount_point.find(HIDDEN_PATH_COMPONENT) != std::string_view::npos) {
+            return false;
+        }
+
+        for (std::string_view prefix : USER_MOUNT_POINT_PREFIXES) {
+            if (starts_with(mount_point, prefix)) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    std::string MountinfoMountWatcher::Parser::unescape(std::string_view field)
+    {
+        std::string unescaped;
+
+        unescaped.reserve(field.size());
+
+        for (std::size_t i = 0; i < field.size(); i++) {
+            if (field[i] == '\\' && i + 3 < field.size() && is_octal_digit(field[i + 1]) &&
+                is_octal_digit(field[i + 2]) && is_octal_digit(field[i + 3])) {
+                unescaped += static_cast<char>(((field[i + 1] - '0') << 6) |
+                                               ((field[i + 2] - '0') << 3) | (field[i + 3] - '0'));
+                i += 3;
+            } else {
+                unescaped += field[i];
+            }
+        }
+
+        return unescaped;
+    }
+}
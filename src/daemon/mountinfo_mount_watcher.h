@@ -0,0 +1,111 @@
+// Copyright (C) 2019 Luxoft Sweden AB
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+//
+// SPDX-License-Identifier: MPL-2.0
+
+#ifndef UIM_DAEMON_MOUNTINFO_MOUNT_WATCHER_H
+#define UIM_DAEMON_MOUNTINFO_MOUNT_WATCHER_H
+
+#include <glibmm.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "daemon/mount_watcher.h"
+
+namespace UserIdentificationManager::Daemon
+{
+    // Watches mounts through /proc/self/mountinfo, without Gio::VolumeMonitor and gvfs.
+    //
+    // The kernel reports changes of the mount table by poll() returning POLLPRI for the open
+    // file, the file is then read again. Lines are compared to the previous contents by mount ID
+    // and only new or changed lines are parsed. Mount IDs are reused, so a mount is only the same
+    // as before if its device, source and mount point are too. If reading fails, the file is
+    // opened again after RETRY_INTERVAL since changes are not reported while it is closed.
+    //
+    // Like Gio::VolumeMonitor, only mounts a user would see in a file manager are reported: block
+    // devices, i.e. with a source under /dev/, mounted under /media/ or /run/media/ and not hidden
+    // by a dot directory. System mount points like / and /boot and virtual file systems like proc
+    // and tmpfs are not.
+    //
+    // The path can be changed for tests, a regular file never reports changes so tests call
+    // poll() after changing it.
+    class MountinfoMountWatcher : public MountWatcher
+    {
+    public:
+        struct Parser;
+
+        static constexpr char DEFAULT_PATH[] = "/proc/self/mountinfo";
+        static constexpr std::chrono::seconds RETRY_INTERVAL{1};
+
+        explicit MountinfoMountWatcher(std::string path = DEFAULT_PATH);
+        ~MountinfoMountWatcher() override;
+
+        MountinfoMountWatcher(const MountinfoMountWatcher &other) = delete;
+        MountinfoMountWatcher(MountinfoMountWatcher &&other) = delete;
+        MountinfoMountWatcher &operator=(const MountinfoMountWatcher &other) = delete;
+        MountinfoMountWatcher &operator=(MountinfoMountWatcher &&other) = delete;
+
+        std::vector<std::string> mounts() override;
+
+        // Read the file and emit mount_removed and then mount_added for the changes since last
+        // read.
+        void poll();
+
+        struct Mount
+        {
+            std::uint64_t id = 0;
+            std::string line;
+            // major:minor of the device.
+            std::string device;
+            std::string source;
+            std::string mount_point;
+            bool user_visible = false;
+        };
+
+    private:
+        static constexpr std::size_t READ_SIZE = 4096;
+
+        bool open_file();
+        void close_file();
+        // Into buffer_. Returns false on failure.
+        bool read_file();
+        void update(bool emit);
+
+        std::string path_;
+        int fd_ = -1;
+        sigc::connection io_connection_;
+        sigc::connection retry_connection_;
+
+        // Last contents read, buffer_ is swapped with it when contents change.
+        std::string contents_;
+        std::string buffer_;
+        std::vector<Mount> mounts_;
+    };
+
+    struct MountinfoMountWatcher::Parser
+    {
+        // Mount ID, the first field, without parsing the rest of the line.
+        static std::optional<std::uint64_t> parse_id(std::string_view line);
+
+        // Parse a line of mountinfo, see proc(5).
+        static std::optional<Mount> parse_line(std::string_view line);
+
+        // Whether a block device mounted at mount_point is shown to users, like
+        // g_unix_mount_guess_should_display() does for the root user the daemon runs as.
+        static bool is_user_visible(std::string_view mount_point);
+
+        // Undo the octal escaping, e.g. "\040" for space, of a field.
+        static std::string unescape(std::string_view field);
+    };
+}
+
+#endif // UIM_DAEMON_MOUNTINFO_MOUNT_WATCHER_H
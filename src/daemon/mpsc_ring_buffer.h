@@ -0,0 +1,128 @@
+// Copyright (C) 2019 Luxoft Sweden AB
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+//
+// SPDX-License-Identifier: MPL-2.0
+
+#ifndef UIM_DAEMON_MPSC_RING_BUFFER_H
+#define UIM_DAEMON_MPSC_RING_BUFFER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+namespace UserIdentificationManager::Daemon
+{
+    // Bounded lock-free multi-producer/single-consumer ring buffer.
+    //
+    // Any number of threads may call try_push() concurrently. Capacity is rounded up to the nearest
+    // power of two. try_pop() is meant to be called by one consumer but is safe to call from
+    // producers as well, which allows a producer to evict the oldest value when full.
+    //
+    // Each slot has a sequence number that tells producers and consumers whose turn it is to
+    // access the slot. A position is claimed with a CAS on the push/pop position and the slot is
+    // handed over by bumping its sequence number. See Dmitry Vyukov's bounded MPMC queue.
+    template <typename T>
+    class MPSCRingBuffer
+    {
+    public:
+        explicit MPSCRingBuffer(std::size_t capacity) :
+            mask_(round_up_to_power_of_two(capacity) - 1),
+            slots_(std::make_unique<Slot[]>(mask_ + 1))
+        {
+            for (std::size_t i = 0; i <= mask_; i++) {
+                slots_[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        MPSCRingBuffer(const MPSCRingBuffer &other) = delete;
+        MPSCRingBuffer(MPSCRingBuffer &&other) = delete;
+        MPSCRingBuffer &operator=(const MPSCRingBuffer &other) = delete;
+        MPSCRingBuffer &operator=(MPSCRingBuffer &&other) = delete;
+
+        std::size_t capacity() const
+        {
+            return mask_ + 1;
+        }
+
+        // Returns false if full. value is only moved from if true is returned.
+        bool try_push(T &&value)
+        {
+            std::size_t pos = push_pos_.load(std::memory_order_relaxed);
+
+            while (true) {
+                Slot &slot = slots_[pos & mask_];
+                std::size_t sequence = slot.sequence.load(std::memory_order_acquire);
+                auto diff = std::intptr_t(sequence) - std::intptr_t(pos);
+
+                if (diff == 0) {
+                    if (push_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        slot.value = std::move(value);
+                        slot.sequence.store(pos + 1, std::memory_order_release);
+                        return true;
+                    }
+                } else if (diff < 0) {
+                    return false;
+                } else {
+                    pos = push_pos_.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // Returns false if empty or if the next value has been claimed by a producer but not yet
+        // published. In the latter case the producer is responsible for notifying the consumer
+        // after try_push() returns.
+        bool try_pop(T &value)
+        {
+            std::size_t pos = pop_pos_.load(std::memory_order_relaxed);
+
+            while (true) {
+                Slot &slot = slots_[pos & mask_];
+                std::size_t sequence = slot.sequence.load(std::memory_order_acquire);
+                auto diff = std::intptr_t(sequence) - std::intptr_t(pos + 1);
+
+                if (diff == 0) {
+                    if (pop_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        value = std::move(slot.value);
+                        slot.sequence.store(pos + mask_ + 1, std::memory_order_release);
+                        return true;
+                    }
+                } else if (diff < 0) {
+                    return false;
+                } else {
+                    pos = pop_pos_.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+    private:
+        struct Slot
+        {
+            std::atomic<std::size_t> sequence{0};
+            T value;
+        };
+
+        static constexpr std::size_t round_up_to_power_of_two(std::size_t n)
+        {
+            std::size_t power = 1;
+            while (power < n) {
+                power <<= 1;
+            }
+            return power;
+        }
+
+        static constexpr std::size_t CACHE_LINE_SIZE = 64;
+
+        const std::size_t mask_;
+        const std::unique_ptr<Slot[]> slots_;
+
+        alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> push_pos_{0};
+        alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> pop_pos_{0};
+    };
+}
+
+#endif // UIM_DAEMON_MPSC_RING_BUFFER_H
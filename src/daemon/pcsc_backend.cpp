@@ -0,0 +1,138 @@
+// Copyright (C) 2019 Luxoft Sweden AB
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+//
+// SPDX-License-Identifier: MPL-2.0
+
+#include "daemon/pcsc_backend.h"
+
+#include <winscard.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace UserIdentificationManager::Daemon
+{
+    namespace
+    {
+        std::vector<std::string> multi_string_split(const char *multi_string)
+        {
+            std::vector<std::string> strings;
+            const char *pos = multi_string;
+
+            while (*pos) {
+                strings.emplace_back(pos);
+                pos += strings.back().size() + 1;
+            }
+
+            return strings;
+        }
+
+        class WinscardBackend : public PCSCBackend
+        {
+        public:
+            LONG establish_context(SCARDCONTEXT &context) override
+            {
+                return SCardEstablishContext(SCARD_SCOPE_SYSTEM, nullptr, nullptr, &context);
+            }
+
+            LONG release_context(SCARDCONTEXT context) override
+            {
+                return SCardReleaseContext(context);
+            }
+
+            LONG list_readers(SCARDCONTEXT context, std::vector<std::string> &reader_names) override
+            {
+                // Querying buffer size and then filling buffer with two calls to
+                // SCardListReaders() is racey in pcsc-lite. Each call updates reader list from
+                // service. Will most likely fail if first call reports X readers and next call
+                // reports X+1 readers due to buffer being too small. The X+1:th reader will never
+                // be noticed. Have seen this happen so use SCARD_AUTOALLOCATE even though it
+                // requires ugly casting of buffer argument and is not exception safe (if
+                // multi_string_split() OOM:s we want to terminate anyway).
+                char *readers_multi_string;
+                auto readers_multi_string_size = static_cast<DWORD>(SCARD_AUTOALLOCATE);
+
+                LONG ret = SCardListReaders(
+                    context,
+                    nullptr,
+                    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+                    reinterpret_cast<LPSTR>(&readers_multi_string),
+                    &readers_multi_string_size);
+
+                if (ret != SCARD_S_SUCCESS) {
+                    return ret;
+                }
+
+                reader_names = multi_string_split(readers_multi_string);
+
+                SCardFreeMemory(context, readers_multi_string);
+
+                return ret;
+            }
+
+            LONG get_status_change(SCARDCONTEXT context,
+                                   DWORD timeout,
+                                   SCARD_READERSTATE *states,
+                                   DWORD num_states) override
+            {
+                return SCardGetStatusChange(context, timeout, states, num_states);
+            }
+
+            LONG cancel(SCARDCONTEXT context) override
+            {
+                return SCardCancel(context);
+            }
+
+            LONG connect(SCARDCONTEXT context,
+                         const char *reader_name,
+                         DWORD share_mode,
+                         DWORD preferred_protocols,
+                         SCARDHANDLE &handle,
+                         DWORD &active_protocol) override
+            {
+                return SCardConnect(context,
+                                    reader_name,
+                                    share_mode,
+                                    preferred_protocols,
+                                    &handle,
+                                    &active_protocol);
+            }
+
+            LONG reconnect(SCARDHANDLE handle,
+                           DWORD share_mode,
+                           DWORD preferred_protocols,
+                           DWORD initialization,
+                           DWORD &active_protocol) override
+            {
+                return SCardReconnect(
+                    handle, share_mode, preferred_protocols, initialization, &active_protocol);
+            }
+
+            LONG disconnect(SCARDHANDLE handle, DWORD disposition) override
+            {
+                return SCardDisconnect(handle, disposition);
+            }
+
+            LONG transmit(SCARDHANDLE handle,
+                          const SCARD_IO_REQUEST *send_pci,
+                          const std::uint8_t *send_buffer,
+                          DWORD send_length,
+                          std::uint8_t *recv_buffer,
+                          DWORD &recv_length) override
+            {
+                return SCardTransmit(
+                    handle, send_pci, send_buffer, send_length, nullptr, recv_buffer, &recv_length);
+            }
+        };
+    }
+
+    PCSCBackend &PCSCBackend::winscard()
+    {
+        static WinscardBackend backend;
+        return backend;
+    }
+}
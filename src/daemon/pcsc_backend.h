@@ -0,0 +1,69 @@
+// Copyright (C) 2019 Luxoft Sweden AB
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+//
+// SPDX-License-Identifier: MPL-2.0
+
+#ifndef UIM_DAEMON_PCSC_BACKEND_H
+#define UIM_DAEMON_PCSC_BACKEND_H
+
+#include <winscard.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace UserIdentificationManager::Daemon
+{
+    // The SCard API calls made by PCSCContext and its helpers.
+    //
+    // winscard() forwards to pcsc-lite. Tests substitute a fake implementation to simulate
+    // readers and cards without pcscd. Methods mirror the SCard functions with the same name and
+    // return codes, except list_readers() that splits the reader names. All methods must be
+    // thread safe.
+    class PCSCBackend
+    {
+    public:
+        static PCSCBackend &winscard();
+
+        PCSCBackend() = default;
+        virtual ~PCSCBackend() = default;
+
+        PCSCBackend(const PCSCBackend &other) = delete;
+        PCSCBackend(PCSCBackend &&other) = delete;
+        PCSCBackend &operator=(const PCSCBackend &other) = delete;
+        PCSCBackend &operator=(PCSCBackend &&other) = delete;
+
+        virtual LONG establish_context(SCARDCONTEXT &context) = 0;
+        virtual LONG release_context(SCARDCONTEXT context) = 0;
+        virtual LONG list_readers(SCARDCONTEXT context, std::vector<std::string> &reader_names) = 0;
+        virtual LONG get_status_change(SCARDCONTEXT context,
+                                       DWORD timeout,
+                                       SCARD_READERSTATE *states,
+                                       DWORD num_states) = 0;
+        virtual LONG cancel(SCARDCONTEXT context) = 0;
+
+        virtual LONG connect(SCARDCONTEXT context,
+                             const char *reader_name,
+                             DWORD share_mode,
+                             DWORD preferred_protocols,
+                             SCARDHANDLE &handle,
+                             DWORD &active_protocol) = 0;
+        virtual LONG reconnect(SCARDHANDLE handle,
+                               DWORD share_mode,
+                               DWORD preferred_protocols,
+                               DWORD initialization,
+                               DWORD &active_protocol) = 0;
+        virtual LONG disconnect(SCARDHANDLE handle, DWORD disposition) = 0;
+        virtual LONG transmit(SCARDHANDLE handle,
+                              const SCARD_IO_REQUEST *send_pci,
+                              const std::uint8_t *send_buffer,
+                              DWORD send_length,
+                              std::uint8_t *recv_buffer,
+                              DWORD &recv_length) = 0;
+    };
+}
+
+#endif // UIM_DAEMON_PCSC_BACKEND_H
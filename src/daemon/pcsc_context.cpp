@@ -11,11 +11,12 @@
 #include <glibmm.h>
 #include <winscard.h>
 
+#include <algorithm>
 #include <chrono>
 #include <cstdint>
 #include <cstdlib>
+#include <list>
 #include <mutex>
-#include <optional>
 #include <string>
 #include <thread>
 #include <utility>
@@ -25,267 +26,222 @@ namespace UserIdentificationManager::Daemon
 {
     namespace
     {
-        class Card
-        {
-        public:
-            ~Card()
-            {
-                disconnect();
-            }
-
-            bool connect(SCARDCONTEXT context, const char *reader_name)
-            {
-                disconnect();
-
-                SCARDHANDLE handle = 0;
-                DWORD active_protocol = SCARD_PROTOCOL_UNDEFINED;
-                LONG ret = SCardConnect(context,
-                                        reader_name,
-                                        SCARD_SHARE_SHARED,
-                                        SCARD_PROTOCOL_T0 | SCARD_PROTOCOL_T1,
-                                        &handle,
-                                        &active_protocol);
+        constexpr char NOTIFICATION_READER_NAME[] = R"(\\?PnP?\Notification)";
+        constexpr unsigned int NOTIFICATION_STATE_INDEX = 0;
 
-                if (ret != SCARD_S_SUCCESS) {
-                    g_warning("SCardConnect() failed for reader \"%s\": %s",
-                              reader_name,
-                              pcsc_stringify_error(ret));
-                    return false;
-                }
+        std::vector<std::string> list_readers(PCSCBackend &backend, SCARDCONTEXT context)
+        {
+            std::vector<std::string> reader_names;
 
-                handle_ = handle;
+            LONG ret = backend.list_readers(context, reader_names);
 
-                switch (active_protocol) {
-                case SCARD_PROTOCOL_T0:
-                    send_pci_ = SCARD_PCI_T0;
-                    break;
-                case SCARD_PROTOCOL_T1:
-                    send_pci_ = SCARD_PCI_T1;
-                    break;
-                default:
-                    g_warning("SCardConnect() returned unknown protocol (%lu) for reader \"%s\"",
-                              active_protocol,
-                              reader_name);
-                    disconnect();
-                    return false;
+            if (ret != SCARD_S_SUCCESS) {
+                if (ret != SCARD_E_NO_READERS_AVAILABLE) {
+                    g_warning("Failed to list PC/SC readers: %s", pcsc_stringify_error(ret));
                 }
 
-                return true;
+                return {};
             }
 
-            void disconnect()
-            {
-                if (!handle_) {
-                    return;
-                }
-
-                LONG ret = SCardDisconnect(*handle_, SCARD_LEAVE_CARD);
-
-                handle_.reset();
+            return reader_names;
+        }
 
-                if (ret != SCARD_S_SUCCESS) {
-                    g_warning("SCardDisconnect() failed: %s", pcsc_stringify_error(ret));
+        std::vector<std::string> list_readers_until_stable(PCSCBackend &backend,
+                                                           SCARDCONTEXT context)
+        {
+            // Looks like \\?PnP?\Notification can miss readers in pcsc-lite. Number of readers
+            // are counted at start of SCardGetStatusChange() and \\?PnP?\Notification is only
+            // set to "changed" if the number of readers change. If a reader is added between
+            // SCardListReaders() and SCardGetStatusChange(), it will not be noticed. Have observed
+            // this behavior with the ACR1252 that exposes two readers, they are not added at the
+            // same time and the second one can show up almost READER_SETTLE_TIME after the first.
+            // List readers again until the list has not changed for READER_SETTLE_TIME, but do not
+            // wait longer than MAX_READER_SETTLE_WAIT for readers that keep coming and going.
+            constexpr auto READER_RECHECK_INTERVAL = std::chrono::milliseconds(10);
+            constexpr auto READER_SETTLE_TIME = std::chrono::milliseconds(100);
+            constexpr auto MAX_READER_SETTLE_WAIT = std::chrono::milliseconds(500);
+
+            auto start = std::chrono::steady_clock::now();
+            auto last_change = start;
+            std::vector<std::string> reader_names = list_readers(backend, context);
+
+            while (true) {
+                auto now = std::chrono::steady_clock::now();
+
+                if (now - last_change >= READER_SETTLE_TIME ||
+                    now - start >= MAX_READER_SETTLE_WAIT) {
+                    break;
                 }
-            }
 
-            std::size_t transmit(const std::vector<std::uint8_t> &send_buffer,
-                                 std::vector<std::uint8_t> &recv_buffer)
-            {
-                DWORD recv_length = recv_buffer.size();
+                std::this_thread::sleep_for(READER_RECHECK_INTERVAL);
 
-                LONG ret = SCardTransmit(*handle_,
-                                         send_pci_,
-                                         send_buffer.data(),
-                                         send_buffer.size(),
-                                         nullptr,
-                                         recv_buffer.data(),
-                                         &recv_length);
+                std::vector<std::string> listed_names = list_readers(backend, context);
 
-                if (ret != SCARD_S_SUCCESS) {
-                    g_warning("SCardTransmit() failed: %s", pcsc_stringify_error(ret));
-                    return 0;
+                if (listed_names != reader_names) {
+                    reader_names = std::move(listed_names);
+                    last_change = std::chrono::steady_clock::now();
                 }
-
-                return recv_length;
             }
 
-        private:
-            std::optional<SCARDHANDLE> handle_;
-            const SCARD_IO_REQUEST *send_pci_ = nullptr;
-        };
-
-        constexpr char NOTIFICATION_READER_NAME[] = R"(\\?PnP?\Notification)";
-        constexpr unsigned int NOTIFICATION_STATE_INDEX = 0;
-
-        std::vector<std::string> multi_string_split(const char *multi_string)
-        {
-            std::vector<std::string> strings;
-            const char *pos = multi_string;
-
-            while (*pos) {
-                strings.emplace_back(pos);
-                pos += strings.back().size() + 1;
-            }
-
-            return strings;
+            return reader_names;
         }
 
-        std::vector<std::string> list_readers(SCARDCONTEXT context)
+        // pcscd stopped or restarted, the context must be established again.
+        bool service_lost(LONG ret)
         {
-            // Querying buffer size and then filling buffer with two calls to SCardListReaders() is
-            // racey in pcsc-lite. Each call updates reader list from service. Will most likely fail
-            // if first call reports X readers and next call reports X+1 readers due to buffer being
-            // too small. The X+1:th reader will never be noticed. Have seen this happen so use
-            // SCARD_AUTOALLOCATE even though it requires ugly casting of buffer argument and is not
-            // exception safe (if multi_string_split() OOM:s we want to terminate anyway).
-            char *readers_multi_string;
-            auto readers_multi_string_size = static_cast<DWORD>(SCARD_AUTOALLOCATE);
-            LONG ret;
-
-            ret = SCardListReaders(context,
-                                   nullptr,
-                                   // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
-                                   reinterpret_cast<LPSTR>(&readers_multi_string),
-                                   &readers_multi_string_size);
-
-            if (ret != SCARD_S_SUCCESS) {
-                if (ret != SCARD_E_NO_READERS_AVAILABLE) {
-                    g_warning("Failed to list PC/SC readers: %s", pcsc_stringify_error(ret));
-                }
-
-                return {};
-            }
-
-            std::vector<std::string> readers = multi_string_split(readers_multi_string);
-
-            SCardFreeMemory(context, readers_multi_string);
-
-            return readers;
+            return ret == SCARD_E_NO_SERVICE || ret == SCARD_E_SERVICE_STOPPED ||
+                   ret == SCARD_E_INVALID_HANDLE;
         }
 
-        std::vector<SCARD_READERSTATE> initial_states(const std::vector<std::string> &reader_names)
+        std::vector<SCARD_READERSTATE> initial_states()
         {
-            std::vector<SCARD_READERSTATE> reader_states(1 + reader_names.size());
+            std::vector<SCARD_READERSTATE> reader_states(1);
 
             reader_states[NOTIFICATION_STATE_INDEX].szReader = NOTIFICATION_READER_NAME;
             reader_states[NOTIFICATION_STATE_INDEX].dwCurrentState = SCARD_STATE_UNAWARE;
             reader_states[NOTIFICATION_STATE_INDEX].dwEventState = SCARD_STATE_UNAWARE;
 
-            for (std::size_t i = 0; i < reader_names.size(); i++) {
-                reader_states[1 + i].szReader = reader_names[i].c_str();
-                reader_states[1 + i].dwCurrentState = SCARD_STATE_UNAWARE;
-                reader_states[1 + i].dwEventState = SCARD_STATE_UNAWARE;
-            }
-
             return reader_states;
         }
 
-        bool get_data_uid_supported(const SCARD_READERSTATE &state)
-        {
-            // TODO: Better parsing of ATR and find out if the "get data" command can be used to
-            //       extract UID for other cards than contactless storage cards that are identified
-            //       with this ATR. See:
-            //       - "3.1.3.2.3.2  Contactless Storage Cards" in
-            //         https://muscle.apdu.fr/www.pcscworkgroup.com/PCSC/V2/pcsc3_v2.01.09.pdf .
-            //       - https://en.wikipedia.org/wiki/Answer_to_reset
-            if (state.cbAtr > 5) {
-                return state.rgbAtr[5] == 0x4f;
-            }
-            return false;
-        }
-
-        std::optional<std::vector<std::uint8_t>> transmit_get_data_uid(SCARDCONTEXT context,
-                                                                       const char *reader_name)
+        // Make reader_names and states match listed_names. Only added and removed readers are
+        // touched, readers still present keep their state. A std::list is used for reader names
+        // since states refer to them with szReader. Returns true if any reader was removed.
+        bool update_readers(const std::vector<std::string> &listed_names,
+                            std::list<std::string> &reader_names,
+                            std::vector<SCARD_READERSTATE> &states)
         {
-            // See "3.2.2.1.3  Get Data Command" in
-            // https://muscle.apdu.fr/www.pcscworkgroup.com/PCSC/V2/pcsc3_v2.01.09.pdf
-            constexpr unsigned int UID_MIN_LENGTH = 4;
-            constexpr unsigned int UID_MAX_LENGTH = 10;
-            constexpr unsigned int ERROR_CODE_LENGTH = 2;
-            constexpr std::uint16_t ERROR_CODE_SUCCESS = 0x9000;
-            constexpr unsigned int RECV_MIN_LENGTH = UID_MIN_LENGTH + ERROR_CODE_LENGTH;
-            constexpr unsigned int RECV_MAX_LENGTH = UID_MAX_LENGTH + ERROR_CODE_LENGTH;
-            const std::vector<std::uint8_t> get_data_command = {0xff, 0xca, 0x00, 0x00, 0x00};
-            std::vector<std::uint8_t> recv_buffer(RECV_MAX_LENGTH);
-
-            Card card;
-
-            if (!card.connect(context, reader_name)) {
-                return {};
+            bool removed = false;
+
+            for (auto it = reader_names.begin(); it != reader_names.end();) {
+                if (std::find(listed_names.cbegin(), listed_names.cend(), *it) ==
+                    listed_names.cend()) {
+                    auto is_reader = [&](const SCARD_READERSTATE &state) {
+                        return state.szReader == it->c_str();
+                    };
+                    states.erase(std::find_if(states.begin(), states.end(), is_reader));
+                    it = reader_names.erase(it);
+                    removed = true;
+                } else {
+                    ++it;
+                }
             }
 
-            std::size_t recv_length = card.transmit(get_data_command, recv_buffer);
-
-            if (recv_length < RECV_MIN_LENGTH) {
-                g_warning("Too few bytes received from reader \"%s\" for Get Data command, "
-                          "received %zu bytes but expected at least %u bytes",
-                          reader_name,
-                          recv_length,
-                          RECV_MIN_LENGTH);
-                return {};
-            }
+            for (const std::string &listed_name : listed_names) {
+                if (std::find(reader_names.cbegin(), reader_names.cend(), listed_name) !=
+                    reader_names.cend()) {
+                    continue;
+                }
 
-            std::uint16_t error_code =
-                recv_buffer[recv_length - 2] << 8 | recv_buffer[recv_length - 1];
+                reader_names.emplace_back(listed_name);
 
-            if (error_code != ERROR_CODE_SUCCESS) {
-                g_warning("Received error 0x%04x from reader \"%s\" for Get Data command",
-                          error_code,
-                          reader_name);
-                return {};
+                SCARD_READERSTATE &state = states.emplace_back();
+                state.szReader = reader_names.back().c_str();
+                state.dwCurrentState = SCARD_STATE_UNAWARE;
+                state.dwEventState = SCARD_STATE_UNAWARE;
             }
 
-            recv_buffer.resize(recv_length - 2);
-
-            return recv_buffer;
+            return removed;
         }
     }
 
-    PCSCContext::PCSCContext()
+    PCSCContext::PCSCContext(PCSCBackend &backend, std::chrono::milliseconds backoff_min) :
+        backend_(backend),
+        reconnect_backoff_min_(backoff_min)
     {
-        thread_ = std::thread(&PCSCContext::thread, this);
     }
 
     PCSCContext::~PCSCContext()
     {
-        thread_join();
+        thread_stop();
     }
 
     PCSCContext &PCSCContext::instance()
     {
-        static PCSCContext context;
+        static PCSCContext context(PCSCBackend::winscard());
         return context;
     }
 
-    void PCSCContext::uid_extract_enable(UIDQueue::Callback &&callback)
+    void PCSCContext::uid_extract_enable(UIDQueue::BatchCallback &&callback)
     {
-        uid_extract_ = true;
-        uid_queue_.set_callback(std::move(callback));
+        uid_queue_.set_batch_callback(std::move(callback));
+        reader_pool_.start();
+        thread_start();
     }
 
     void PCSCContext::uid_extract_disable()
     {
+        thread_stop();
+        reader_pool_.stop();
+        // The cached card connections were released with the contexts of the readers.
+        uid_extractor_.forget_connections();
         uid_queue_.clear_callback();
-        uid_extract_ = false;
+    }
+
+    Statistics PCSCContext::statistics() const
+    {
+        Statistics statistics = {{"uid_queue.dropped", uid_queue_.dropped_count()},
+                                 {"reader_pool.dropped", reader_pool_.dropped_count()},
+                                 {"reader_pool.timeouts", reader_pool_.timeout_count()},
+                                 {"reader_pool.cancelled", reader_pool_.cancelled_count()},
+                                 {"reader_pool.abandoned", reader_pool_.abandoned_count()},
+                                 {"pcscd.connected", counters_.connected.load()},
+                                 {"pcscd.connect_failed", counters_.connect_failed.load()},
+                                 {"pcscd.lost", counters_.lost.load()},
+                                 {"pcscd.status_change_failed",
+                                  counters_.status_change_failed.load()}};
+        Statistics uid_extractor_statistics = uid_extractor_.statistics();
+
+        statistics.insert(statistics.end(),
+                          uid_extractor_statistics.cbegin(),
+                          uid_extractor_statistics.cend());
+
+        return statistics;
     }
 
     void PCSCContext::thread()
     {
-        LONG ret;
+        // Connection to pcscd is a small state machine, each transition is counted:
+        //
+        //   disconnected -> connected     SCardEstablishContext() succeeded, "pcscd.connected"
+        //   disconnected -> disconnected  It failed, back off, "pcscd.connect_failed"
+        //   connected -> disconnected     pcscd went away, back off, "pcscd.lost"
+        //   connected -> connected        Other SCardGetStatusChange() error, back off,
+        //                                 "pcscd.status_change_failed"
+        //
+        // Reader states are kept while disconnected so that cards inserted meanwhile are noticed
+        // when connected again. The backoff is reset by a successful SCardGetStatusChange().
         SCARDCONTEXT context = 0;
+        std::list<std::string> reader_names;
+        std::vector<SCARD_READERSTATE> states = initial_states();
+        std::chrono::milliseconds backoff = reconnect_backoff_min_;
+        bool connect_failure_logged = false;
 
-        ret = SCardEstablishContext(SCARD_SCOPE_SYSTEM, nullptr, nullptr, &context);
-        if (ret != SCARD_S_SUCCESS) {
-            g_warning("Failed to establish PC/SC context: %s", pcsc_stringify_error(ret));
-            return;
-        }
+        while (true) {
+            if (!context) {
+                LONG ret = backend_.establish_context(context);
 
-        context_ = context;
+                if (ret != SCARD_S_SUCCESS) {
+                    context = 0;
+                    counters_.connect_failed++;
+                    // Only warn once per outage, pcscd may be down for a long time.
+                    if (!connect_failure_logged) {
+                        g_warning("Failed to establish PC/SC context: %s, retrying",
+                                  pcsc_stringify_error(ret));
+                        connect_failure_logged = true;
+                    }
+                    if (!thread_backoff(backoff)) {
+                        break;
+                    }
+                    continue;
+                }
 
-        std::vector<std::string> reader_names = list_readers(context);
-        std::vector<SCARD_READERSTATE> states = initial_states(reader_names);
+                counters_.connected++;
+                connect_failure_logged = false;
+                context_ = context;
+                update_readers(list_readers(backend_, context), reader_names, states);
+            }
 
-        while (true) {
             {
                 std::unique_lock<std::mutex> lock(run_status_.mutex);
                 if (run_status_.stop) {
@@ -294,7 +250,7 @@ namespace UserIdentificationManager::Daemon
                 run_status_.cancellable = true;
             }
 
-            ret = SCardGetStatusChange(context, INFINITE, states.data(), states.size());
+            LONG ret = backend_.get_status_change(context, INFINITE, states.data(), states.size());
 
             {
                 std::unique_lock<std::mutex> lock(run_status_.mutex);
@@ -305,56 +261,114 @@ namespace UserIdentificationManager::Daemon
                 }
             }
 
+            if (ret == SCARD_E_CANCELLED || ret == SCARD_E_TIMEOUT) {
+                continue;
+            }
+
             if (ret != SCARD_S_SUCCESS) {
-                if (ret != SCARD_E_CANCELLED) {
+                if (service_lost(ret)) {
+                    g_warning("Lost connection to pcscd: %s, reconnecting",
+                              pcsc_stringify_error(ret));
+                    counters_.lost++;
+                    context_ = 0;
+                    backend_.release_context(context);
+                    context = 0;
+                    // Contexts of the readers are gone too, they are established again for the
+                    // next card.
+                    reader_pool_.retain_readers({});
+                } else {
                     g_warning("Failed to get PC/SC status change: %s", pcsc_stringify_error(ret));
+                    counters_.status_change_failed++;
+                }
+                if (!thread_backoff(backoff)) {
+                    break;
                 }
                 continue;
             }
 
-            check_states_after_get_status_change(context, states);
+            backoff = reconnect_backoff_min_;
+
+            check_states_after_get_status_change(states);
 
             if (states[NOTIFICATION_STATE_INDEX].dwEventState & SCARD_STATE_CHANGED) {
-                // Looks like \\?PnP?\Notification can miss readers in pcsc-lite. Number of readers
-                // are counted at start of SCardGetStatusChange() and \\?PnP?\Notification is only
-                // set to "changed" if the number of readers change. If a reader is added between
-                // SCardListReaders() and SCardGetStatusChange(), it will not be noticed. Sleeping a
-                // bit makes it less likely that a reader is not detected in next SCardListReaders()
-                // call. Have observed this behavior with the ACR1252 that exposes two readers. It
-                // is very often both of them are not detected without this sleep.
-                std::this_thread::sleep_for(std::chrono::milliseconds(100));
-                reader_names = list_readers(context);
-                states = initial_states(reader_names);
+                std::vector<std::string> listed_names =
+                    list_readers_until_stable(backend_, context);
+
+                if (update_readers(listed_names, reader_names, states)) {
+                    std::vector<ReaderId> listed_ids;
+
+                    for (const std::string &listed_name : listed_names) {
+                        listed_ids.emplace_back(reader_names_.intern(listed_name));
+                    }
+
+                    reader_pool_.retain_readers(listed_ids);
+                }
             }
         }
 
-        ret = SCardReleaseContext(context);
+        if (!context) {
+            return;
+        }
+
+        context_ = 0;
+
+        LONG ret = backend_.release_context(context);
         if (ret != SCARD_S_SUCCESS) {
             g_warning("Failed to release PC/SC context: %s", pcsc_stringify_error(ret));
         }
     }
 
-    void PCSCContext::thread_join()
+    bool PCSCContext::thread_backoff(std::chrono::milliseconds &backoff)
     {
+        std::unique_lock<std::mutex> lock(run_status_.mutex);
+
+        bool stop = run_status_.stop_condition.wait_for(
+            lock, backoff, [this] { return run_status_.stop; });
+
+        backoff = std::min(backoff * 2, RECONNECT_BACKOFF_MAX);
+
+        return !stop;
+    }
+
+    void PCSCContext::thread_start()
+    {
+        if (thread_.joinable()) {
+            return;
+        }
+
+        run_status_.stop = false;
+        thread_ = std::thread(&PCSCContext::thread, this);
+    }
+
+    void PCSCContext::thread_stop()
+    {
+        if (!thread_.joinable()) {
+            return;
+        }
+
         {
             std::unique_lock<std::mutex> lock(run_status_.mutex);
 
             run_status_.stop = true;
+            run_status_.stop_condition.notify_one();
 
-            // SCardCancel() may not be noticed so loop until it is. Condition to wake up
-            // as quickly as possible when it is done and to retry if it is not. See
+            // SCardCancel() may not be noticed so retry until it is, SCardGetStatusChange() waits
+            // without timeout. Condition to wake up as quickly as possible when it is done.
+            // Backing off keeps the retries cheap if pcscd is slow to respond. See
             // https://salsa.debian.org/rousseau/PCSC/issues/16 for upstream bug.
+            auto retry_interval = CANCEL_RETRY_INTERVAL_MIN;
+
             while (run_status_.cancellable) {
-                SCardCancel(context_);
-                run_status_.cancelled_condition.wait_for(lock, std::chrono::milliseconds(50));
+                backend_.cancel(context_);
+                run_status_.cancelled_condition.wait_for(lock, retry_interval);
+                retry_interval = std::min(retry_interval * 2, CANCEL_RETRY_INTERVAL_MAX);
             }
         }
 
         thread_.join();
     }
 
-    void PCSCContext::check_states_after_get_status_change(SCARDCONTEXT context,
-                                                           std::vector<SCARD_READERSTATE> &states)
+    void PCSCContext::check_states_after_get_status_change(std::vector<SCARD_READERSTATE> &states)
     {
         for (std::size_t i = 0; i < states.size(); i++) {
             if (i == NOTIFICATION_STATE_INDEX) {
@@ -366,7 +380,7 @@ namespace UserIdentificationManager::Daemon
             if (state.dwEventState & SCARD_STATE_CHANGED) {
                 if ((state.dwCurrentState & SCARD_STATE_EMPTY) &&
                     (state.dwEventState & SCARD_STATE_PRESENT)) {
-                    card_present(context, state);
+                    card_present(state);
                 }
             }
 
@@ -374,18 +388,59 @@ namespace UserIdentificationManager::Daemon
         }
     }
 
-    void PCSCContext::card_present(SCARDCONTEXT context, const SCARD_READERSTATE &state)
+    void PCSCContext::card_present(const SCARD_READERSTATE &state)
     {
-        if (uid_extract_) {
-            if (get_data_uid_supported(state)) {
-                auto uid = transmit_get_data_uid(context, state.szReader);
+        PCSCReaderPool::CardEvent event;
 
-                if (uid) {
-                    uid_queue_.push(ExtractedUID{std::move(*uid), state.szReader});
-                }
-            } else {
-                g_warning("Can not extract UID from card present at \"%s\"", state.szReader);
-            }
+        event.timestamp_us = g_get_monotonic_time();
+
+        if (!event.atr.assign(state.rgbAtr, state.cbAtr)) {
+            g_warning("Too long ATR (%lu bytes) for card present at \"%s\"",
+                      state.cbAtr,
+                      state.szReader);
+            return;
         }
+
+        reader_pool_.submit(reader_names_.intern(state.szReader), std::move(event));
+    }
+
+    void PCSCContext::extract_uid(const PCSCReaderPool::Transaction &transaction)
+    {
+        auto result = uid_extractor_.extract(transaction.context(),
+                                             transaction.reader_id(),
+                                             transaction.reader_name(),
+                                             transaction.event().atr);
+
+        // A late result from a cancelled transaction may not be trusted.
+        if (!result || transaction.cancelled()) {
+            return;
+        }
+
+        if (!uid_queue_.push(ExtractedUID{result->uid,
+                                          result->ndef_message,
+                                          transaction.reader_id(),
+                                          transaction.event().timestamp_us})) {
+            warn_uid_dropped(transaction.reader_name());
+        }
+    }
+
+    void PCSCContext::warn_uid_dropped(const std::string &reader_name)
+    {
+        constexpr gint64 INTERVAL_US =
+            std::chrono::microseconds(DROPPED_UID_WARNING_INTERVAL).count();
+        gint64 now = g_get_monotonic_time();
+        gint64 last = dropped_uid_warning_us_.load(std::memory_order_relaxed);
+
+        // Workers may drop UIDs at the same time, only the one that updates the time warns.
+        if ((last != 0 && now - last < INTERVAL_US) ||
+            !dropped_uid_warning_us_.compare_exchange_strong(last,
+                                                             now,
+                                                             std::memory_order_relaxed)) {
+            return;
+        }
+
+        g_warning("UID queue full, dropping UID extracted from \"%s\" (%llu dropped in total)",
+                  reader_name.c_str(),
+                  static_cast<unsigned long long>(uid_queue_.dropped_count()));
     }
 }
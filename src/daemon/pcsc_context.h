@@ -13,55 +13,115 @@
 #include <winscard.h>
 
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <cstdint>
 #include <mutex>
+#include <string>
 #include <thread>
 #include <utility>
 #include <vector>
 
 #include "daemon/idle_queue.h"
+#include "daemon/pcsc_backend.h"
+#include "daemon/pcsc_reader_pool.h"
+#include "daemon/reader_names.h"
+#include "daemon/statistics.h"
+#include "daemon/uid_extractor.h"
 
 namespace UserIdentificationManager::Daemon
 {
     // Helper class for pcsclite.
     //
-    // Starts a separate thread where all SCard API calls are made since there is no way to
-    // integrate nicely with a main loop. All public methods are meant to be called from the main
+    // Starts a separate thread that monitors readers since there is no way to integrate nicely
+    // with a main loop. The thread only runs while UID extraction is enabled, disabling stops it
+    // with SCardCancel(). If pcscd is not running, or restarts, the thread reconnects with
+    // exponential backoff. UIDs are extracted on a PCSCReaderPool so that the monitor thread keeps
+    // running while cards are read. The pool is started and stopped together with the thread, so
+    // no thread runs and no PC/SC context or card connection is kept while UID extraction is
+    // disabled. All public methods are meant to be called from the main
     // thread. Any callbacks invoked by PCSCContext are quaranteed to be invoked in the main thread.
     // The idea is to hide all syncronization with the thread performing SCard API calls and the
     // rest of the program in PCSCContext.
+    //
+    // Readers are referred to by interned ReaderId:s. From the status change of a card being
+    // inserted to the UID being passed to the callback no memory is allocated in steady state.
     class PCSCContext
     {
     public:
         struct ExtractedUID
         {
-            std::vector<std::uint8_t> uid;
-            std::string reader_name;
+            UIDExtractor::UID uid;
+            // See UIDExtractor::Result::ndef_message.
+            bool ndef_message;
+            ReaderId reader_id;
+            // When the card was detected, see IdSource::IdentifiedUser::timestamp_us.
+            std::int64_t timestamp_us;
         };
 
         using UIDQueue = IdleQueue<ExtractedUID>;
 
+        // Shared instance using pcsc-lite.
         static PCSCContext &instance();
 
+        // The first backoff is only changed by tests, see RECONNECT_BACKOFF_MIN.
+        explicit PCSCContext(PCSCBackend &backend,
+                             std::chrono::milliseconds backoff_min = RECONNECT_BACKOFF_MIN);
+        ~PCSCContext();
+
         PCSCContext(const PCSCContext &other) = delete;
         PCSCContext(PCSCContext &&other) = delete;
         PCSCContext &operator=(const PCSCContext &other) = delete;
         PCSCContext &operator=(PCSCContext &&other) = delete;
 
-        void uid_extract_enable(UIDQueue::Callback &&callback);
+        // Longest time uid_extract_disable() waits for UIDs being extracted. Workers still stuck
+        // in the driver after that are abandoned, see PCSCReaderPool.
+        static constexpr std::chrono::milliseconds STOP_TIMEOUT{500};
+
+        void uid_extract_enable(UIDQueue::BatchCallback &&callback);
         void uid_extract_disable();
 
+        // Name of the reader a UID was extracted from.
+        const std::string &reader_name(ReaderId reader_id) const
+        {
+            return reader_names_.name(reader_id);
+        }
+
+        Statistics statistics() const;
+
     private:
-        PCSCContext();
-        ~PCSCContext();
+        // Enough to read cards in a few readers at the same time, e.g. both readers of an
+        // ACR1252 and a reader at another seat.
+        static constexpr unsigned int UID_EXTRACT_THREADS = 4;
+
+        // Reading the UID of a well behaving card takes tens of milliseconds.
+        static constexpr std::chrono::milliseconds UID_EXTRACT_TIMEOUT{1000};
+
+        // SCardCancel() is retried with exponential backoff from the first to the second.
+        static constexpr std::chrono::milliseconds CANCEL_RETRY_INTERVAL_MIN{1};
+        static constexpr std::chrono::milliseconds CANCEL_RETRY_INTERVAL_MAX{64};
+
+        // Waiting between attempts to reach pcscd doubles from the first to the second.
+        static constexpr std::chrono::milliseconds RECONNECT_BACKOFF_MIN{100};
+        static constexpr std::chrono::milliseconds RECONNECT_BACKOFF_MAX{6400};
+
+        // While the main loop is blocked every UID extracted is dropped, warn at most this often.
+        static constexpr std::chrono::seconds DROPPED_UID_WARNING_INTERVAL{10};
 
         void thread();
-        void thread_join();
+        void thread_start();
+        void thread_stop();
+
+        // Wait for backoff, or until stopped, and double it. Returns false if stopped.
+        bool thread_backoff(std::chrono::milliseconds &backoff);
+
+        void check_states_after_get_status_change(std::vector<SCARD_READERSTATE> &states);
+        void card_present(const SCARD_READERSTATE &state);
+        void extract_uid(const PCSCReaderPool::Transaction &transaction);
+        void warn_uid_dropped(const std::string &reader_name);
 
-        void check_states_after_get_status_change(SCARDCONTEXT context,
-                                                  std::vector<SCARD_READERSTATE> &states);
-        void card_present(SCARDCONTEXT context, const SCARD_READERSTATE &state);
+        PCSCBackend &backend_;
+        const std::chrono::milliseconds reconnect_backoff_min_;
 
         std::thread thread_;
 
@@ -73,10 +133,35 @@ namespace UserIdentificationManager::Daemon
             bool stop = false;
             bool cancellable = false;
             std::condition_variable cancelled_condition;
+            std::condition_variable stop_condition;
         } run_status_;
 
-        std::atomic<bool> uid_extract_{false};
+        struct
+        {
+            std::atomic<std::uint64_t> connected{0};
+            std::atomic<std::uint64_t> connect_failed{0};
+            std::atomic<std::uint64_t> lost{0};
+            std::atomic<std::uint64_t> status_change_failed{0};
+        } counters_;
+
+        ReaderNames reader_names_;
+
+        // Every UID extracted is passed on in order, UIDs are only dropped if the queue is full.
         UIDQueue uid_queue_;
+        // Monotonic time of the last warning about a dropped UID, 0 if none.
+        std::atomic<gint64> dropped_uid_warning_us_{0};
+
+        UIDExtractor uid_extractor_{backend_};
+
+        // Declared after reader_names_, uid_queue_ and uid_extractor_ since the workers use them
+        // until the pool is destroyed.
+        PCSCReaderPool reader_pool_{
+            backend_,
+            reader_names_,
+            UID_EXTRACT_THREADS,
+            UID_EXTRACT_TIMEOUT,
+            STOP_TIMEOUT,
+            [this](const PCSCReaderPool::Transaction &transaction) { extract_uid(transaction); }};
     };
 }
 
@@ -0,0 +1,339 @@
+// Copyright (C) 2019 Luxoft Sweden AB
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+//
+// SPDX-License-Identifier: MPL-2.0
+
+#include "daemon/pcsc_reader_pool.h"
+
+#include <glib.h>
+#include <winscard.h>
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace UserIdentificationManager::Daemon
+{
+    PCSCReaderPool::Reader::Reader(PCSCBackend &pcsc_backend,
+                                   ReaderId reader_id,
+                                   const std::string &reader_name) :
+        backend(pcsc_backend),
+        id(reader_id),
+        name(reader_name)
+    {
+        pending_events.reserve(MAX_PENDING_EVENTS_PER_READER);
+    }
+
+    PCSCReaderPool::Reader::~Reader()
+    {
+        release_context();
+    }
+
+    bool PCSCReaderPool::Reader::establish_context()
+    {
+        if (context.load()) {
+            return true;
+        }
+
+        SCARDCONTEXT reader_context = 0;
+        LONG ret = backend.establish_context(reader_context);
+
+        if (ret != SCARD_S_SUCCESS) {
+            g_warning("Failed to establish PC/SC context for reader \"%s\": %s",
+                      name.c_str(),
+                      pcsc_stringify_error(ret));
+            return false;
+        }
+
+        context = reader_context;
+
+        return true;
+    }
+
+    void PCSCReaderPool::Reader::release_context()
+    {
+        SCARDCONTEXT reader_context = context.exchange(0);
+
+        if (!reader_context) {
+            return;
+        }
+
+        LONG ret = backend.release_context(reader_context);
+        if (ret != SCARD_S_SUCCESS) {
+            g_warning("Failed to release PC/SC context for reader \"%s\": %s",
+                      name.c_str(),
+                      pcsc_stringify_error(ret));
+        }
+    }
+
+    PCSCReaderPool::Run::Run(const Handler &run_handler,
+                             std::chrono::milliseconds run_transaction_timeout,
+                             const std::shared_ptr<Counters> &run_counters) :
+        handler(run_handler),
+        transaction_timeout(run_transaction_timeout),
+        counters(run_counters)
+    {
+    }
+
+    PCSCReaderPool::PCSCReaderPool(PCSCBackend &backend,
+                                   const ReaderNames &reader_names,
+                                   unsigned int num_threads,
+                                   std::chrono::milliseconds transaction_timeout,
+                                   std::chrono::milliseconds stop_timeout,
+                                   Handler &&handler) :
+        backend_(backend),
+        reader_names_(reader_names),
+        transaction_timeout_(transaction_timeout),
+        stop_timeout_(stop_timeout),
+        num_threads_(num_threads),
+        handler_(std::move(handler))
+    {
+    }
+
+    PCSCReaderPool::~PCSCReaderPool()
+    {
+        stop();
+    }
+
+    void PCSCReaderPool::start()
+    {
+        if (run_) {
+            return;
+        }
+
+        run_ = std::make_shared<Run>(handler_, transaction_timeout_, counters_);
+        run_->num_running_workers = num_threads_;
+
+        // The threads own the run too, so that an abandoned worker can finish after stop().
+        for (unsigned int i = 0; i < num_threads_; i++) {
+            threads_.emplace_back(&Run::worker, run_);
+        }
+
+        watchdog_thread_ = std::thread(&Run::watchdog, run_);
+    }
+
+    void PCSCReaderPool::stop()
+    {
+        if (!run_) {
+            return;
+        }
+
+        std::shared_ptr<Run> run = std::move(run_);
+        bool workers_finished;
+
+        {
+            std::unique_lock<std::mutex> lock(run->mutex);
+
+            run->stop = true;
+
+            for (Reader *reader : run->in_flight_readers) {
+                cancel(*reader);
+            }
+
+            run->condition.notify_all();
+            run->watchdog_condition.notify_one();
+
+            // SCardCancel() does not interrupt a driver stuck in e.g. SCardTransmit(), see the
+            // class comment.
+            workers_finished = run->stopped_condition.wait_for(
+                lock, stop_timeout_, [&run] { return run->num_running_workers == 0; });
+
+            if (!workers_finished) {
+                counters_->abandoned.fetch_add(run->num_running_workers,
+                                               std::memory_order_relaxed);
+                g_warning("%u PC/SC reader pool workers did not stop within %lld ms, abandoning",
+                          run->num_running_workers,
+                          static_cast<long long>(stop_timeout_.count()));
+            }
+
+            // Readers release their contexts when destroyed. They are created again for the next
+            // card presented after start().
+            run->ready_readers.clear();
+            run->readers.clear();
+        }
+
+        for (std::thread &thread : threads_) {
+            if (workers_finished) {
+                thread.join();
+            } else {
+                thread.detach();
+            }
+        }
+
+        threads_.clear();
+        watchdog_thread_.join();
+    }
+
+    void PCSCReaderPool::submit(ReaderId reader_id, CardEvent &&event)
+    {
+        Run &run = *run_;
+
+        {
+            std::unique_lock<std::mutex> lock(run.mutex);
+
+            std::shared_ptr<Reader> &reader = run.readers[reader_id];
+
+            if (!reader) {
+                reader =
+                    std::make_shared<Reader>(backend_, reader_id, reader_names_.name(reader_id));
+            }
+
+            // Added again before its worker was done.
+            reader->removed = false;
+
+            if (reader->pending_events.size() == MAX_PENDING_EVENTS_PER_READER) {
+                reader->pending_events.erase(reader->pending_events.begin());
+                counters_->dropped.fetch_add(1, std::memory_order_relaxed);
+                g_warning("Too many card events pending for reader \"%s\", dropped oldest",
+                          reader->name.c_str());
+            }
+
+            reader->pending_events.emplace_back(std::move(event));
+
+            // A reader in flight is put back as ready by its worker when done.
+            if (reader->in_flight || reader->pending_events.size() > 1) {
+                return;
+            }
+
+            run.ready_readers.emplace_back(reader);
+        }
+
+        run.condition.notify_one();
+    }
+
+    void PCSCReaderPool::retain_readers(const std::vector<ReaderId> &reader_ids)
+    {
+        if (!run_) {
+            return;
+        }
+
+        Run &run = *run_;
+        std::unique_lock<std::mutex> lock(run.mutex);
+
+        for (auto it = run.readers.begin(); it != run.readers.end();) {
+            const std::shared_ptr<Reader> &reader = it->second;
+
+            if (std::find(reader_ids.cbegin(), reader_ids.cend(), reader->id) !=
+                reader_ids.cend()) {
+                ++it;
+                continue;
+            }
+
+            reader->pending_events.clear();
+            run.ready_readers.erase(
+                std::remove(run.ready_readers.begin(), run.ready_readers.end(), reader),
+                run.ready_readers.end());
+
+            if (reader->in_flight) {
+                reader->removed = true;
+                ++it;
+            } else {
+                it = run.readers.erase(it);
+            }
+        }
+    }
+
+    void PCSCReaderPool::Run::worker()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        while (true) {
+            condition.wait(lock, [this] { return stop || !ready_readers.empty(); });
+
+            if (stop) {
+                break;
+            }
+
+            std::shared_ptr<Reader> reader = std::move(ready_readers.front());
+            ready_readers.erase(ready_readers.begin());
+
+            CardEvent event = reader->pending_events.front();
+            reader->pending_events.erase(reader->pending_events.begin());
+            reader->in_flight = true;
+            reader->deadline = std::chrono::steady_clock::now() + transaction_timeout;
+            in_flight_readers.emplace_back(reader.get());
+            watchdog_condition.notify_one();
+
+            lock.unlock();
+
+            if (reader->establish_context()) {
+                handler(Transaction(*reader, event));
+            }
+
+            lock.lock();
+
+            reader->in_flight = false;
+            in_flight_readers.erase(
+                std::find(in_flight_readers.begin(), in_flight_readers.end(), reader.get()));
+
+            if (reader->cancelled) {
+                // The context may be left in a bad state by the driver, start over with a new one.
+                counters->cancelled.fetch_add(1, std::memory_order_relaxed);
+                reader->release_context();
+                reader->cancelled = false;
+            }
+
+            // Forgotten while in flight, by retain_readers() or stop().
+            if (reader->removed || stop) {
+                readers.erase(reader->id);
+                continue;
+            }
+
+            if (!reader->pending_events.empty()) {
+                ready_readers.emplace_back(std::move(reader));
+                condition.notify_one();
+            }
+        }
+
+        num_running_workers--;
+        stopped_condition.notify_one();
+    }
+
+    void PCSCReaderPool::Run::watchdog()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        while (!stop) {
+            auto now = std::chrono::steady_clock::now();
+            auto next_deadline = std::chrono::steady_clock::time_point::max();
+
+            for (Reader *reader : in_flight_readers) {
+                if (reader->cancelled) {
+                    continue;
+                }
+
+                if (reader->deadline <= now) {
+                    g_warning("Transaction for reader \"%s\" timed out, cancelling",
+                              reader->name.c_str());
+                    counters->timeouts.fetch_add(1, std::memory_order_relaxed);
+                    cancel(*reader);
+                } else {
+                    next_deadline = std::min(next_deadline, reader->deadline);
+                }
+            }
+
+            if (next_deadline == std::chrono::steady_clock::time_point::max()) {
+                watchdog_condition.wait(lock);
+            } else {
+                watchdog_condition.wait_until(lock, next_deadline);
+            }
+        }
+    }
+    void PCSCReaderPool::cancel(Reader &reader)
+    {
+        reader.cancelled = true;
+
+        SCARDCONTEXT reader_context = reader.context.load();
+
+        if (reader_context) {
+            reader.backend.cancel(reader_context);
+        }
+    }
+}
@@ -0,0 +1,252 @@
+// Copyright (C) 2019 Luxoft Sweden AB
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+//
+// SPDX-License-Identifier: MPL-2.0
+
+#ifndef UIM_DAEMON_PCSC_READER_POOL_H
+#define UIM_DAEMON_PCSC_READER_POOL_H
+
+#include <winscard.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "daemon/atr.h"
+#include "daemon/pcsc_backend.h"
+#include "daemon/reader_names.h"
+
+namespace UserIdentificationManager::Daemon
+{
+    // Handles card events from PCSCContext on a small pool of worker threads.
+    //
+    // Each reader gets a PC/SC context of its own since pcsc-lite serializes all calls made with
+    // the same context. At most one event per reader is handled at a time and events for a reader
+    // are handled in the order they are submitted. Events for different readers are handled in
+    // parallel, so a slow card in one reader does not delay cards presented to other readers.
+    //
+    // Handling an event is a transaction with a deadline. A watchdog thread calls SCardCancel()
+    // on the reader's context when the deadline has passed. pcsc-lite only lets SCardCancel()
+    // interrupt blocking waits, a driver stuck in e.g. SCardTransmit() is not interrupted. So the
+    // handler must check Transaction::cancelled() before it delivers any result and the reader's
+    // context is replaced with a new one after a cancelled transaction.
+    //
+    // The worker and watchdog threads only run between start() and stop(). Stopping forgets all
+    // readers, so no PC/SC context is kept while the pool is idle. A worker still stuck in the
+    // driver when stop() has waited stop_timeout is abandoned and left to finish on its own. The
+    // pool and its threads share ownership of the state of a run, so an abandoned worker may
+    // outlive the pool. The backend, the reader names and what the handler uses must outlive it
+    // too, PCSCContext::instance() lives until the process exits.
+    //
+    // Submitting and handling events does not allocate memory once a reader has been seen.
+    class PCSCReaderPool
+    {
+        struct Reader;
+
+    public:
+        struct CardEvent
+        {
+            Atr::Bytes atr;
+            // When the card was detected, see IdSource::IdentifiedUser::timestamp_us.
+            std::int64_t timestamp_us = 0;
+        };
+
+        class Transaction
+        {
+        public:
+            Transaction(const Reader &reader, const CardEvent &event) :
+                reader_(reader), event_(event)
+            {
+            }
+
+            SCARDCONTEXT context() const
+            {
+                return reader_.context.load();
+            }
+
+            ReaderId reader_id() const
+            {
+                return reader_.id;
+            }
+
+            const std::string &reader_name() const
+            {
+                return reader_.name;
+            }
+
+            const CardEvent &event() const
+            {
+                return event_;
+            }
+
+            // True if the deadline has passed or the pool is being stopped.
+            bool cancelled() const
+            {
+                return reader_.cancelled.load();
+            }
+
+        private:
+            const Reader &reader_;
+            const CardEvent &event_;
+        };
+
+        // Invoked in a worker thread.
+        using Handler = std::function<void(const Transaction &transaction)>;
+
+        // Number of events that may wait for a reader while an event is handled for it. If more
+        // are submitted, the oldest is dropped.
+        static constexpr std::size_t MAX_PENDING_EVENTS_PER_READER = 4;
+
+        PCSCReaderPool(PCSCBackend &backend,
+                       const ReaderNames &reader_names,
+                       unsigned int num_threads,
+                       std::chrono::milliseconds transaction_timeout,
+                       std::chrono::milliseconds stop_timeout,
+                       Handler &&handler);
+        ~PCSCReaderPool();
+
+        PCSCReaderPool(const PCSCReaderPool &other) = delete;
+        PCSCReaderPool(PCSCReaderPool &&other) = delete;
+        PCSCReaderPool &operator=(const PCSCReaderPool &other) = delete;
+        PCSCReaderPool &operator=(PCSCReaderPool &&other) = delete;
+
+        // Start the worker and watchdog threads, if not running.
+        void start();
+
+        // Cancel transactions in flight, wait up to stop_timeout for the workers to finish, drop
+        // pending events and release the PC/SC contexts of all readers. The context of a reader
+        // in flight in an abandoned worker is released when the worker is done.
+        void stop();
+
+        // Only called while started, not concurrently with start() and stop().
+        void submit(ReaderId reader_id, CardEvent &&event);
+
+        // Forget all readers not in reader_ids. Events pending for them are dropped and their
+        // PC/SC contexts are released. A reader in flight is only forgotten when its worker is
+        // done, if an event is submitted for it before that it is kept. So there is never more
+        // than one transaction per reader.
+        void retain_readers(const std::vector<ReaderId> &reader_ids);
+
+        std::uint64_t dropped_count() const
+        {
+            return counters_->dropped.load(std::memory_order_relaxed);
+        }
+
+        // Number of transactions that passed their deadline.
+        std::uint64_t timeout_count() const
+        {
+            return counters_->timeouts.load(std::memory_order_relaxed);
+        }
+
+        // Number of transactions that ended cancelled, due to timeout or the pool being stopped.
+        std::uint64_t cancelled_count() const
+        {
+            return counters_->cancelled.load(std::memory_order_relaxed);
+        }
+
+        // Number of workers that did not finish within stop_timeout and were abandoned.
+        std::uint64_t abandoned_count() const
+        {
+            return counters_->abandoned.load(std::memory_order_relaxed);
+        }
+
+    private:
+        struct Reader
+        {
+            Reader(PCSCBackend &pcsc_backend, ReaderId reader_id, const std::string &reader_name);
+            ~Reader();
+
+            Reader(const Reader &other) = delete;
+            Reader(Reader &&other) = delete;
+            Reader &operator=(const Reader &other) = delete;
+            Reader &operator=(Reader &&other) = delete;
+
+            // Establish the PC/SC context if not done. Only called by the worker that has the
+            // reader in flight.
+            bool establish_context();
+            void release_context();
+
+            PCSCBackend &backend;
+            const ReaderId id;
+            const std::string &name;
+            std::atomic<SCARDCONTEXT> context{0};
+            // FIFO, reserved for MAX_PENDING_EVENTS_PER_READER.
+            std::vector<CardEvent> pending_events;
+            bool in_flight = false;
+            // Not retained while in flight, forgotten when the worker is done.
+            bool removed = false;
+            std::chrono::steady_clock::time_point deadline;
+            std::atomic<bool> cancelled{false};
+        };
+
+        struct Counters
+        {
+            std::atomic<std::uint64_t> dropped{0};
+            std::atomic<std::uint64_t> timeouts{0};
+            std::atomic<std::uint64_t> cancelled{0};
+            std::atomic<std::uint64_t> abandoned{0};
+        };
+
+        // State of the threads from start() to stop(), see the class comment.
+        struct Run
+        {
+            Run(const Handler &run_handler,
+                std::chrono::milliseconds run_transaction_timeout,
+                const std::shared_ptr<Counters> &run_counters);
+
+            Run(const Run &other) = delete;
+            Run(Run &&other) = delete;
+            Run &operator=(const Run &other) = delete;
+            Run &operator=(Run &&other) = delete;
+
+            void worker();
+            void watchdog();
+
+            const Handler handler;
+            const std::chrono::milliseconds transaction_timeout;
+            const std::shared_ptr<Counters> counters;
+
+            std::mutex mutex;
+            std::condition_variable condition;
+            bool stop = false;
+            std::map<ReaderId, std::shared_ptr<Reader>> readers;
+            // FIFO, vectors keep their capacity unlike deques that allocate blocks as they go.
+            std::vector<std::shared_ptr<Reader>> ready_readers;
+            std::vector<Reader *> in_flight_readers;
+            std::condition_variable watchdog_condition;
+            // Workers not yet finished, stopped_condition is notified when one finishes.
+            unsigned int num_running_workers = 0;
+            std::condition_variable stopped_condition;
+        };
+
+        // Call SCardCancel() for a reader in flight. Called with the mutex of the run locked.
+        static void cancel(Reader &reader);
+
+        PCSCBackend &backend_;
+        const ReaderNames &reader_names_;
+        const std::chrono::milliseconds transaction_timeout_;
+        const std::chrono::milliseconds stop_timeout_;
+        const unsigned int num_threads_;
+        const Handler handler_;
+        const std::shared_ptr<Counters> counters_ = std::make_shared<Counters>();
+
+        // Null and empty while stopped. Only touched by start() and stop(), and by submit() and
+        // retain_readers() while started.
+        std::shared_ptr<Run> run_;
+        std::vector<std::thread> threads_;
+        std::thread watchdog_thread_;
+    };
+}
+
+#endif // UIM_DAEMON_PCSC_READER_POOL_H
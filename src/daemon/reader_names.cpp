@@ -0,0 +1,39 @@
+// Copyright (C) 2019 Luxoft Sweden AB
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+//
+// SPDX-License-Identifier: MPL-2.0
+
+#include "daemon/reader_names.h"
+
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+namespace UserIdentificationManager::Daemon
+{
+    ReaderId ReaderNames::intern(std::string_view name)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        for (std::size_t i = 0; i < names_.size(); i++) {
+            if (names_[i] == name) {
+                return ReaderId(i);
+            }
+        }
+
+        names_.emplace_back(name);
+
+        return ReaderId(names_.size() - 1);
+    }
+
+    const std::string &ReaderNames::name(ReaderId id) const
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        return names_.at(id);
+    }
+}
@@ -0,0 +1,51 @@
+// Copyright (C) 2019 Luxoft Sweden AB
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+//
+// SPDX-License-Identifier: MPL-2.0
+
+#ifndef UIM_DAEMON_READER_NAMES_H
+#define UIM_DAEMON_READER_NAMES_H
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+namespace UserIdentificationManager::Daemon
+{
+    using ReaderId = std::uint16_t;
+
+    // Interned PC/SC reader names.
+    //
+    // Card events and extracted UIDs refer to readers with a ReaderId instead of carrying a copy of
+    // the name. A name gets an id the first time it is interned and keeps it, also if the reader is
+    // removed and added again. Names are never forgotten, there are only a handful of readers
+    // during the lifetime of the daemon. Thread safe, references returned by name() stay valid
+    // until ReaderNames is destroyed.
+    class ReaderNames
+    {
+    public:
+        ReaderNames() = default;
+
+        ReaderNames(const ReaderNames &other) = delete;
+        ReaderNames(ReaderNames &&other) = delete;
+        ReaderNames &operator=(const ReaderNames &other) = delete;
+        ReaderNames &operator=(ReaderNames &&other) = delete;
+
+        // Only allocates memory the first time a name is interned.
+        ReaderId intern(std::string_view name);
+
+        const std::string &name(ReaderId id) const;
+
+    private:
+        mutable std::mutex mutex_;
+        // Index is ReaderId. A deque since push_back() does not invalidate references.
+        std::deque<std::string> names_;
+    };
+}
+
+#endif // UIM_DAEMON_READER_NAMES_H
@@ -0,0 +1,290 @@
+// Copyright (C) 2019 Luxoft Sweden AB
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+//
+// SPDX-License-Identifier: MPL-2.0
+
+#ifndef UIM_DAEMON_RING_BUFFER_H
+#define UIM_DAEMON_RING_BUFFER_H
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+namespace UserIdentificationManager::Daemon
+{
+    // Keeps the last capacity() values pushed, oldest first.
+    //
+    // Storage for capacity() values is allocated up front, pushing never allocates and overwrites
+    // the oldest value when full. The capacity can be changed at runtime, keeping the newest
+    // values. Not thread safe, see MPSCRingBuffer for passing values between threads.
+    //
+    // view() gives access to the values without copying them. A View is invalidated by the next
+    // push(), set_capacity() or clear().
+    template <typename T>
+    class RingBuffer
+    {
+    public:
+        class View
+        {
+        public:
+            class const_iterator
+            {
+            public:
+                using iterator_category = std::random_access_iterator_tag;
+                using value_type = T;
+                using difference_type = std::ptrdiff_t;
+                using pointer = const T *;
+                using reference = const T &;
+
+                const_iterator() = default;
+
+                // position is first + index, below 2 * capacity.
+                const_iterator(const T *data, std::size_t capacity, std::size_t position) :
+                    data_(data),
+                    capacity_(capacity),
+                    position_(position)
+                {
+                }
+
+                reference operator*() const
+                {
+                    return data_[position_ < capacity_ ? position_ : position_ - capacity_];
+                }
+
+                pointer operator->() const
+                {
+                    return &**this;
+                }
+
+                reference operator[](difference_type n) const
+                {
+                    return *(*this + n);
+                }
+
+                const_iterator &operator++()
+                {
+                    position_++;
+                    return *this;
+                }
+
+                const_iterator operator++(int)
+                {
+                    const_iterator previous = *this;
+                    position_++;
+                    return previous;
+                }
+
+                const_iterator &operator--()
+                {
+                    position_--;
+                    return *this;
+                }
+
+                const_iterator operator--(int)
+                {
+                    const_iterator previous = *this;
+                    position_--;
+                    return previous;
+                }
+
+                const_iterator &operator+=(difference_type n)
+                {
+                    position_ += n;
+                    return *this;
+                }
+
+                const_iterator &operator-=(difference_type n)
+                {
+                    position_ -= n;
+                    return *this;
+                }
+
+                const_iterator operator+(difference_type n) const
+                {
+                    return const_iterator(data_, capacity_, position_ + n);
+                }
+
+                friend const_iterator operator+(difference_type n, const const_iterator &it)
+                {
+                    return it + n;
+                }
+
+                const_iterator operator-(difference_type n) const
+                {
+                    return const_iterator(data_, capacity_, position_ - n);
+                }
+
+                difference_type operator-(const const_iterator &other) const
+                {
+                    return difference_type(position_) - difference_type(other.position_);
+                }
+
+                bool operator==(const const_iterator &other) const
+                {
+                    return position_ == other.position_;
+                }
+
+                bool operator!=(const const_iterator &other) const
+                {
+                    return position_ != other.position_;
+                }
+
+                bool operator<(const const_iterator &other) const
+                {
+                    return position_ < other.position_;
+                }
+
+                bool operator>(const const_iterator &other) const
+                {
+                    return position_ > other.position_;
+                }
+
+                bool operator<=(const const_iterator &other) const
+                {
+                    return position_ <= other.position_;
+                }
+
+                bool operator>=(const const_iterator &other) const
+                {
+                    return position_ >= other.position_;
+                }
+
+            private:
+                const T *data_ = nullptr;
+                std::size_t capacity_ = 0;
+                std::size_t position_ = 0;
+            };
+
+            View(const T *data, std::size_t capacity, std::size_t first, std::size_t size) :
+                data_(data),
+                capacity_(capacity),
+                first_(first),
+                size_(size)
+            {
+            }
+
+            std::size_t size() const
+            {
+                return size_;
+            }
+
+            bool empty() const
+            {
+                return size_ == 0;
+            }
+
+            // Index 0 is the oldest value.
+            const T &operator[](std::size_t index) const
+            {
+                return begin()[index];
+            }
+
+            const_iterator begin() const
+            {
+                return const_iterator(data_, capacity_, first_);
+            }
+
+            const_iterator end() const
+            {
+                return const_iterator(data_, capacity_, first_ + size_);
+            }
+
+            // The newest count values, all if count is larger than size().
+            View last(std::size_t count) const
+            {
+                if (count >= size_) {
+                    return *this;
+                }
+
+                std::size_t first = first_ + size_ - count;
+
+                return View(data_, capacity_, first < capacity_ ? first : first - capacity_, count);
+            }
+
+        private:
+            const T *data_;
+            std::size_t capacity_;
+            std::size_t first_;
+            std::size_t size_;
+        };
+
+        explicit RingBuffer(std::size_t capacity) : values_(capacity)
+        {
+        }
+
+        std::size_t capacity() const
+        {
+            return values_.size();
+        }
+
+        std::size_t size() const
+        {
+            return size_;
+        }
+
+        bool empty() const
+        {
+            return size_ == 0;
+        }
+
+        // Does nothing if the capacity is 0.
+        void push(const T &value)
+        {
+            if (values_.empty()) {
+                return;
+            }
+
+            std::size_t last = first_ + size_;
+
+            values_[last < capacity() ? last : last - capacity()] = value;
+
+            if (size_ < capacity()) {
+                size_++;
+            } else {
+                first_ = first_ + 1 < capacity() ? first_ + 1 : 0;
+            }
+        }
+
+        // Allocates new storage unless the capacity is unchanged. The newest values that fit are
+        // kept.
+        void set_capacity(std::size_t capacity)
+        {
+            if (capacity == this->capacity()) {
+                return;
+            }
+
+            std::vector<T> values(capacity);
+            std::size_t size = std::min(size_, capacity);
+            View current = view();
+
+            std::copy(current.end() - size, current.end(), values.begin());
+
+            values_ = std::move(values);
+            first_ = 0;
+            size_ = size;
+        }
+
+        void clear()
+        {
+            first_ = 0;
+            size_ = 0;
+        }
+
+        View view() const
+        {
+            return View(values_.data(), capacity(), first_, size_);
+        }
+
+    private:
+        std::vector<T> values_;
+        std::size_t first_ = 0;
+        std::size_t size_ = 0;
+    };
+}
+
+#endif // UIM_DAEMON_RING_BUFFER_H
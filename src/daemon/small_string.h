@@ -0,0 +1,111 @@
+// Copyright (C) 2019 Luxoft Sweden AB
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+//
+// SPDX-License-Identifier: MPL-2.0
+
+#ifndef UIM_DAEMON_SMALL_STRING_H
+#define UIM_DAEMON_SMALL_STRING_H
+
+#include <array>
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+namespace UserIdentificationManager::Daemon
+{
+    // String stored inline if it has at most INLINE_CAPACITY characters, on the heap otherwise.
+    //
+    // Unlike std::string, whose small string buffer is 15 characters in libstdc++, the inline
+    // capacity is chosen by the user. Strings that fit are created, appended to and copied
+    // without allocating memory. Always null terminated.
+    template <std::size_t INLINE_CAPACITY>
+    class SmallString
+    {
+    public:
+        SmallString() = default;
+
+        SmallString(std::string_view string)
+        {
+            append(string);
+        }
+
+        SmallString(const char *string) : SmallString(std::string_view(string))
+        {
+        }
+
+        SmallString(const std::string &string) : SmallString(std::string_view(string))
+        {
+        }
+
+        void append(std::string_view string)
+        {
+            std::size_t new_size = size_ + string.size();
+
+            if (new_size <= INLINE_CAPACITY) {
+                string.copy(inline_.data() + size_, string.size());
+                inline_[new_size] = '\0';
+            } else {
+                if (size_ <= INLINE_CAPACITY) {
+                    heap_.reserve(new_size);
+                    heap_.assign(inline_.data(), size_);
+                }
+                heap_.append(string);
+            }
+
+            size_ = new_size;
+        }
+
+        void clear()
+        {
+            size_ = 0;
+            inline_[0] = '\0';
+            heap_.clear();
+        }
+
+        const char *c_str() const
+        {
+            return size_ <= INLINE_CAPACITY ? inline_.data() : heap_.c_str();
+        }
+
+        std::size_t size() const
+        {
+            return size_;
+        }
+
+        bool empty() const
+        {
+            return size_ == 0;
+        }
+
+        std::string_view view() const
+        {
+            return {c_str(), size_};
+        }
+
+        friend bool operator==(const SmallString &a, const SmallString &b)
+        {
+            return a.view() == b.view();
+        }
+
+        friend bool operator!=(const SmallString &a, const SmallString &b)
+        {
+            return a.view() != b.view();
+        }
+
+        friend std::ostream &operator<<(std::ostream &stream, const SmallString &string)
+        {
+            return stream << string.view();
+        }
+
+    private:
+        std::size_t size_ = 0;
+        std::array<char, INLINE_CAPACITY + 1> inline_{};
+        std::string heap_;
+    };
+}
+
+#endif // UIM_DAEMON_SMALL_STRING_H
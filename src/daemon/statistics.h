@@ -0,0 +1,27 @@
+// Copyright (C) 2019 Luxoft Sweden AB
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+//
+// SPDX-License-Identifier: MPL-2.0
+
+#ifndef UIM_DAEMON_STATISTICS_H
+#define UIM_DAEMON_STATISTICS_H
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace UserIdentificationManager::Daemon
+{
+    // Named counters for debugging purposes and for tuning e.g. queue sizes under real load.
+    //
+    // Names are lower case and dot separated, e.g. "uid_queue.dropped". IdSource::Group prefixes
+    // the names of each source's counters with the source name. See GetStatistics in the D-Bus
+    // interface.
+    using Statistics = std::vector<std::pair<std::string, std::uint64_t>>;
+}
+
+#endif // UIM_DAEMON_STATISTICS_H
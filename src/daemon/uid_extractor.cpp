@@ -0,0 +1,603 @@
+// Copyright (C) 2019 Luxoft Sweden AB
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+//
+// SPDX-License-Identifier: MPL-2.0
+
+#include "daemon/uid_extractor.h"
+
+#include <glib.h>
+#include <winscard.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "daemon/atr.h"
+#include "daemon/inline_bytes.h"
+
+namespace UserIdentificationManager::Daemon
+{
+    namespace
+    {
+        class Card
+        {
+        public:
+            explicit Card(PCSCBackend &backend) : backend_(backend)
+            {
+            }
+
+            Card(const Card &other) = delete;
+            Card(Card &&other) = delete;
+            Card &operator=(const Card &other) = delete;
+            Card &operator=(Card &&other) = delete;
+
+            ~Card()
+            {
+                disconnect();
+            }
+
+            bool connect(SCARDCONTEXT context, const char *reader_name)
+            {
+                disconnect();
+
+                SCARDHANDLE handle = 0;
+                DWORD active_protocol = SCARD_PROTOCOL_UNDEFINED;
+                LONG ret = backend_.connect(context,
+                                            reader_name,
+                                            SCARD_SHARE_SHARED,
+                                            SCARD_PROTOCOL_T0 | SCARD_PROTOCOL_T1,
+                                            handle,
+                                            active_protocol);
+
+                if (ret != SCARD_S_SUCCESS) {
+                    g_warning("SCardConnect() failed for reader \"%s\": %s",
+                              reader_name,
+                              pcsc_stringify_error(ret));
+                    return false;
+                }
+
+                handle_ = handle;
+
+                return set_protocol(active_protocol, reader_name);
+            }
+
+            // Reuse the handle of an earlier connection to the reader. SCardReconnect() keeps the
+            // handle and, if the card was not replaced, the negotiated protocol. Returns false,
+            // with the handle disconnected, if the reader does not allow it.
+            bool reconnect(SCARDHANDLE handle, const char *reader_name)
+            {
+                disconnect();
+
+                handle_ = handle;
+
+                DWORD active_protocol = SCARD_PROTOCOL_UNDEFINED;
+                LONG ret = backend_.reconnect(handle,
+                                              SCARD_SHARE_SHARED,
+                                              SCARD_PROTOCOL_T0 | SCARD_PROTOCOL_T1,
+                                              SCARD_LEAVE_CARD,
+                                              active_protocol);
+
+                if (ret != SCARD_S_SUCCESS) {
+                    g_debug("SCardReconnect() failed for reader \"%s\": %s",
+                            reader_name,
+                            pcsc_stringify_error(ret));
+                    disconnect();
+                    return false;
+                }
+
+                return set_protocol(active_protocol, reader_name);
+            }
+
+            // Give up ownership of the handle without disconnecting it.
+            std::optional<SCARDHANDLE> release()
+            {
+                return std::exchange(handle_, std::nullopt);
+            }
+
+            void disconnect()
+            {
+                if (!handle_) {
+                    return;
+                }
+
+                LONG ret = backend_.disconnect(*handle_, SCARD_LEAVE_CARD);
+
+                handle_.reset();
+
+                if (ret != SCARD_S_SUCCESS) {
+                    g_warning("SCardDisconnect() failed: %s", pcsc_stringify_error(ret));
+                }
+            }
+
+            std::size_t transmit(const std::uint8_t *send_buffer,
+                                 std::size_t send_length,
+                                 std::uint8_t *recv_buffer,
+                                 std::size_t recv_buffer_size)
+            {
+                DWORD recv_length = recv_buffer_size;
+
+                LONG ret = backend_.transmit(
+                    *handle_, send_pci_, send_buffer, send_length, recv_buffer, recv_length);
+
+                if (ret != SCARD_S_SUCCESS) {
+                    g_warning("SCardTransmit() failed: %s", pcsc_stringify_error(ret));
+                    return 0;
+                }
+
+                return recv_length;
+            }
+
+        private:
+            bool set_protocol(DWORD active_protocol, const char *reader_name)
+            {
+                switch (active_protocol) {
+                case SCARD_PROTOCOL_T0:
+                    send_pci_ = SCARD_PCI_T0;
+                    return true;
+                case SCARD_PROTOCOL_T1:
+                    send_pci_ = SCARD_PCI_T1;
+                    return true;
+                default:
+                    g_warning("Unknown protocol (%lu) negotiated for reader \"%s\"",
+                              active_protocol,
+                              reader_name);
+                    disconnect();
+                    return false;
+                }
+            }
+
+            PCSCBackend &backend_;
+            std::optional<SCARDHANDLE> handle_;
+            const SCARD_IO_REQUEST *send_pci_ = nullptr;
+        };
+
+        using UID = UIDExtractor::UID;
+
+        // Response data of a command. No command used has a longer response than the longest
+        // UID, an NDEF message.
+        using ResponseData = InlineBytes<UID::capacity()>;
+
+        constexpr unsigned int UID_MIN_LENGTH = 4;
+        constexpr unsigned int UID_MAX_LENGTH = 10;
+        constexpr unsigned int STATUS_WORD_LENGTH = 2;
+
+        // Transmit command and return the response data without status word if the status word
+        // is 90 00. Command is any contiguous byte container, e.g. a std::array.
+        template <typename Command>
+        std::optional<ResponseData> transmit_apdu(Card &card,
+                                                  const Command &command,
+                                                  std::size_t max_response_length,
+                                                  const char *reader_name,
+                                                  const char *command_name)
+        {
+            constexpr std::uint16_t STATUS_WORD_SUCCESS = 0x9000;
+            InlineBytes<ResponseData::capacity() + STATUS_WORD_LENGTH> recv_buffer;
+
+            std::size_t recv_length =
+                card.transmit(command.data(),
+                              command.size(),
+                              recv_buffer.data(),
+                              std::min(max_response_length, ResponseData::capacity()) +
+                                  STATUS_WORD_LENGTH);
+
+            if (recv_length < STATUS_WORD_LENGTH) {
+                g_debug("Too few bytes received from reader \"%s\" for %s command, received %zu "
+                        "bytes",
+                        reader_name,
+                        command_name,
+                        recv_length);
+                return {};
+            }
+
+            std::uint16_t status_word =
+                recv_buffer[recv_length - 2] << 8 | recv_buffer[recv_length - 1];
+
+            if (status_word != STATUS_WORD_SUCCESS) {
+                g_debug("Received status 0x%04x from reader \"%s\" for %s command",
+                        status_word,
+                        reader_name,
+                        command_name);
+                return {};
+            }
+
+            ResponseData data;
+            data.assign(recv_buffer.data(), recv_length - STATUS_WORD_LENGTH);
+
+            return data;
+        }
+
+        std::optional<UID> get_data(Card &card, const char *reader_name)
+        {
+            // See "3.2.2.1.3  Get Data Command" in
+            // https://muscle.apdu.fr/www.pcscworkgroup.com/PCSC/V2/pcsc3_v2.01.09.pdf
+            constexpr std::array<std::uint8_t, 5> get_data_command = {0xff, 0xca, 0x00, 0x00, 0x00};
+
+            auto uid =
+                transmit_apdu(card, get_data_command, UID_MAX_LENGTH, reader_name, "Get Data");
+
+            if (uid && uid->size() < UID_MIN_LENGTH) {
+                g_debug("Too short UID received from reader \"%s\" for Get Data command, "
+                        "received %zu bytes but expected at least %u bytes",
+                        reader_name,
+                        uid->size(),
+                        UID_MIN_LENGTH);
+                return {};
+            }
+
+            return uid;
+        }
+
+        std::optional<UID> iso_14443_4_select_read(Card &card, const char *reader_name)
+        {
+            // See "NFC Forum Type 4 Tag Operation Specification", NDEF Tag Application. The NDEF
+            // message is used as ID since the UID of these cards is often random. Only for cards
+            // the ATR table suggests it for, see strategy_allowed(), and marked as such, see
+            // UIDExtractor::Result.
+            constexpr std::size_t MAX_NDEF_MESSAGE_LENGTH = UID::capacity();
+            constexpr unsigned int CC_LENGTH = 15;
+            constexpr unsigned int CC_NDEF_FILE_CONTROL_TLV_OFFSET = 7;
+            constexpr std::uint8_t NDEF_FILE_CONTROL_TLV_TAG = 0x04;
+            constexpr unsigned int CC_NDEF_FILE_ID_OFFSET = 9;
+            constexpr unsigned int NLEN_LENGTH = 2;
+            constexpr std::array<std::uint8_t, 13> select_ndef_application_command = {
+                0x00, 0xa4, 0x04, 0x00, 0x07, 0xd2, 0x76, 0x00, 0x00, 0x85, 0x01, 0x01, 0x00};
+
+            auto select_file = [&](std::uint8_t id_high, std::uint8_t id_low) {
+                const std::array<std::uint8_t, 7> command = {
+                    0x00, 0xa4, 0x00, 0x0c, 0x02, id_high, id_low};
+                return transmit_apdu(card, command, 0, reader_name, "Select File").has_value();
+            };
+
+            auto read_binary = [&](std::uint16_t offset, std::uint8_t length) {
+                const std::array<std::uint8_t, 5> command = {
+                    0x00, 0xb0, std::uint8_t(offset >> 8), std::uint8_t(offset & 0xff), length};
+                auto data = transmit_apdu(card, command, length, reader_name, "Read Binary");
+                if (data && data->size() != length) {
+                    data.reset();
+                }
+                return data;
+            };
+
+            if (!transmit_apdu(card, select_ndef_application_command, 0, reader_name, "Select")) {
+                return {};
+            }
+
+            if (!select_file(0xe1, 0x03)) {
+                return {};
+            }
+
+            auto cc = read_binary(0, CC_LENGTH);
+
+            if (!cc || (*cc)[CC_NDEF_FILE_CONTROL_TLV_OFFSET] != NDEF_FILE_CONTROL_TLV_TAG) {
+                return {};
+            }
+
+            if (!select_file((*cc)[CC_NDEF_FILE_ID_OFFSET], (*cc)[CC_NDEF_FILE_ID_OFFSET + 1])) {
+                return {};
+            }
+
+            auto nlen = read_binary(0, NLEN_LENGTH);
+
+            if (!nlen) {
+                return {};
+            }
+
+            unsigned int message_length = (*nlen)[0] << 8 | (*nlen)[1];
+
+            if (message_length == 0 || message_length > MAX_NDEF_MESSAGE_LENGTH) {
+                g_debug("Unsupported NDEF message length %u from reader \"%s\"",
+                        message_length,
+                        reader_name);
+                return {};
+            }
+
+            return read_binary(NLEN_LENGTH, message_length);
+        }
+
+        std::optional<UID> acs_direct_transmit(Card &card, const char *reader_name)
+        {
+            // Direct Transmit pseudo APDU of ACS readers, see "ACR122U Application Programming
+            // Interface", with the PN532 command InListPassiveTarget for one ISO 14443 type A
+            // target. See "PN532 User Manual". Response is D5 4B NbTg Tg SENS_RES(2) SEL_RES
+            // NFCIDLength NFCID.
+            constexpr std::size_t MAX_RESPONSE_LENGTH = ResponseData::capacity();
+            constexpr unsigned int NUM_TARGETS_OFFSET = 2;
+            constexpr unsigned int UID_LENGTH_OFFSET = 7;
+            constexpr std::array<std::uint8_t, 9> in_list_passive_target_command = {
+                0xff, 0x00, 0x00, 0x00, 0x04, 0xd4, 0x4a, 0x01, 0x00};
+
+            auto response = transmit_apdu(card,
+                                          in_list_passive_target_command,
+                                          MAX_RESPONSE_LENGTH,
+                                          reader_name,
+                                          "Direct Transmit");
+
+            if (!response || response->size() <= UID_LENGTH_OFFSET || (*response)[0] != 0xd5 ||
+                (*response)[1] != 0x4b || (*response)[NUM_TARGETS_OFFSET] == 0) {
+                return {};
+            }
+
+            std::size_t uid_length = (*response)[UID_LENGTH_OFFSET];
+
+            if (uid_length < UID_MIN_LENGTH || uid_length > UID_MAX_LENGTH ||
+                response->size() < UID_LENGTH_OFFSET + 1 + uid_length) {
+                return {};
+            }
+
+            UID uid;
+            uid.assign(response->data() + UID_LENGTH_OFFSET + 1, uid_length);
+
+            return uid;
+        }
+
+        struct Strategy
+        {
+            Atr::UIDStrategy id;
+            // Used in statistics names.
+            const char *name;
+            std::optional<UID> (*extract)(Card &card, const char *reader_name);
+            // See UIDExtractor::Result::ndef_message.
+            bool ndef_message;
+        };
+
+        // Probed in this order after the strategy suggested by the ATR, if any and allowed, see
+        // strategy_allowed().
+        constexpr Strategy STRATEGIES[] = {
+            {Atr::UIDStrategy::GET_DATA, "get_data", get_data, false},
+            {Atr::UIDStrategy::ISO_14443_4_SELECT_READ,
+             "iso_14443_4_select_read",
+             iso_14443_4_select_read,
+             true},
+            {Atr::UIDStrategy::ACS_DIRECT_TRANSMIT,
+             "acs_direct_transmit",
+             acs_direct_transmit,
+             false}};
+
+        // Readers with a PN532 that accept its commands in the Direct Transmit pseudo APDU.
+        constexpr std::string_view ACS_PN532_READER_PREFIXES[] = {"ACS ACR122", "ACS ACR1222"};
+
+        // The NDEF message can be written by anyone holding the card, so it is only used as ID
+        // when the ATR table suggests it, never as a fallback. The Direct Transmit escape APDU
+        // is vendor specific and only sent to readers known to understand it.
+        bool strategy_allowed(Atr::UIDStrategy id,
+                              Atr::UIDStrategy suggested,
+                              std::string_view reader_name)
+        {
+            switch (id) {
+            case Atr::UIDStrategy::ISO_14443_4_SELECT_READ:
+                return id == suggested;
+            case Atr::UIDStrategy::ACS_DIRECT_TRANSMIT:
+                return std::any_of(std::begin(ACS_PN532_READER_PREFIXES),
+                                   std::end(ACS_PN532_READER_PREFIXES),
+                                   [&](std::string_view prefix) {
+                                       return reader_name.substr(0, prefix.size()) == prefix;
+                                   });
+            default:
+                return true;
+            }
+        }
+
+        // Index of the strategy, 0 for NONE, i.e. the default order.
+        std::size_t strategy_index(Atr::UIDStrategy id)
+        {
+            for (std::size_t i = 0; i < std::size(STRATEGIES); i++) {
+                if (STRATEGIES[i].id == id) {
+                    return i;
+                }
+            }
+
+            return 0;
+        }
+
+        void add_latency(std::atomic<std::uint64_t> &latency_us_total,
+                         std::atomic<std::uint64_t> &latency_us_max,
+                         std::chrono::steady_clock::duration latency)
+        {
+            std::uint64_t latency_us =
+                std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+            std::uint64_t previous_max = latency_us_max.load();
+
+            latency_us_total.fetch_add(latency_us);
+            while (latency_us > previous_max &&
+                   !latency_us_max.compare_exchange_weak(previous_max, latency_us)) {
+            }
+        }
+    }
+
+    UIDExtractor::UIDExtractor(PCSCBackend &backend) : backend_(backend)
+    {
+    }
+
+    std::optional<UIDExtractor::Result> UIDExtractor::extract(SCARDCONTEXT context,
+                                                              ReaderId reader_id,
+                                                              const std::string &reader_name,
+                                                              const Atr::Bytes &atr)
+    {
+        static_assert(std::size(STRATEGIES) == NUM_STRATEGIES);
+
+        Atr::Classification classification = Atr::classify(atr.data(), atr.size());
+
+        if (classification.type == Atr::CardType::UNKNOWN) {
+            g_warning("Can not extract UID from card present at \"%s\"", reader_name.c_str());
+            return {};
+        }
+
+        Card card(backend_);
+
+        auto connect_start = std::chrono::steady_clock::now();
+        bool connected = false;
+
+        if (auto handle = cached_connection(context, reader_id)) {
+            connected = card.reconnect(*handle, reader_name.c_str());
+            (connected ? connect_counters_.reused : connect_counters_.reconnect_failed)++;
+        }
+
+        if (!connected) {
+            connected = card.connect(context, reader_name.c_str());
+            if (connected) {
+                connect_counters_.established++;
+            }
+        }
+
+        add_latency(connect_counters_.latency_us_total,
+                    connect_counters_.latency_us_max,
+                    std::chrono::steady_clock::now() - connect_start);
+
+        if (!connected) {
+            return {};
+        }
+
+        MemoKey key{reader_id, atr};
+        std::optional<Atr::UIDStrategy> memoized = memoized_strategy(key);
+        std::size_t first = strategy_index(memoized.value_or(classification.uid_strategy));
+
+        for (std::size_t n = 0; n < NUM_STRATEGIES; n++) {
+            std::size_t i = n == 0 ? first : (n <= first ? n - 1 : n);
+            const Strategy &strategy = STRATEGIES[i];
+            Counters &counters = counters_[i];
+
+            if (!strategy_allowed(strategy.id, classification.uid_strategy, reader_name)) {
+                continue;
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            auto uid = strategy.extract(card, reader_name.c_str());
+
+            add_latency(counters.latency_us_total,
+                        counters.latency_us_max,
+                        std::chrono::steady_clock::now() - start);
+
+            if (uid) {
+                counters.success++;
+                if (memoized != strategy.id) {
+                    memoize_strategy(key, strategy.id);
+                }
+                cache_connection(context, reader_id, *card.release());
+                return Result{*uid, strategy.ndef_message};
+            }
+
+            counters.failure++;
+        }
+
+        if (memoized) {
+            memoize_strategy(key, std::nullopt);
+        }
+
+        g_warning("Failed to extract UID from card present at \"%s\"", reader_name.c_str());
+
+        return {};
+    }
+
+    void UIDExtractor::forget_connections()
+    {
+        std::unique_lock<std::mutex> lock(connections_mutex_);
+
+        connections_.clear();
+    }
+
+    Statistics UIDExtractor::statistics() const
+    {
+        Statistics statistics = {
+            {"connect.established", connect_counters_.established.load()},
+            {"connect.reused", connect_counters_.reused.load()},
+            {"connect.reconnect_failed", connect_counters_.reconnect_failed.load()},
+            {"connect.latency_us_total", connect_counters_.latency_us_total.load()},
+            {"connect.latency_us_max", connect_counters_.latency_us_max.load()}};
+
+        for (std::size_t i = 0; i < NUM_STRATEGIES; i++) {
+            std::string prefix = std::string("uid_strategy.") + STRATEGIES[i].name + ".";
+            const Counters &counters = counters_[i];
+
+            statistics.emplace_back(prefix + "success", counters.success.load());
+            statistics.emplace_back(prefix + "failure", counters.failure.load());
+            statistics.emplace_back(prefix + "latency_us_total", counters.latency_us_total.load());
+            statistics.emplace_back(prefix + "latency_us_max", counters.latency_us_max.load());
+        }
+
+        return statistics;
+    }
+
+    std::optional<Atr::UIDStrategy> UIDExtractor::memoized_strategy(const MemoKey &key)
+    {
+        std::unique_lock<std::mutex> lock(memo_mutex_);
+
+        auto it = memo_.find(key);
+
+        if (it == memo_.end()) {
+            return {};
+        }
+
+        return it->second;
+    }
+
+    void UIDExtractor::memoize_strategy(const MemoKey &key,
+                                        std::optional<Atr::UIDStrategy> strategy)
+    {
+        std::unique_lock<std::mutex> lock(memo_mutex_);
+
+        if (!strategy) {
+            memo_.erase(key);
+            return;
+        }
+
+        if (memo_.size() >= MAX_MEMO_ENTRIES && memo_.count(key) == 0) {
+            memo_.clear();
+        }
+
+        memo_[key] = *strategy;
+    }
+
+    std::optional<SCARDHANDLE> UIDExtractor::cached_connection(SCARDCONTEXT context,
+                                                               ReaderId reader_id)
+    {
+        std::unique_lock<std::mutex> lock(connections_mutex_);
+
+        auto it = connections_.find(reader_id);
+
+        if (it == connections_.end()) {
+            return {};
+        }
+
+        // The entry is kept, without handle, so that caching the connection again does not
+        // allocate a new node.
+        CachedConnection &connection = it->second;
+        std::optional<SCARDHANDLE> handle = std::exchange(connection.handle, std::nullopt);
+
+        // Handles are released together with their context, e.g. after a cancelled transaction.
+        if (connection.context != context) {
+            return {};
+        }
+
+        return handle;
+    }
+
+    void UIDExtractor::cache_connection(SCARDCONTEXT context,
+                                        ReaderId reader_id,
+                                        SCARDHANDLE handle)
+    {
+        std::unique_lock<std::mutex> lock(connections_mutex_);
+
+        if (connections_.size() >= MAX_CACHED_CONNECTIONS && connections_.count(reader_id) == 0) {
+            // Mostly stale handles of removed readers, errors are expected.
+            for (const auto &[cached_reader_id, connection] : connections_) {
+                if (connection.handle) {
+                    backend_.disconnect(*connection.handle, SCARD_LEAVE_CARD);
+                }
+            }
+            connections_.clear();
+        }
+
+        connections_[reader_id] = CachedConnection{context, handle};
+    }
+}
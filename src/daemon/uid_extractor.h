@@ -0,0 +1,140 @@
+// Copyright (C) 2019 Luxoft Sweden AB
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+//
+// SPDX-License-Identifier: MPL-2.0
+
+#ifndef UIM_DAEMON_UID_EXTRACTOR_H
+#define UIM_DAEMON_UID_EXTRACTOR_H
+
+#include <winscard.h>
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+
+#include "daemon/atr.h"
+#include "daemon/inline_bytes.h"
+#include "daemon/pcsc_backend.h"
+#include "daemon/reader_names.h"
+#include "daemon/statistics.h"
+
+namespace UserIdentificationManager::Daemon
+{
+    // Extracts an ID from a card by probing a list of strategies, see Atr::UIDStrategy.
+    //
+    // Probing starts with the strategy suggested by the ATR if the card is in the table of
+    // Atr::classify(), with Get Data otherwise. The strategy that succeeds is remembered for the
+    // reader and ATR, so repeated taps of the same card type only send the commands of that
+    // strategy. If it stops working, the other strategies are probed again. The NDEF message is
+    // only read if the card table suggests it and vendor commands are only sent to readers known
+    // to support them.
+    //
+    // The connection to a reader is kept after a successful extraction and reused with
+    // SCardReconnect() on the next tap, falling back to SCardConnect() if that fails. Cached
+    // handles are never disconnected explicitly, they are released with their context and then
+    // forgotten with forget_connections().
+    //
+    // Thread safe, PCSCReaderPool workers call extract() concurrently. At most one extraction per
+    // reader may be in progress. Extracting does not allocate memory once the strategy is memoized
+    // and the connection cached.
+    class UIDExtractor
+    {
+    public:
+        // Longer NDEF messages are not used as ID, so that the hex ID of the smart card source
+        // is kept short and stored inline, see IdSource::UserIdentificationId.
+        using UID = InlineBytes<26>;
+
+        struct Result
+        {
+            UID uid;
+            // The UID is the NDEF message of the card, which anyone holding the card can write,
+            // and must not be mistaken for a UID assigned by the card manufacturer.
+            bool ndef_message;
+        };
+
+        explicit UIDExtractor(PCSCBackend &backend);
+
+        UIDExtractor(const UIDExtractor &other) = delete;
+        UIDExtractor(UIDExtractor &&other) = delete;
+        UIDExtractor &operator=(const UIDExtractor &other) = delete;
+        UIDExtractor &operator=(UIDExtractor &&other) = delete;
+
+        // reader_name is used in log messages.
+        std::optional<Result> extract(SCARDCONTEXT context,
+                                      ReaderId reader_id,
+                                      const std::string &reader_name,
+                                      const Atr::Bytes &atr);
+
+        // Forget all cached connections. Called when the contexts they were made with have been
+        // released. A connection cached later by an abandoned extraction is made with a released
+        // context too, and is never reused.
+        void forget_connections();
+
+        // Connection reuse and latency, and success and failure count and latency per strategy.
+        Statistics statistics() const;
+
+    private:
+        static constexpr std::size_t NUM_STRATEGIES = 3;
+
+        // Forget all memoized strategies if there are more entries than this. There is normally
+        // only a handful of readers and card types.
+        static constexpr std::size_t MAX_MEMO_ENTRIES = 64;
+
+        // Disconnect all cached connections if there are more than this, see MAX_MEMO_ENTRIES.
+        static constexpr std::size_t MAX_CACHED_CONNECTIONS = 16;
+
+        struct Counters
+        {
+            std::atomic<std::uint64_t> success{0};
+            std::atomic<std::uint64_t> failure{0};
+            std::atomic<std::uint64_t> latency_us_total{0};
+            std::atomic<std::uint64_t> latency_us_max{0};
+        };
+
+        struct ConnectCounters
+        {
+            std::atomic<std::uint64_t> established{0};
+            std::atomic<std::uint64_t> reused{0};
+            std::atomic<std::uint64_t> reconnect_failed{0};
+            std::atomic<std::uint64_t> latency_us_total{0};
+            std::atomic<std::uint64_t> latency_us_max{0};
+        };
+
+        struct CachedConnection
+        {
+            SCARDCONTEXT context;
+            std::optional<SCARDHANDLE> handle;
+        };
+
+        using MemoKey = std::pair<ReaderId, Atr::Bytes>;
+
+        std::optional<Atr::UIDStrategy> memoized_strategy(const MemoKey &key);
+        void memoize_strategy(const MemoKey &key, std::optional<Atr::UIDStrategy> strategy);
+
+        // Take the cached connection to the reader, if any, out of the cache.
+        std::optional<SCARDHANDLE> cached_connection(SCARDCONTEXT context, ReaderId reader_id);
+        void cache_connection(SCARDCONTEXT context, ReaderId reader_id, SCARDHANDLE handle);
+
+        PCSCBackend &backend_;
+
+        std::mutex memo_mutex_;
+        std::map<MemoKey, Atr::UIDStrategy> memo_;
+
+        std::mutex connections_mutex_;
+        std::map<ReaderId, CachedConnection> connections_;
+
+        ConnectCounters connect_counters_;
+        std::array<Counters, NUM_STRATEGIES> counters_;
+    };
+}
+
+#endif // UIM_DAEMON_UID_EXTRACTOR_H
@@ -0,0 +1,195 @@
+// Copyright (C) 2019 Luxoft Sweden AB
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+//
+// SPDX-License-Identifier: MPL-2.0
+
+#include "daemon/atr.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace UserIdentificationManager::Daemon
+{
+    namespace
+    {
+        // Real ATRs, mostly from https://smartcard-atr.apdu.fr/ .
+        constexpr char MIFARE_CLASSIC_1K[] =
+            "3B 8F 80 01 80 4F 0C A0 00 00 03 06 03 00 01 00 00 00 00 6A";
+        constexpr char MIFARE_CLASSIC_4K[] =
+            "3B 8F 80 01 80 4F 0C A0 00 00 03 06 03 00 02 00 00 00 00 69";
+        constexpr char MIFARE_ULTRALIGHT[] =
+            "3B 8F 80 01 80 4F 0C A0 00 00 03 06 03 00 03 00 00 00 00 68";
+        constexpr char MIFARE_MINI[] =
+            "3B 8F 80 01 80 4F 0C A0 00 00 03 06 03 00 26 00 00 00 00 4D";
+        constexpr char FELICA[] = "3B 8F 80 01 80 4F 0C A0 00 00 03 06 11 00 3B 00 00 00 00 42";
+        constexpr char MIFARE_DESFIRE_ACR122[] = "3B 81 80 01 80 80";
+        constexpr char MIFARE_DESFIRE_OMNIKEY[] = "3B 8A 80 01 00 31 C1 73 C8 40 00 00 90 00 90";
+        constexpr char ISO_14443_B[] = "3B 88 80 01 00 00 00 00 33 81 81 00 3A";
+        constexpr char CARD_EMULATION[] = "3B 80 80 01 01";
+        constexpr char YUBIKEY_4[] = "3B F8 13 00 00 81 31 FE 15 59 75 62 69 6B 65 79 34 D4";
+        constexpr char CONTACT_T0[] = "3B 6E 00 00 80 31 80 66 B0 84 0C 01 6E 01 83 00 90 00";
+
+        std::vector<std::uint8_t> from_hex(std::string_view hex)
+        {
+            std::vector<std::uint8_t> bytes;
+
+            for (std::size_t i = 0; i + 1 < hex.size(); i += 3) {
+                bytes.emplace_back(std::stoul(std::string(hex.substr(i, 2)), nullptr, 16));
+            }
+
+            return bytes;
+        }
+
+        Atr::Parsed parse(std::string_view hex)
+        {
+            std::vector<std::uint8_t> atr = from_hex(hex);
+            return Atr::parse(atr.data(), atr.size());
+        }
+
+        Atr::Classification classify(std::string_view hex)
+        {
+            std::vector<std::uint8_t> atr = from_hex(hex);
+            return Atr::classify(atr.data(), atr.size());
+        }
+
+        // Classification is usable at compile time.
+        constexpr std::uint8_t COMPILE_TIME_ATR[] = {0x3b, 0x81, 0x80, 0x01, 0x80, 0x80};
+        static_assert(Atr::classify(COMPILE_TIME_ATR, sizeof(COMPILE_TIME_ATR)).type ==
+                      Atr::CardType::CONTACTLESS_ISO_14443_4);
+    }
+
+    TEST(Atr, RealAtrsValid)
+    {
+        for (const char *hex : {MIFARE_CLASSIC_1K,
+                                MIFARE_CLASSIC_4K,
+                                MIFARE_ULTRALIGHT,
+                                MIFARE_MINI,
+                                FELICA,
+                                MIFARE_DESFIRE_ACR122,
+                                MIFARE_DESFIRE_OMNIKEY,
+                                ISO_14443_B,
+                                CARD_EMULATION,
+                                YUBIKEY_4,
+                                CONTACT_T0}) {
+            EXPECT_TRUE(parse(hex).valid) << hex;
+        }
+    }
+
+    TEST(Atr, ParseInterfaceAndHistoricalBytes)
+    {
+        Atr::Parsed parsed = parse(YUBIKEY_4);
+
+        EXPECT_TRUE(parsed.valid);
+        EXPECT_EQ(1U << 1, parsed.protocols);
+        EXPECT_EQ(0x81, parsed.td1);
+        EXPECT_EQ(0x31, parsed.td2);
+        EXPECT_EQ(9U, parsed.historical_bytes_offset);
+        EXPECT_EQ(8U, parsed.historical_bytes_size);
+
+        parsed = parse(CONTACT_T0);
+
+        EXPECT_TRUE(parsed.valid);
+        EXPECT_EQ(1U << 0, parsed.protocols);
+        EXPECT_EQ(0, parsed.td1);
+        EXPECT_EQ(4U, parsed.historical_bytes_offset);
+        EXPECT_EQ(14U, parsed.historical_bytes_size);
+    }
+
+    TEST(Atr, InvalidAtrs)
+    {
+        // Wrong TCK.
+        EXPECT_FALSE(parse("3B 8F 80 01 80 4F 0C A0 00 00 03 06 03 00 01 00 00 00 00 6B").valid);
+        // Missing TCK.
+        EXPECT_FALSE(parse("3B 8F 80 01 80 4F 0C A0 00 00 03 06 03 00 01 00 00 00 00").valid);
+        // Extra byte.
+        EXPECT_FALSE(parse("3B 81 80 01 80 80 00").valid);
+        // Truncated in interface bytes.
+        EXPECT_FALSE(parse("3B 8F 80").valid);
+        // Bad TS.
+        EXPECT_FALSE(parse("3C 81 80 01 80 81").valid);
+        EXPECT_FALSE(parse("3B").valid);
+        EXPECT_FALSE(parse("").valid);
+
+        EXPECT_EQ(Atr::CardType::UNKNOWN, classify("3B 81 80 01 80 81").type);
+    }
+
+    TEST(Atr, ClassifyStorageCards)
+    {
+        struct
+        {
+            const char *hex;
+            std::string_view name;
+        } cards[] = {{MIFARE_CLASSIC_1K, "MIFARE Classic 1K"},
+                     {MIFARE_CLASSIC_4K, "MIFARE Classic 4K"},
+                     {MIFARE_ULTRALIGHT, "MIFARE Ultralight"},
+                     {MIFARE_MINI, "MIFARE Mini"},
+                     {FELICA, "FeliCa"}};
+
+        for (const auto &card : cards) {
+            Atr::Classification classification = classify(card.hex);
+
+            EXPECT_EQ(Atr::CardType::CONTACTLESS_STORAGE, classification.type) << card.hex;
+            EXPECT_EQ(card.name, classification.name) << card.hex;
+            EXPECT_EQ(Atr::UIDStrategy::GET_DATA, classification.uid_strategy) << card.hex;
+        }
+    }
+
+    TEST(Atr, ClassifyUnknownStorageCard)
+    {
+        Atr::Classification classification =
+            classify("3B 8F 80 01 80 4F 0C A0 00 00 03 06 03 FF FF 00 00 00 00 6B");
+
+        EXPECT_EQ(Atr::CardType::CONTACTLESS_STORAGE, classification.type);
+        EXPECT_TRUE(classification.name.empty());
+        EXPECT_EQ(Atr::UIDStrategy::NONE, classification.uid_strategy);
+    }
+
+    TEST(Atr, ClassifyIso14443Part4Cards)
+    {
+        struct
+        {
+            const char *hex;
+            std::string_view name;
+            Atr::UIDStrategy uid_strategy;
+        } cards[] = {{MIFARE_DESFIRE_ACR122, "MIFARE DESFire", Atr::UIDStrategy::GET_DATA},
+                     {CARD_EMULATION,
+                      "ISO 14443-4 card emulation",
+                      Atr::UIDStrategy::ISO_14443_4_SELECT_READ}};
+
+        for (const auto &card : cards) {
+            Atr::Classification classification = classify(card.hex);
+
+            EXPECT_EQ(Atr::CardType::CONTACTLESS_ISO_14443_4, classification.type) << card.hex;
+            EXPECT_EQ(card.name, classification.name) << card.hex;
+            EXPECT_EQ(card.uid_strategy, classification.uid_strategy) << card.hex;
+        }
+    }
+
+    TEST(Atr, UnknownIso14443Part4CardsGetNoSuggestion)
+    {
+        for (const char *hex : {MIFARE_DESFIRE_OMNIKEY, ISO_14443_B}) {
+            Atr::Classification classification = classify(hex);
+
+            EXPECT_EQ(Atr::CardType::CONTACTLESS_ISO_14443_4, classification.type) << hex;
+            EXPECT_TRUE(classification.name.empty()) << hex;
+            EXPECT_EQ(Atr::UIDStrategy::NONE, classification.uid_strategy) << hex;
+        }
+    }
+
+    TEST(Atr, ContactCardsNotSupported)
+    {
+        for (const char *hex : {YUBIKEY_4, CONTACT_T0}) {
+            Atr::Classification classification = classify(hex);
+
+            EXPECT_EQ(Atr::CardType::UNKNOWN, classification.type) << hex;
+            EXPECT_EQ(Atr::UIDStrategy::NONE, classification.uid_strategy) << hex;
+        }
+    }
+}
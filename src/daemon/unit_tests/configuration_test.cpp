@@ -63,4 +63,30 @@ namespace UserIdentificationManager::Daemon
 
         EXPECT_TRUE(config.sources_enable.empty());
     }
+
+    TEST(Configuration, HistoryCapacityParsedCorrectly)
+    {
+        Common::ScopedTempFile file("[history]\n"
+                                    "capacity=5000");
+        Configuration config = Configuration::from_file(file.path());
+
+        EXPECT_EQ(5000u, config.history_capacity);
+    }
+
+    TEST(Configuration, HistoryCapacityDefaultIfInvalid)
+    {
+        Common::ScopedSilentLogHandler log_handler;
+
+        const std::vector<std::string> invalid_capacities = {
+            "abc", "-1", std::to_string(Configuration::MAX_HISTORY_CAPACITY + 1)};
+
+        for (const std::string &capacity : invalid_capacities) {
+            Common::ScopedTempFile file("[history]\n"
+                                        "capacity=" +
+                                        capacity);
+            Configuration config = Configuration::from_file(file.path());
+
+            EXPECT_EQ(Configuration().history_capacity, config.history_capacity) << capacity;
+        }
+    }
 }
@@ -0,0 +1,585 @@
+// Copyright (C) 2019 Luxoft Sweden AB
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+//
+// SPDX-License-Identifier: MPL-2.0
+
+#include "daemon/unit_tests/fake_pcsc_backend.h"
+
+#include <winscard.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace UserIdentificationManager::Daemon
+{
+    namespace
+    {
+        constexpr char NOTIFICATION_READER_NAME[] = R"(\\?PnP?\Notification)";
+        constexpr unsigned int EVENT_COUNT_SHIFT = 16;
+        constexpr std::array<std::uint8_t, 5> GET_DATA_COMMAND = {0xff, 0xca, 0x00, 0x00, 0x00};
+        constexpr std::array<std::uint8_t, 2> STATUS_SUCCESS = {0x90, 0x00};
+        constexpr std::array<std::uint8_t, 2> STATUS_INSTRUCTION_NOT_SUPPORTED = {0x6d, 0x00};
+        constexpr std::array<std::uint8_t, 2> STATUS_FILE_NOT_FOUND = {0x6a, 0x82};
+        constexpr std::array<std::uint8_t, 2> STATUS_WRONG_PARAMETERS = {0x6b, 0x00};
+
+        // NFC Forum Type 4 Tag, see "NFC Forum Type 4 Tag Operation Specification".
+        constexpr std::array<std::uint8_t, 13> SELECT_NDEF_APPLICATION_COMMAND = {
+            0x00, 0xa4, 0x04, 0x00, 0x07, 0xd2, 0x76, 0x00, 0x00, 0x85, 0x01, 0x01, 0x00};
+        constexpr std::array<std::uint8_t, 5> SELECT_FILE_COMMAND_PREFIX = {
+            0x00, 0xa4, 0x00, 0x0c, 0x02};
+        constexpr std::array<std::uint8_t, 2> READ_BINARY_COMMAND_PREFIX = {0x00, 0xb0};
+        constexpr std::size_t READ_BINARY_COMMAND_LENGTH = 5;
+        constexpr std::uint16_t CC_FILE_ID = 0xe103;
+        constexpr std::uint16_t NDEF_FILE_ID = 0xe104;
+        // Capability container with an NDEF File Control TLV for NDEF_FILE_ID.
+        constexpr std::array<std::uint8_t, 15> CC_FILE = {0x00, 0x0f, 0x20, 0x00, 0x3b,
+                                                          0x00, 0x34, 0x04, 0x06, 0xe1,
+                                                          0x04, 0x00, 0xff, 0x00, 0x00};
+
+        template <std::size_t N>
+        bool starts_with(const std::uint8_t *buffer,
+                         std::size_t length,
+                         const std::array<std::uint8_t, N> &prefix)
+        {
+            return length >= N && std::equal(prefix.cbegin(), prefix.cend(), buffer);
+        }
+    }
+
+    void FakePCSCBackend::add_reader(const std::string &reader_name)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        readers_[reader_name];
+        reader_list_version_++;
+        changed_condition_.notify_all();
+    }
+
+    void FakePCSCBackend::remove_reader(const std::string &reader_name)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        readers_.erase(reader_name);
+        reader_list_version_++;
+        changed_condition_.notify_all();
+    }
+
+    void FakePCSCBackend::insert_card(const std::string &reader_name,
+                                      const std::vector<std::uint8_t> &atr,
+                                      const std::vector<std::uint8_t> &uid,
+                                      const std::vector<std::uint8_t> &ndef_message)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        Reader &reader = readers_.at(reader_name);
+        std::vector<std::uint8_t> ndef_file;
+
+        if (!ndef_message.empty()) {
+            ndef_file = {std::uint8_t(ndef_message.size() >> 8), std::uint8_t(ndef_message.size())};
+            ndef_file.insert(ndef_file.end(), ndef_message.cbegin(), ndef_message.cend());
+        }
+
+        reader.card = Card{next_card_id_++, atr, uid, std::move(ndef_file)};
+        reader.event_count++;
+        changed_condition_.notify_all();
+    }
+
+    void FakePCSCBackend::remove_card(const std::string &reader_name)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        Reader &reader = readers_.at(reader_name);
+
+        reader.card.reset();
+        reader.event_count++;
+        changed_condition_.notify_all();
+    }
+
+    void FakePCSCBackend::set_service_running(bool running)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        service_running_ = running;
+
+        if (!running) {
+            num_establish_failures_ = 0;
+            contexts_.clear();
+            cancelled_contexts_.clear();
+            connections_.clear();
+            changed_condition_.notify_all();
+        }
+    }
+
+    void FakePCSCBackend::set_transmit_latency(std::chrono::microseconds latency)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        transmit_latency_ = latency;
+    }
+
+    void FakePCSCBackend::set_transmit_blocked(bool blocked)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        transmit_blocked_ = blocked;
+        changed_condition_.notify_all();
+    }
+
+    void FakePCSCBackend::set_num_cancels_lost(unsigned int num_lost)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        num_cancels_lost_ = num_lost;
+    }
+
+    void FakePCSCBackend::set_status_change_hook(std::function<void()> &&hook)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        status_change_hook_ = std::move(hook);
+    }
+
+    bool FakePCSCBackend::wait_until_waiting_for_card(const std::string &reader_name,
+                                                      std::chrono::milliseconds timeout)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        return changed_condition_.wait_for(lock, timeout, [&] {
+            auto it = readers_.find(reader_name);
+            return it != readers_.end() && it->second.num_waiting_for_card > 0;
+        });
+    }
+
+    bool FakePCSCBackend::wait_until_card_read(const std::string &reader_name,
+                                               std::chrono::milliseconds timeout)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        return changed_condition_.wait_for(lock, timeout, [&] {
+            auto it = readers_.find(reader_name);
+            return it != readers_.end() && it->second.card && it->second.card->read;
+        });
+    }
+
+    bool FakePCSCBackend::wait_until_transmitting(unsigned int num_transmits,
+                                                  std::chrono::milliseconds timeout)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        return changed_condition_.wait_for(
+            lock, timeout, [&] { return num_transmits_ >= num_transmits; });
+    }
+
+    bool FakePCSCBackend::wait_until_establish_failed(unsigned int num_failures,
+                                                      std::chrono::milliseconds timeout)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        return changed_condition_.wait_for(
+            lock, timeout, [&] { return num_establish_failures_ >= num_failures; });
+    }
+
+    bool FakePCSCBackend::wait_until_contexts_released(std::chrono::milliseconds timeout)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        return changed_condition_.wait_for(lock, timeout, [this] { return contexts_.empty(); });
+    }
+
+    unsigned int FakePCSCBackend::num_contexts() const
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        return contexts_.size();
+    }
+
+    unsigned int FakePCSCBackend::num_transmits() const
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        return num_transmits_;
+    }
+
+    LONG FakePCSCBackend::establish_context(SCARDCONTEXT &context)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        if (!service_running_) {
+            num_establish_failures_++;
+            changed_condition_.notify_all();
+            return SCARD_E_NO_SERVICE;
+        }
+
+        context = next_context_++;
+        contexts_.insert(context);
+
+        return SCARD_S_SUCCESS;
+    }
+
+    LONG FakePCSCBackend::release_context(SCARDCONTEXT context)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        if (contexts_.erase(context) == 0) {
+            return SCARD_E_INVALID_HANDLE;
+        }
+
+        cancelled_contexts_.erase(context);
+        changed_condition_.notify_all();
+
+        return SCARD_S_SUCCESS;
+    }
+
+    LONG FakePCSCBackend::list_readers(SCARDCONTEXT context,
+                                       std::vector<std::string> &reader_names)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        if (contexts_.count(context) == 0) {
+            return SCARD_E_INVALID_HANDLE;
+        }
+
+        if (readers_.empty()) {
+            return SCARD_E_NO_READERS_AVAILABLE;
+        }
+
+        reader_names.clear();
+
+        for (const auto &[reader_name, reader] : readers_) {
+            reader_names.emplace_back(reader_name);
+        }
+
+        return SCARD_S_SUCCESS;
+    }
+
+    LONG FakePCSCBackend::get_status_change(SCARDCONTEXT context,
+                                            DWORD timeout,
+                                            SCARD_READERSTATE *states,
+                                            DWORD num_states)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        const std::uint64_t reader_list_version = reader_list_version_;
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+
+        while (true) {
+            // Contexts are dropped when the service stops, also while waiting.
+            if (contexts_.count(context) == 0) {
+                return service_running_ ? SCARD_E_INVALID_HANDLE : SCARD_E_NO_SERVICE;
+            }
+
+            if (cancelled_contexts_.erase(context) > 0) {
+                return SCARD_E_CANCELLED;
+            }
+
+            bool changed = false;
+
+            for (DWORD i = 0; i < num_states; i++) {
+                SCARD_READERSTATE &state = states[i];
+
+                if (std::strcmp(state.szReader, NOTIFICATION_READER_NAME) == 0) {
+                    if (reader_list_version_ != reader_list_version) {
+                        state.dwEventState = SCARD_STATE_CHANGED;
+                        changed = true;
+                    } else {
+                        state.dwEventState = state.dwCurrentState & ~SCARD_STATE_CHANGED;
+                    }
+                    continue;
+                }
+
+                DWORD event_state = reader_state(state.szReader);
+
+                if (event_state != (state.dwCurrentState & ~SCARD_STATE_CHANGED)) {
+                    event_state |= SCARD_STATE_CHANGED;
+                    changed = true;
+                }
+
+                state.dwEventState = event_state;
+
+                auto it = readers_.find(state.szReader);
+                if (it != readers_.end() && it->second.card) {
+                    std::size_t atr_size = std::min(it->second.card->atr.size(),
+                                                    sizeof(state.rgbAtr));
+                    std::copy_n(it->second.card->atr.cbegin(), atr_size, state.rgbAtr);
+                    state.cbAtr = atr_size;
+                } else {
+                    state.cbAtr = 0;
+                }
+            }
+
+            if (changed) {
+                if (status_change_hook_) {
+                    status_change_hook_();
+                }
+                return SCARD_S_SUCCESS;
+            }
+
+            // Nothing is allocated here, tests check that the card present path does not allocate.
+            auto waiting_for_card = [&](DWORD i) -> Reader * {
+                auto it = readers_.find(states[i].szReader);
+                if (it == readers_.end() || !(states[i].dwCurrentState & SCARD_STATE_EMPTY)) {
+                    return nullptr;
+                }
+                return &it->second;
+            };
+
+            for (DWORD i = 0; i < num_states; i++) {
+                if (Reader *reader = waiting_for_card(i)) {
+                    reader->num_waiting_for_card++;
+                    changed_condition_.notify_all();
+                }
+            }
+
+            bool timed_out = false;
+
+            if (timeout == INFINITE) {
+                changed_condition_.wait(lock);
+            } else {
+                timed_out =
+                    changed_condition_.wait_until(lock, deadline) == std::cv_status::timeout;
+            }
+
+            // Readers may have been removed, and added again, while waiting.
+            for (DWORD i = 0; i < num_states; i++) {
+                Reader *reader = waiting_for_card(i);
+                if (reader && reader->num_waiting_for_card > 0) {
+                    reader->num_waiting_for_card--;
+                }
+            }
+
+            if (timed_out) {
+                return SCARD_E_TIMEOUT;
+            }
+        }
+    }
+
+    LONG FakePCSCBackend::cancel(SCARDCONTEXT context)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        if (contexts_.count(context) == 0) {
+            return SCARD_E_INVALID_HANDLE;
+        }
+
+        if (num_cancels_lost_ > 0) {
+            num_cancels_lost_--;
+            return SCARD_S_SUCCESS;
+        }
+
+        cancelled_contexts_.insert(context);
+        changed_condition_.notify_all();
+
+        return SCARD_S_SUCCESS;
+    }
+
+    LONG FakePCSCBackend::connect(SCARDCONTEXT context,
+                                  const char *reader_name,
+                                  DWORD /*share_mode*/,
+                                  DWORD /*preferred_protocols*/,
+                                  SCARDHANDLE &handle,
+                                  DWORD &active_protocol)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        if (contexts_.count(context) == 0) {
+            return SCARD_E_INVALID_HANDLE;
+        }
+
+        auto it = readers_.find(reader_name);
+
+        if (it == readers_.end()) {
+            return SCARD_E_UNKNOWN_READER;
+        }
+
+        if (!it->second.card) {
+            return SCARD_E_NO_SMARTCARD;
+        }
+
+        handle = next_handle_++;
+        active_protocol = SCARD_PROTOCOL_T1;
+        connections_[handle] = Connection{reader_name, it->second.card->id};
+
+        return SCARD_S_SUCCESS;
+    }
+
+    LONG FakePCSCBackend::reconnect(SCARDHANDLE handle,
+                                    DWORD /*share_mode*/,
+                                    DWORD /*preferred_protocols*/,
+                                    DWORD /*initialization*/,
+                                    DWORD &active_protocol)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        auto connection = connections_.find(handle);
+
+        if (connection == connections_.end()) {
+            return SCARD_E_INVALID_HANDLE;
+        }
+
+        auto reader = readers_.find(connection->second.reader_name);
+
+        if (reader == readers_.end()) {
+            return SCARD_E_READER_UNAVAILABLE;
+        }
+
+        if (!reader->second.card) {
+            return SCARD_E_NO_SMARTCARD;
+        }
+
+        // The handle now refers to the card currently in the reader.
+        connection->second.card_id = reader->second.card->id;
+        active_protocol = SCARD_PROTOCOL_T1;
+
+        return SCARD_S_SUCCESS;
+    }
+
+    LONG FakePCSCBackend::disconnect(SCARDHANDLE handle, DWORD /*disposition*/)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        if (connections_.erase(handle) == 0) {
+            return SCARD_E_INVALID_HANDLE;
+        }
+
+        return SCARD_S_SUCCESS;
+    }
+
+    LONG FakePCSCBackend::transmit(SCARDHANDLE handle,
+                                   const SCARD_IO_REQUEST * /*send_pci*/,
+                                   const std::uint8_t *send_buffer,
+                                   DWORD send_length,
+                                   std::uint8_t *recv_buffer,
+                                   DWORD &recv_length)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        if (connections_.count(handle) == 0) {
+            return SCARD_E_INVALID_HANDLE;
+        }
+
+        std::chrono::microseconds latency = transmit_latency_;
+
+        num_transmits_++;
+        changed_condition_.notify_all();
+
+        lock.unlock();
+        std::this_thread::sleep_for(latency);
+        lock.lock();
+
+        changed_condition_.wait(lock, [this] { return !transmit_blocked_; });
+        num_transmits_--;
+
+        auto connection = connections_.find(handle);
+
+        if (connection == connections_.end()) {
+            return SCARD_E_INVALID_HANDLE;
+        }
+
+        auto reader = readers_.find(connection->second.reader_name);
+
+        if (reader == readers_.end() || !reader->second.card ||
+            reader->second.card->id != connection->second.card_id) {
+            return SCARD_W_REMOVED_CARD;
+        }
+
+        Card &card = *reader->second.card;
+        Response response = {nullptr, 0, &STATUS_INSTRUCTION_NOT_SUPPORTED, false};
+
+        if (std::equal(send_buffer,
+                       send_buffer + send_length,
+                       GET_DATA_COMMAND.cbegin(),
+                       GET_DATA_COMMAND.cend())) {
+            response = {card.uid.data(), card.uid.size(), &STATUS_SUCCESS, true};
+        } else if (!card.ndef_file.empty()) {
+            response = ndef_tag_response(card, send_buffer, send_length);
+        }
+
+        if (response.data_size + response.status->size() > recv_length) {
+            return SCARD_E_INSUFFICIENT_BUFFER;
+        }
+
+        std::uint8_t *status_buffer =
+            std::copy(response.data, response.data + response.data_size, recv_buffer);
+        std::copy(response.status->cbegin(), response.status->cend(), status_buffer);
+        recv_length = response.data_size + response.status->size();
+
+        if (response.card_read) {
+            card.read = true;
+            changed_condition_.notify_all();
+        }
+
+        return SCARD_S_SUCCESS;
+    }
+
+    FakePCSCBackend::Response FakePCSCBackend::ndef_tag_response(Card &card,
+                                                                 const std::uint8_t *command,
+                                                                 std::size_t length)
+    {
+        if (starts_with(command, length, SELECT_NDEF_APPLICATION_COMMAND)) {
+            card.selected_file = 0;
+            return {nullptr, 0, &STATUS_SUCCESS, false};
+        }
+
+        if (starts_with(command, length, SELECT_FILE_COMMAND_PREFIX) &&
+            length == SELECT_FILE_COMMAND_PREFIX.size() + 2) {
+            std::uint16_t file_id = command[length - 2] << 8 | command[length - 1];
+
+            if (file_id != CC_FILE_ID && file_id != NDEF_FILE_ID) {
+                return {nullptr, 0, &STATUS_FILE_NOT_FOUND, false};
+            }
+
+            card.selected_file = file_id;
+            return {nullptr, 0, &STATUS_SUCCESS, false};
+        }
+
+        if (starts_with(command, length, READ_BINARY_COMMAND_PREFIX) &&
+            length == READ_BINARY_COMMAND_LENGTH && card.selected_file != 0) {
+            std::size_t offset = command[2] << 8 | command[3];
+            std::size_t read_length = command[4];
+            const std::uint8_t *file = CC_FILE.data();
+            std::size_t file_size = CC_FILE.size();
+
+            if (card.selected_file == NDEF_FILE_ID) {
+                file = card.ndef_file.data();
+                file_size = card.ndef_file.size();
+            }
+
+            if (offset + read_length > file_size) {
+                return {nullptr, 0, &STATUS_WRONG_PARAMETERS, false};
+            }
+
+            // The message is read last, after its length.
+            bool message_read = card.selected_file == NDEF_FILE_ID && offset > 0 &&
+                                offset + read_length == file_size;
+
+            return {file + offset, read_length, &STATUS_SUCCESS, message_read};
+        }
+
+        return {nullptr, 0, &STATUS_INSTRUCTION_NOT_SUPPORTED, false};
+    }
+
+    DWORD FakePCSCBackend::reader_state(const char *reader_name) const
+    {
+        auto it = readers_.find(reader_name);
+
+        if (it == readers_.end()) {
+            return SCARD_STATE_UNKNOWN;
+        }
+
+        const Reader &reader = it->second;
+
+        return (reader.event_count << EVENT_COUNT_SHIFT) |
+               (reader.card ? SCARD_STATE_PRESENT : SCARD_STATE_EMPTY);
+    }
+}
@@ -0,0 +1,192 @@
+// Copyright (C) 2019 Luxoft Sweden AB
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+//
+// SPDX-License-Identifier: MPL-2.0
+
+#ifndef UIM_DAEMON_UNIT_TESTS_FAKE_PCSC_BACKEND_H
+#define UIM_DAEMON_UNIT_TESTS_FAKE_PCSC_BACKEND_H
+
+#include <winscard.h>
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "daemon/pcsc_backend.h"
+
+namespace UserIdentificationManager::Daemon
+{
+    // PCSCBackend simulating readers and contactless cards, for testing PCSCContext without
+    // pcscd.
+    //
+    // Readers are hotplugged and cards inserted and removed by calling the methods below from any
+    // thread. Cards answer Get Data with their UID, after the configured transmit latency. Cards
+    // with an NDEF message also act as an NFC Forum Type 4 Tag holding it. Any other command is
+    // answered with "instruction not supported". The status change semantics follow
+    // pcsc-lite, including the event counter in the upper 16 bits of the reader state.
+    class FakePCSCBackend : public PCSCBackend
+    {
+    public:
+        static constexpr std::chrono::seconds DEFAULT_WAIT_TIMEOUT{10};
+
+        void add_reader(const std::string &reader_name);
+        void remove_reader(const std::string &reader_name);
+
+        void insert_card(const std::string &reader_name,
+                         const std::vector<std::uint8_t> &atr,
+                         const std::vector<std::uint8_t> &uid,
+                         const std::vector<std::uint8_t> &ndef_message = {});
+        void remove_card(const std::string &reader_name);
+
+        // Simulate pcscd stopping and starting. Stopping invalidates all contexts and card
+        // connections, SCardGetStatusChange() calls waiting return SCARD_E_NO_SERVICE.
+        void set_service_running(bool running);
+
+        void set_transmit_latency(std::chrono::microseconds latency);
+
+        // Simulate a driver stuck in SCardTransmit(). While blocked, SCardTransmit() does not
+        // return, even if cancelled.
+        void set_transmit_blocked(bool blocked);
+
+        // Simulate SCardCancel() being lost like it can be in pcsc-lite when called just before
+        // SCardGetStatusChange() starts waiting. The next num_lost calls succeed but cancel
+        // nothing.
+        void set_num_cancels_lost(unsigned int num_lost);
+
+        // Invoked, with the backend locked, when SCardGetStatusChange() is about to return a
+        // change. Apart from the hook, nothing is allocated from then on until the next
+        // SCardConnect() or reader and card change by the methods above.
+        void set_status_change_hook(std::function<void()> &&hook);
+
+        // Wait until SCardGetStatusChange() waits for a card to be inserted in the reader, i.e.
+        // until an inserted card will be noticed. Returns false on timeout.
+        bool wait_until_waiting_for_card(
+            const std::string &reader_name,
+            std::chrono::milliseconds timeout = DEFAULT_WAIT_TIMEOUT);
+
+        // Wait until the UID of the card in the reader has been read. Returns false on timeout.
+        bool wait_until_card_read(const std::string &reader_name,
+                                  std::chrono::milliseconds timeout = DEFAULT_WAIT_TIMEOUT);
+
+        // Wait until num_transmits SCardTransmit() calls are in progress at the same time.
+        // Returns false on timeout.
+        bool wait_until_transmitting(unsigned int num_transmits,
+                                     std::chrono::milliseconds timeout = DEFAULT_WAIT_TIMEOUT);
+
+        // Wait until SCardEstablishContext() has failed num_failures times since the service
+        // stopped. Returns false on timeout.
+        bool wait_until_establish_failed(unsigned int num_failures,
+                                         std::chrono::milliseconds timeout = DEFAULT_WAIT_TIMEOUT);
+
+        // Wait until all contexts are released. Returns false on timeout.
+        bool wait_until_contexts_released(std::chrono::milliseconds timeout = DEFAULT_WAIT_TIMEOUT);
+
+        unsigned int num_contexts() const;
+        unsigned int num_transmits() const;
+
+        LONG establish_context(SCARDCONTEXT &context) override;
+        LONG release_context(SCARDCONTEXT context) override;
+        LONG list_readers(SCARDCONTEXT context, std::vector<std::string> &reader_names) override;
+        LONG get_status_change(SCARDCONTEXT context,
+                               DWORD timeout,
+                               SCARD_READERSTATE *states,
+                               DWORD num_states) override;
+        LONG cancel(SCARDCONTEXT context) override;
+
+        LONG connect(SCARDCONTEXT context,
+                     const char *reader_name,
+                     DWORD share_mode,
+                     DWORD preferred_protocols,
+                     SCARDHANDLE &handle,
+                     DWORD &active_protocol) override;
+        LONG reconnect(SCARDHANDLE handle,
+                       DWORD share_mode,
+                       DWORD preferred_protocols,
+                       DWORD initialization,
+                       DWORD &active_protocol) override;
+        LONG disconnect(SCARDHANDLE handle, DWORD disposition) override;
+        LONG transmit(SCARDHANDLE handle,
+                      const SCARD_IO_REQUEST *send_pci,
+                      const std::uint8_t *send_buffer,
+                      DWORD send_length,
+                      std::uint8_t *recv_buffer,
+                      DWORD &recv_length) override;
+
+    private:
+        struct Card
+        {
+            std::uint64_t id;
+            std::vector<std::uint8_t> atr;
+            std::vector<std::uint8_t> uid;
+            // NLEN followed by the NDEF message, empty if the card has none.
+            std::vector<std::uint8_t> ndef_file;
+            bool read = false;
+            std::uint16_t selected_file = 0;
+        };
+
+        struct Response
+        {
+            const std::uint8_t *data;
+            std::size_t data_size;
+            const std::array<std::uint8_t, 2> *status;
+            // The UID or NDEF message has been read.
+            bool card_read;
+        };
+
+        struct Reader
+        {
+            std::optional<Card> card;
+            DWORD event_count = 0;
+            unsigned int num_waiting_for_card = 0;
+        };
+
+        struct Connection
+        {
+            std::string reader_name;
+            std::uint64_t card_id;
+        };
+
+        // Answer a command to an NFC Forum Type 4 Tag.
+        static Response ndef_tag_response(Card &card,
+                                          const std::uint8_t *command,
+                                          std::size_t length);
+
+        DWORD reader_state(const char *reader_name) const;
+
+        mutable std::mutex mutex_;
+        std::condition_variable changed_condition_;
+
+        std::map<std::string, Reader, std::less<>> readers_;
+        std::uint64_t reader_list_version_ = 0;
+        std::uint64_t next_card_id_ = 1;
+
+        std::set<SCARDCONTEXT> contexts_;
+        std::set<SCARDCONTEXT> cancelled_contexts_;
+        SCARDCONTEXT next_context_ = 1;
+
+        std::map<SCARDHANDLE, Connection> connections_;
+        SCARDHANDLE next_handle_ = 1;
+
+        bool service_running_ = true;
+        unsigned int num_establish_failures_ = 0;
+        std::chrono::microseconds transmit_latency_{0};
+        bool transmit_blocked_ = false;
+        unsigned int num_transmits_ = 0;
+        unsigned int num_cancels_lost_ = 0;
+        std::function<void()> status_change_hook_;
+    };
+}
+
+#endif // UIM_DAEMON_UNIT_TESTS_FAKE_PCSC_BACKEND_H
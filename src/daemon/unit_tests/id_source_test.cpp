@@ -11,6 +11,7 @@
 #include <gtest/gtest.h>
 
 #include <cstddef>
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -37,13 +38,20 @@ namespace UserIdentificationManager::Daemon
                 set_enabled(false);
             }
 
+            Statistics statistics() const override
+            {
+                return {{"counter", std::uint64_t(name().back() - '0')}};
+            }
+
             IdentifiedUser simulate_user_identified(const std::string &user_identification_id,
-                                                    IdSource::SeatId seat_id) const
+                                                    IdSource::SeatId seat_id,
+                                                    std::int64_t timestamp_us = 0) const
             {
                 IdentifiedUser user;
 
                 user.user_identification_id = name() + "-" + user_identification_id;
                 user.seat_id = seat_id;
+                user.timestamp_us = timestamp_us;
 
                 user_identified(user);
 
@@ -115,7 +123,7 @@ namespace UserIdentificationManager::Daemon
         testing::AssertionResult expect_users(const char *users1_expr,
                                               const char *users2_expr,
                                               const std::vector<IdSource::IdentifiedUser> &users1,
-                                              const std::vector<IdSource::IdentifiedUser> &users2)
+                                              const IdSource::Group::IdentifiedUsers &users2)
         {
             if (users1.size() != users2.size()) {
                 return testing::AssertionFailure()
@@ -214,6 +222,13 @@ namespace UserIdentificationManager::Daemon
         EXPECT_EQ(Names({"TEST1", "TEST3"}), group().enabled_names());
     }
 
+    TEST_F(IdSourceGroupTest, StatisticsPrefixedWithSourceName)
+    {
+        Statistics expected = {{"TEST1.counter", 1}, {"TEST2.counter", 2}, {"TEST3.counter", 3}};
+
+        EXPECT_EQ(expected, group().statistics());
+    }
+
     TEST_F(IdSourceGroupTest, UserIdentifiedSignal)
     {
         IdSource::IdentifiedUser received_user;
@@ -251,24 +266,170 @@ namespace UserIdentificationManager::Daemon
 
         group().enable_all();
 
-        for (unsigned int i = 0; i < IdSource::Group::MAX_SAVED_IDENTIFIED_USERS; i++) {
+        for (unsigned int i = 0; i < IdSource::Group::DEFAULT_HISTORY_CAPACITY; i++) {
             TestSource &source = test_source(i % NUM_TEST_SOURCES);
 
             expected_users.emplace_back(
                 source.simulate_user_identified(std::to_string(i), IdSource::SeatId(i)));
         }
 
-        EXPECT_EQ(IdSource::Group::MAX_SAVED_IDENTIFIED_USERS, group().identified_users().size());
+        EXPECT_EQ(IdSource::Group::DEFAULT_HISTORY_CAPACITY, group().identified_users().size());
         EXPECT_PRED_FORMAT2(expect_users, expected_users, group().identified_users());
 
         expected_users.emplace_back(test_source(0).simulate_user_identified("123", 0x0123));
         expected_users.erase(expected_users.begin());
-        EXPECT_EQ(IdSource::Group::MAX_SAVED_IDENTIFIED_USERS, group().identified_users().size());
+        EXPECT_EQ(IdSource::Group::DEFAULT_HISTORY_CAPACITY, group().identified_users().size());
         EXPECT_PRED_FORMAT2(expect_users, expected_users, group().identified_users());
 
         expected_users.emplace_back(test_source(1).simulate_user_identified("456", 0x4567));
         expected_users.erase(expected_users.begin());
-        EXPECT_EQ(IdSource::Group::MAX_SAVED_IDENTIFIED_USERS, group().identified_users().size());
+        EXPECT_EQ(IdSource::Group::DEFAULT_HISTORY_CAPACITY, group().identified_users().size());
+        EXPECT_PRED_FORMAT2(expect_users, expected_users, group().identified_users());
+    }
+
+    TEST_F(IdSourceGroupTest, HistoryCapacityKeepsMostRecent)
+    {
+        std::vector<IdSource::IdentifiedUser> expected_users;
+
+        group().enable_all();
+        group().set_history_capacity(2);
+
+        test_source(0).simulate_user_identified("123", 0x0123);
+        expected_users.emplace_back(test_source(1).simulate_user_identified("456", 0x4567));
+        expected_users.emplace_back(test_source(2).simulate_user_identified("789", 0x89ab));
+        EXPECT_PRED_FORMAT2(expect_users, expected_users, group().identified_users());
+
+        group().set_history_capacity(1);
+        expected_users.erase(expected_users.begin());
         EXPECT_PRED_FORMAT2(expect_users, expected_users, group().identified_users());
     }
+
+    TEST_F(IdSourceGroupTest, SequenceNumbersAndTimestamps)
+    {
+        std::vector<IdSource::IdentifiedUser> received_users;
+
+        group().enable_all();
+        group().user_identified_signal().connect(
+            [&](const auto &user) { received_users.emplace_back(user); });
+
+        test_source(0).simulate_user_identified("123", 0x0123, 1000);
+        test_source(1).simulate_user_identified("456", 0x4567, 3000);
+        test_source(0).simulate_user_identified("789", 0x89ab, 2000);
+
+        ASSERT_EQ(3u, received_users.size());
+        IdSource::Group::IdentifiedUsers identified_users = group().identified_users();
+        ASSERT_EQ(3u, identified_users.size());
+
+        for (std::size_t i = 0; i < received_users.size(); i++) {
+            EXPECT_EQ(i + 1, received_users[i].sequence_number);
+            EXPECT_EQ(i + 1, identified_users[i].sequence_number);
+            EXPECT_EQ(received_users[i].timestamp_us, identified_users[i].timestamp_us);
+        }
+
+        EXPECT_EQ(1000, received_users[0].timestamp_us);
+        EXPECT_EQ(3000, received_users[1].timestamp_us);
+        EXPECT_EQ(2000, received_users[2].timestamp_us);
+    }
+
+    TEST_F(IdSourceGroupTest, IdentifiedUsersSince)
+    {
+        std::vector<IdSource::IdentifiedUser> expected_users;
+
+        group().enable_all();
+        group().set_history_capacity(2);
+        EXPECT_EQ(0u, group().last_sequence_number());
+        EXPECT_TRUE(group().identified_users_since(0).empty());
+        EXPECT_FALSE(group().identified_users_lost_since(0));
+
+        test_source(0).simulate_user_identified("123", 0x0123);
+        expected_users.emplace_back(test_source(1).simulate_user_identified("456", 0x4567));
+        expected_users.emplace_back(test_source(2).simulate_user_identified("789", 0x89ab));
+        EXPECT_EQ(3u, group().last_sequence_number());
+
+        EXPECT_PRED_FORMAT2(expect_users, expected_users, group().identified_users_since(1));
+        EXPECT_FALSE(group().identified_users_lost_since(1));
+
+        EXPECT_PRED_FORMAT2(expect_users, expected_users, group().identified_users_since(0));
+        EXPECT_TRUE(group().identified_users_lost_since(0));
+
+        expected_users.erase(expected_users.begin());
+        EXPECT_PRED_FORMAT2(expect_users, expected_users, group().identified_users_since(2));
+        EXPECT_FALSE(group().identified_users_lost_since(2));
+
+        EXPECT_TRUE(group().identified_users_since(3).empty());
+        EXPECT_FALSE(group().identified_users_lost_since(3));
+    }
+
+    TEST_F(IdSourceGroupTest, IdentifiedUsersSinceAfterLastTreatedAsZero)
+    {
+        std::vector<IdSource::IdentifiedUser> expected_users;
+
+        group().enable_all();
+
+        expected_users.emplace_back(test_source(0).simulate_user_identified("123", 0x0123));
+        EXPECT_PRED_FORMAT2(expect_users, expected_users, group().identified_users_since(100));
+        EXPECT_FALSE(group().identified_users_lost_since(100));
+    }
+
+    TEST_F(IdSourceGroupTest, HistoryVersionChangesWithHistory)
+    {
+        group().enable_all();
+
+        std::uint64_t version = group().history_version();
+
+        test_source(0).simulate_user_identified("123", 0x0123);
+        EXPECT_NE(version, group().history_version());
+
+        version = group().history_version();
+        group().set_history_capacity(IdSource::Group::DEFAULT_HISTORY_CAPACITY);
+        EXPECT_EQ(version, group().history_version());
+
+        group().set_history_capacity(1);
+        EXPECT_NE(version, group().history_version());
+    }
+
+    TEST_F(IdSourceGroupTest, SourcesVersionChangesWithEnabledSources)
+    {
+        std::uint64_t version = group().sources_version();
+
+        group().disable_all();
+        EXPECT_EQ(version, group().sources_version());
+
+        group().enable({"TEST2"});
+        EXPECT_NE(version, group().sources_version());
+
+        version = group().sources_version();
+        test_source(1).enable();
+        EXPECT_EQ(version, group().sources_version());
+
+        group().enable_all();
+        EXPECT_NE(version, group().sources_version());
+    }
+
+    TEST_F(IdSourceGroupTest, CurrentUsers)
+    {
+        std::size_t current_users_in_signal = 0;
+
+        group().enable_all();
+        group().set_history_capacity(1);
+        group().user_identified_signal().connect([&](const auto & /*user*/) {
+            current_users_in_signal = group().current_users().size();
+        });
+        EXPECT_TRUE(group().current_users().empty());
+
+        IdSource::IdentifiedUser user1 = test_source(0).simulate_user_identified("123", 0x0000);
+        IdSource::IdentifiedUser user2 = test_source(1).simulate_user_identified("456", 0x0001);
+        EXPECT_EQ(2u, current_users_in_signal);
+
+        const IdSource::Group::CurrentUsers &current_users = group().current_users();
+        ASSERT_EQ(2u, current_users.size());
+        EXPECT_PRED_FORMAT2(expect_user, user1, current_users.at(0x0000));
+        EXPECT_PRED_FORMAT2(expect_user, user2, current_users.at(0x0001));
+        EXPECT_EQ(1u, current_users.at(0x0000).sequence_number);
+
+        user1 = test_source(2).simulate_user_identified("789", 0x0000);
+        ASSERT_EQ(2u, current_users.size());
+        EXPECT_PRED_FORMAT2(expect_user, user1, current_users.at(0x0000));
+        EXPECT_EQ(3u, current_users.at(0x0000).sequence_number);
+    }
 }
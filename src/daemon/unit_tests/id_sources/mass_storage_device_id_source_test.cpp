@@ -8,27 +8,320 @@
 
 #include "daemon/id_sources/mass_storage_device_id_source.h"
 
+#include <fcntl.h>
+#include <glib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <glibmm.h>
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
 #include "common/scoped_silent_log_handler.h"
-#include "common/scoped_temp_file.h"
+#include "daemon/mount_watcher.h"
 
 namespace UserIdentificationManager::Daemon
 {
     namespace
     {
-        std::optional<IdSource::IdentifiedUser> parser_read_file(const std::string &file_content)
+        std::optional<IdSource::IdentifiedUser> parse_id_content(const std::string &file_content)
         {
-            Common::ScopedTempFile file(file_content);
             Common::ScopedSilentLogHandler log_handler;
 
-            return MassStorageDeviceIdSource::Parser::read_file(file.path());
+            return MassStorageDeviceIdSource::Parser::parse("test", file_content);
+        }
+
+        constexpr std::size_t PARALLELISM = MassStorageDeviceIdSource::MOUNT_SCAN_PARALLELISM;
+
+        std::string user_id_content(std::size_t user)
+        {
+            return "ID " + std::to_string(user) + "\nSEAT 0x0\n";
         }
+
+        // IDs of the users in user_id_content() from first to last.
+        std::vector<std::string> user_identification_ids(const std::vector<std::size_t> &users)
+        {
+            std::vector<std::string> ids;
+
+            for (std::size_t user : users) {
+                ids.emplace_back("MSD-" + std::to_string(user));
+            }
+
+            return ids;
+        }
+
+        std::vector<std::size_t> users_up_to(std::size_t num_users)
+        {
+            std::vector<std::size_t> users(num_users);
+
+            for (std::size_t user = 0; user < num_users; user++) {
+                users[user] = user;
+            }
+
+            return users;
+        }
+
+        class FakeMountWatcher : public MountWatcher
+        {
+        public:
+            explicit FakeMountWatcher(std::vector<std::string> roots) : roots_(std::move(roots))
+            {
+            }
+
+            std::vector<std::string> mounts() override
+            {
+                return roots_;
+            }
+
+            void add(const std::string &root)
+            {
+                roots_.emplace_back(root);
+                mount_added_.emit(root);
+            }
+
+            void remove(const std::string &root)
+            {
+                roots_.erase(std::find(roots_.begin(), roots_.end(), root));
+                mount_removed_.emit(root);
+            }
+
+        private:
+            std::vector<std::string> roots_;
+        };
+
+        // Temporary directory standing in for the root directory of a mounted device.
+        class TempMount
+        {
+        public:
+            TempMount()
+            {
+                char *root = g_dir_make_tmp(nullptr, nullptr);
+
+                if (!root) {
+                    throw std::runtime_error("Failed to create temporary directory");
+                }
+
+                root_ = root;
+                g_free(root);
+            }
+
+            TempMount(const TempMount &other) = delete;
+            TempMount(TempMount &&other) = delete;
+            TempMount &operator=(const TempMount &other) = delete;
+            TempMount &operator=(TempMount &&other) = delete;
+
+            ~TempMount()
+            {
+                // Lets a read still waiting for the FIFO finish.
+                if (fifo_read_started()) {
+                    close(fifo_fd_);
+                }
+
+                unlink(user_id_file_path().c_str());
+                rmdir(root_.c_str());
+            }
+
+            const std::string &root() const
+            {
+                return root_;
+            }
+
+            void write_user_id_file(const std::string &contents) const
+            {
+                ASSERT_TRUE(g_file_set_contents(
+                    user_id_file_path().c_str(), contents.data(), contents.size(), nullptr));
+            }
+
+            // Write contents over the user ID file in place and restore its modification time.
+            // Reported as a change, although the FileKey is the same if contents are.
+            void rewrite_user_id_file(const std::string &contents) const
+            {
+                const std::string path = user_id_file_path();
+                struct stat file_stat = {};
+
+                ASSERT_EQ(0, stat(path.c_str(), &file_stat));
+
+                int fd = open(path.c_str(), O_WRONLY | O_TRUNC);
+
+                ASSERT_NE(-1, fd);
+                EXPECT_EQ(ssize_t(contents.size()), write(fd, contents.data(), contents.size()));
+                close(fd);
+
+                const struct timespec times[] = {file_stat.st_atim, file_stat.st_mtim};
+
+                ASSERT_EQ(0, utimensat(AT_FDCWD, path.c_str(), times, 0));
+            }
+
+            // Make the user ID file a FIFO. Reading it does not complete until write_fifo(), so
+            // reads can be held in flight.
+            void make_fifo() const
+            {
+                ASSERT_EQ(0, mkfifo(user_id_file_path().c_str(), S_IRUSR | S_IWUSR));
+            }
+
+            // True once the FIFO has been opened for reading.
+            bool fifo_read_started()
+            {
+                if (fifo_fd_ == -1) {
+                    fifo_fd_ = open(user_id_file_path().c_str(), O_WRONLY | O_NONBLOCK);
+                }
+
+                return fifo_fd_ != -1;
+            }
+
+            // Unless closed, the read does not see the end of the file.
+            void write_fifo(const std::string &contents, bool close_fifo = true)
+            {
+                ASSERT_TRUE(fifo_read_started());
+                ASSERT_EQ(ssize_t(contents.size()),
+                          write(fifo_fd_, contents.data(), contents.size()));
+
+                if (close_fifo) {
+                    close(fifo_fd_);
+                    fifo_fd_ = -1;
+                }
+            }
+
+        private:
+            std::string user_id_file_path() const
+            {
+                return root_ + "/pelux-user-id";
+            }
+
+            std::string root_;
+            int fifo_fd_ = -1;
+        };
+
+        class MassStorageDeviceIdSourceTest : public testing::Test, public IdSource::Listener
+        {
+        public:
+            static constexpr std::chrono::seconds WAIT_TIMEOUT{10};
+
+            MassStorageDeviceIdSourceTest()
+            {
+                source_.set_listener(this);
+            }
+
+            ~MassStorageDeviceIdSourceTest() override
+            {
+                source_.disable();
+            }
+
+            MassStorageDeviceIdSourceTest(const MassStorageDeviceIdSourceTest &other) = delete;
+            MassStorageDeviceIdSourceTest(MassStorageDeviceIdSourceTest &&other) = delete;
+            MassStorageDeviceIdSourceTest &operator=(const MassStorageDeviceIdSourceTest &other) =
+                delete;
+            MassStorageDeviceIdSourceTest &operator=(MassStorageDeviceIdSourceTest &&other) =
+                delete;
+
+            void user_identified(const IdSource::IdentifiedUser &identified_user) override
+            {
+                identified_ids_.emplace_back(identified_user.user_identification_id.view());
+            }
+
+            // Mounted when the source is enabled, in this order.
+            void create_mounts(std::size_t num_mounts)
+            {
+                for (std::size_t i = 0; i < num_mounts; i++) {
+                    mounts_.emplace_back(std::make_unique<TempMount>());
+                }
+            }
+
+            TempMount &mount(std::size_t index)
+            {
+                return *mounts_.at(index);
+            }
+
+            MassStorageDeviceIdSource &source()
+            {
+                return source_;
+            }
+
+            // Created when the source is enabled.
+            FakeMountWatcher &mount_watcher()
+            {
+                return *mount_watcher_;
+            }
+
+            const std::vector<std::string> &identified_ids() const
+            {
+                return identified_ids_;
+            }
+
+            std::uint64_t statistic(const std::string &name) const
+            {
+                for (const auto &[statistic_name, value] : source_.statistics()) {
+                    if (statistic_name == name) {
+                        return value;
+                    }
+                }
+
+                ADD_FAILURE() << "No statistic named " << name;
+
+                return 0;
+            }
+
+            // Run the main loop until condition is true. Returns false on timeout. Polls since
+            // FIFOs are opened by GIO worker threads, outside the main loop.
+            bool run_until(const std::function<bool()> &condition,
+                           std::chrono::milliseconds timeout = WAIT_TIMEOUT)
+            {
+                Glib::RefPtr<Glib::MainContext> main_context = Glib::MainContext::get_default();
+                auto deadline = std::chrono::steady_clock::now() + timeout;
+
+                while (!condition()) {
+                    if (std::chrono::steady_clock::now() >= deadline) {
+                        return false;
+                    }
+
+                    while (main_context->iteration(false)) {
+                    }
+
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+
+                return true;
+            }
+
+            void run_for(std::chrono::milliseconds duration)
+            {
+                run_until([] { return false; }, duration);
+            }
+
+        private:
+            std::vector<std::unique_ptr<TempMount>> mounts_;
+            FakeMountWatcher *mount_watcher_ = nullptr;
+            std::vector<std::string> identified_ids_;
+
+            MassStorageDeviceIdSource source_{[this] {
+                std::vector<std::string> roots;
+
+                for (const auto &temp_mount : mounts_) {
+                    roots.emplace_back(temp_mount->root());
+                }
+
+                auto fake_mount_watcher = std::make_unique<FakeMountWatcher>(std::move(roots));
+                mount_watcher_ = fake_mount_watcher.get();
+
+                return fake_mount_watcher;
+            }};
+        };
     }
 
     TEST(MassStorageDeviceIdSourceParser, ValidFile)
     {
-        auto result = parser_read_file("ID 1234\n"
+        auto result = parse_id_content("ID 1234\n"
                                        "SEAT 0x5678");
         ASSERT_TRUE(result.has_value());
         EXPECT_EQ("MSD-1234", result->user_identification_id);
@@ -37,7 +330,7 @@ namespace UserIdentificationManager::Daemon
 
     TEST(MassStorageDeviceIdSourceParser, ValidFileWithTrailingNewline)
     {
-        auto result = parser_read_file("ID 4321\n"
+        auto result = parse_id_content("ID 4321\n"
                                        "SEAT 0x8765\n");
         ASSERT_TRUE(result.has_value());
         EXPECT_EQ("MSD-4321", result->user_identification_id);
@@ -46,7 +339,7 @@ namespace UserIdentificationManager::Daemon
 
     TEST(MassStorageDeviceIdSourceParser, TrailingLinesIgnored)
     {
-        auto result = parser_read_file("ID 1\n"
+        auto result = parse_id_content("ID 1\n"
                                        "SEAT 0x2345\n"
                                        "Allows for e.g. trailing lines to contain\n"
                                        "other ids to copy paste to top");
@@ -57,7 +350,7 @@ namespace UserIdentificationManager::Daemon
 
     TEST(MassStorageDeviceIdSourceParser, SeatIdZeroAllowed)
     {
-        auto result = parser_read_file("ID 1234\n"
+        auto result = parse_id_content("ID 1234\n"
                                        "SEAT 0x0");
         ASSERT_TRUE(result.has_value());
         EXPECT_EQ("MSD-1234", result->user_identification_id);
@@ -66,7 +359,7 @@ namespace UserIdentificationManager::Daemon
 
     TEST(MassStorageDeviceIdSourceParser, SeatIdMaxAllowed)
     {
-        auto result = parser_read_file("ID 1234\n"
+        auto result = parse_id_content("ID 1234\n"
                                        "SEAT 0xffff");
         ASSERT_TRUE(result.has_value());
         EXPECT_EQ("MSD-1234", result->user_identification_id);
@@ -75,22 +368,22 @@ namespace UserIdentificationManager::Daemon
 
     TEST(MassStorageDeviceIdSourceParser, ToFewLines)
     {
-        EXPECT_FALSE(parser_read_file("ID 1234 SEAT 0x5678").has_value());
+        EXPECT_FALSE(parse_id_content("ID 1234 SEAT 0x5678").has_value());
     }
 
     TEST(MassStorageDeviceIdSourceParser, GarbageLinesAtStart)
     {
-        EXPECT_FALSE(parser_read_file("\n"
+        EXPECT_FALSE(parse_id_content("\n"
                                       "ID 1234\n"
                                       "SEAT 0x5678")
                          .has_value());
 
-        EXPECT_FALSE(parser_read_file("garbage\n"
+        EXPECT_FALSE(parse_id_content("garbage\n"
                                       "ID 1234\n"
                                       "SEAT 0x5678")
                          .has_value());
 
-        EXPECT_FALSE(parser_read_file("\n"
+        EXPECT_FALSE(parse_id_content("\n"
                                       "\n"
                                       "ID 1234\n"
                                       "SEAT 0x5678")
@@ -99,133 +392,405 @@ namespace UserIdentificationManager::Daemon
 
     TEST(MassStorageDeviceIdSourceParser, InvalidIdPrefix)
     {
-        EXPECT_FALSE(parser_read_file(" ID 1234\n"
+        EXPECT_FALSE(parse_id_content(" ID 1234\n"
                                       "SEAT 0x5678")
                          .has_value());
 
-        EXPECT_FALSE(parser_read_file("aID 1234\n"
+        EXPECT_FALSE(parse_id_content("aID 1234\n"
                                       "SEAT 0x5678")
                          .has_value());
 
-        EXPECT_FALSE(parser_read_file("iD 1234\n"
+        EXPECT_FALSE(parse_id_content("iD 1234\n"
                                       "SEAT 0x5678")
                          .has_value());
 
-        EXPECT_FALSE(parser_read_file("id 1234\n"
+        EXPECT_FALSE(parse_id_content("id 1234\n"
                                       "SEAT 0x5678")
                          .has_value());
 
-        EXPECT_FALSE(parser_read_file("IDb 1234\n"
+        EXPECT_FALSE(parse_id_content("IDb 1234\n"
                                       "SEAT 0x5678")
                          .has_value());
 
-        EXPECT_FALSE(parser_read_file("ID1234\n"
+        EXPECT_FALSE(parse_id_content("ID1234\n"
                                       "SEAT 0x5678")
                          .has_value());
     }
 
     TEST(MassStorageDeviceIdSourceParser, InvalidId)
     {
-        EXPECT_FALSE(parser_read_file("ID \n"
+        EXPECT_FALSE(parse_id_content("ID \n"
                                       "SEAT 0x5678")
                          .has_value());
 
-        EXPECT_FALSE(parser_read_file("ID 1a\n"
+        EXPECT_FALSE(parse_id_content("ID 1a\n"
                                       "SEAT 0x5678")
                          .has_value());
 
-        EXPECT_FALSE(parser_read_file("ID a1\n"
+        EXPECT_FALSE(parse_id_content("ID a1\n"
                                       "SEAT 0x5678")
                          .has_value());
 
-        EXPECT_FALSE(parser_read_file("ID 1a2\n"
+        EXPECT_FALSE(parse_id_content("ID 1a2\n"
                                       "SEAT 0x5678")
                          .has_value());
 
-        EXPECT_FALSE(parser_read_file("ID 12 \n"
+        EXPECT_FALSE(parse_id_content("ID 12 \n"
                                       "SEAT 0x5678")
                          .has_value());
 
-        EXPECT_FALSE(parser_read_file("ID 1 2\n"
+        EXPECT_FALSE(parse_id_content("ID 1 2\n"
                                       "SEAT 0x5678")
                          .has_value());
     }
 
     TEST(MassStorageDeviceIdSourceParser, InvalidSeatPrefix)
     {
-        EXPECT_FALSE(parser_read_file("ID 1234\n"
+        EXPECT_FALSE(parse_id_content("ID 1234\n"
                                       " SEAT 0x5678")
                          .has_value());
 
-        EXPECT_FALSE(parser_read_file("ID 1234\n"
+        EXPECT_FALSE(parse_id_content("ID 1234\n"
                                       "aSEAT 0x5678")
                          .has_value());
 
-        EXPECT_FALSE(parser_read_file("ID 1234\n"
+        EXPECT_FALSE(parse_id_content("ID 1234\n"
                                       "sEAT 0x5678")
                          .has_value());
 
-        EXPECT_FALSE(parser_read_file("ID 1234\n"
+        EXPECT_FALSE(parse_id_content("ID 1234\n"
                                       "seat 0x5678")
                          .has_value());
 
-        EXPECT_FALSE(parser_read_file("ID 1234\n"
+        EXPECT_FALSE(parse_id_content("ID 1234\n"
                                       "SEATa 0x5678")
                          .has_value());
 
-        EXPECT_FALSE(parser_read_file("ID 1234\n"
+        EXPECT_FALSE(parse_id_content("ID 1234\n"
                                       "SEAT0x5678")
                          .has_value());
     }
 
     TEST(MassStorageDeviceIdSourceParser, InvalidSeat)
     {
-        EXPECT_FALSE(parser_read_file("ID 1234\n"
+        EXPECT_FALSE(parse_id_content("ID 1234\n"
                                       "SEAT 0")
                          .has_value());
 
-        EXPECT_FALSE(parser_read_file("ID 1234\n"
+        EXPECT_FALSE(parse_id_content("ID 1234\n"
                                       "SEAT 0x")
                          .has_value());
 
-        EXPECT_FALSE(parser_read_file("ID 1234\n"
+        EXPECT_FALSE(parse_id_content("ID 1234\n"
                                       "SEAT 12")
                          .has_value());
 
-        EXPECT_FALSE(parser_read_file("ID 1234\n"
+        EXPECT_FALSE(parse_id_content("ID 1234\n"
                                       "SEAT 5678")
                          .has_value());
 
-        EXPECT_FALSE(parser_read_file("ID 1234\n"
+        EXPECT_FALSE(parse_id_content("ID 1234\n"
                                       "SEAT 0x10000")
                          .has_value());
 
-        EXPECT_FALSE(parser_read_file("ID 1234\n"
+        EXPECT_FALSE(parse_id_content("ID 1234\n"
                                       "SEAT 0x1ffff")
                          .has_value());
 
-        EXPECT_FALSE(parser_read_file("ID 1234\n"
+        EXPECT_FALSE(parse_id_content("ID 1234\n"
                                       "SEAT -0x0")
                          .has_value());
 
-        EXPECT_FALSE(parser_read_file("ID 1234\n"
+        EXPECT_FALSE(parse_id_content("ID 1234\n"
                                       "SEAT -0x1")
                          .has_value());
 
-        EXPECT_FALSE(parser_read_file("ID 1234\n"
+        EXPECT_FALSE(parse_id_content("ID 1234\n"
                                       "SEAT 0x56 78")
                          .has_value());
 
-        EXPECT_FALSE(parser_read_file("ID 1234\n"
+        EXPECT_FALSE(parse_id_content("ID 1234\n"
                                       "SEAT 0x5678 ")
                          .has_value());
 
-        EXPECT_FALSE(parser_read_file("ID 1234\n"
+        EXPECT_FALSE(parse_id_content("ID 1234\n"
                                       "SEAT 0x567z")
                          .has_value());
 
-        EXPECT_FALSE(parser_read_file("ID 1234\n"
+        EXPECT_FALSE(parse_id_content("ID 1234\n"
                                       "SEAT 0x567 z")
                          .has_value());
     }
+
+    TEST_F(MassStorageDeviceIdSourceTest, ExistingMountsIdentifiedInMountOrder)
+    {
+        constexpr std::size_t NUM_MOUNTS = PARALLELISM + 2;
+
+        create_mounts(NUM_MOUNTS);
+        mount(0).make_fifo();
+        for (std::size_t i = 1; i < NUM_MOUNTS; i++) {
+            mount(i).write_user_id_file(user_id_content(i));
+        }
+
+        source().enable();
+
+        // All later mounts are read while the first is held in flight, their users are held back.
+        ASSERT_TRUE(run_until([&] { return statistic("file.reads") == NUM_MOUNTS - 1; }));
+        EXPECT_TRUE(identified_ids().empty());
+
+        mount(0).write_fifo(user_id_content(0));
+
+        ASSERT_TRUE(run_until([&] { return identified_ids().size() == NUM_MOUNTS; }));
+        EXPECT_EQ(user_identification_ids(users_up_to(NUM_MOUNTS)), identified_ids());
+        EXPECT_EQ(NUM_MOUNTS, statistic("mount_scan.mounts"));
+        EXPECT_GT(statistic("mount_scan.duration_us"), 0U);
+    }
+
+    TEST_F(MassStorageDeviceIdSourceTest, AtMostMountScanParallelismReadsInFlight)
+    {
+        constexpr std::size_t NUM_MOUNTS = PARALLELISM + 2;
+
+        create_mounts(NUM_MOUNTS);
+        for (std::size_t i = 0; i < NUM_MOUNTS; i++) {
+            mount(i).make_fifo();
+        }
+
+        source().enable();
+
+        ASSERT_TRUE(run_until([&] {
+            for (std::size_t i = 0; i < PARALLELISM; i++) {
+                if (!mount(i).fifo_read_started()) {
+                    return false;
+                }
+            }
+            return true;
+        }));
+
+        // Give the source a chance to start more reads than allowed.
+        run_for(std::chrono::milliseconds(100));
+        EXPECT_FALSE(mount(PARALLELISM).fifo_read_started());
+
+        // One more read is started for each read that ends.
+        mount(0).write_fifo(user_id_content(0));
+        ASSERT_TRUE(run_until([&] { return mount(PARALLELISM).fifo_read_started(); }));
+        EXPECT_FALSE(mount(PARALLELISM + 1).fifo_read_started());
+
+        for (std::size_t i = 1; i < NUM_MOUNTS; i++) {
+            ASSERT_TRUE(run_until([&] { return mount(i).fifo_read_started(); }));
+            mount(i).write_fifo(user_id_content(i));
+        }
+
+        ASSERT_TRUE(run_until([&] { return identified_ids().size() == NUM_MOUNTS; }));
+        EXPECT_EQ(user_identification_ids(users_up_to(NUM_MOUNTS)), identified_ids());
+    }
+
+    TEST_F(MassStorageDeviceIdSourceTest, MountRemovedBeforeItsTurnSkipped)
+    {
+        constexpr std::size_t NUM_MOUNTS = PARALLELISM + 2;
+        constexpr std::size_t REMOVED = PARALLELISM;
+
+        create_mounts(NUM_MOUNTS);
+        for (std::size_t i = 0; i < NUM_MOUNTS; i++) {
+            if (i < PARALLELISM) {
+                mount(i).make_fifo();
+            } else {
+                mount(i).write_user_id_file(user_id_content(i));
+            }
+        }
+
+        source().enable();
+
+        ASSERT_TRUE(run_until([&] { return mount(PARALLELISM - 1).fifo_read_started(); }));
+        mount_watcher().remove(mount(REMOVED).root());
+
+        for (std::size_t i = 0; i < PARALLELISM; i++) {
+            ASSERT_TRUE(run_until([&] { return mount(i).fifo_read_started(); }));
+            mount(i).write_fifo(user_id_content(i));
+        }
+
+        ASSERT_TRUE(run_until([&] { return statistic("mount_scan.mounts") == NUM_MOUNTS; }));
+
+        std::vector<std::size_t> users = users_up_to(NUM_MOUNTS);
+        users.erase(users.begin() + REMOVED);
+
+        EXPECT_EQ(user_identification_ids(users), identified_ids());
+        EXPECT_EQ(NUM_MOUNTS - 1, statistic("file.reads"));
+    }
+
+    TEST_F(MassStorageDeviceIdSourceTest, MountAddedAgainDuringScanKeepsItsPlace)
+    {
+        constexpr std::size_t NUM_MOUNTS = PARALLELISM + 2;
+
+        create_mounts(NUM_MOUNTS);
+        for (std::size_t i = 0; i < NUM_MOUNTS; i++) {
+            mount(i).write_user_id_file(user_id_content(i));
+        }
+
+        source().enable();
+
+        // Reported while its read in the scan is in flight, and before the scan got to it.
+        mount_watcher().add(mount(1).root());
+        mount_watcher().add(mount(NUM_MOUNTS - 1).root());
+
+        ASSERT_TRUE(run_until([&] { return statistic("mount_scan.mounts") == NUM_MOUNTS; }));
+        run_for(std::chrono::milliseconds(100));
+
+        EXPECT_EQ(user_identification_ids(users_up_to(NUM_MOUNTS)), identified_ids());
+        EXPECT_EQ(NUM_MOUNTS, statistic("file.reads"));
+    }
+
+    TEST_F(MassStorageDeviceIdSourceTest, MountWithoutFileSkipped)
+    {
+        create_mounts(3);
+        mount(0).write_user_id_file(user_id_content(0));
+        mount(2).write_user_id_file(user_id_content(2));
+
+        source().enable();
+
+        ASSERT_TRUE(run_until([&] { return statistic("mount_scan.mounts") == 3; }));
+        EXPECT_EQ(user_identification_ids({0, 2}), identified_ids());
+    }
+
+    TEST_F(MassStorageDeviceIdSourceTest, ReadEndsAfterSecondLine)
+    {
+        create_mounts(1);
+        mount(0).make_fifo();
+
+        source().enable();
+
+        ASSERT_TRUE(run_until([&] { return mount(0).fifo_read_started(); }));
+        mount(0).write_fifo(user_id_content(0) + "More lines", false);
+
+        ASSERT_TRUE(run_until([&] { return identified_ids().size() == 1; }));
+        EXPECT_EQ(user_identification_ids({0}), identified_ids());
+    }
+
+    TEST_F(MassStorageDeviceIdSourceTest, TooLongFirstLinesRejected)
+    {
+        Common::ScopedSilentLogHandler log_handler;
+
+        create_mounts(2);
+        mount(0).write_user_id_file(
+            "ID " + std::string(MassStorageDeviceIdSource::MAX_READ_SIZE, '1') + "\nSEAT 0x0\n");
+        mount(1).write_user_id_file(user_id_content(1) +
+                                    std::string(MassStorageDeviceIdSource::MAX_READ_SIZE, 'x'));
+
+        source().enable();
+
+        ASSERT_TRUE(run_until([&] { return statistic("mount_scan.mounts") == 2; }));
+        EXPECT_EQ(user_identification_ids({1}), identified_ids());
+        EXPECT_EQ(2U, statistic("file.reads"));
+    }
+
+    TEST_F(MassStorageDeviceIdSourceTest, UnchangedFileNotReadAgain)
+    {
+        create_mounts(1);
+        mount(0).write_user_id_file(user_id_content(0));
+
+        source().enable();
+
+        ASSERT_TRUE(run_until([&] { return identified_ids().size() == 1; }));
+
+        mount(0).rewrite_user_id_file(user_id_content(0));
+
+        ASSERT_TRUE(run_until([&] { return statistic("file.unchanged_skipped") == 1; }));
+        EXPECT_EQ(user_identification_ids({0}), identified_ids());
+        EXPECT_EQ(1U, statistic("file.reads"));
+
+        mount(0).write_user_id_file(user_id_content(1));
+
+        ASSERT_TRUE(run_until([&] { return identified_ids().size() == 2; }));
+        EXPECT_EQ(user_identification_ids({0, 1}), identified_ids());
+        EXPECT_EQ(2U, statistic("file.reads"));
+        EXPECT_EQ(1U, statistic("file.unchanged_skipped"));
+    }
+
+    TEST_F(MassStorageDeviceIdSourceTest, ChangesWithinWindowCoalesced)
+    {
+        create_mounts(1);
+        mount(0).write_user_id_file(user_id_content(0));
+
+        source().enable();
+
+        ASSERT_TRUE(run_until([&] { return identified_ids().size() == 1; }));
+
+        // All changes are reported when the main loop runs again, well within the window.
+        mount(0).write_user_id_file(user_id_content(1));
+        mount(0).write_user_id_file(user_id_content(2));
+        mount(0).write_user_id_file(user_id_content(3));
+
+        ASSERT_TRUE(run_until([&] { return statistic("file.reads") == 2; }));
+        run_for(MassStorageDeviceIdSource::CHANGE_COALESCE_WINDOW * 2);
+
+        EXPECT_EQ(user_identification_ids({0, 3}), identified_ids());
+        EXPECT_EQ(2U, statistic("file.reads"));
+        EXPECT_GE(statistic("file.changes_coalesced"), 2U);
+    }
+
+    TEST_F(MassStorageDeviceIdSourceTest, FileForgottenWhenUnmounted)
+    {
+        create_mounts(1);
+        mount(0).write_user_id_file(user_id_content(0));
+
+        source().enable();
+
+        ASSERT_TRUE(run_until([&] { return identified_ids().size() == 1; }));
+
+        // Neither monitored nor read while unmounted, but read again when mounted.
+        mount_watcher().remove(mount(0).root());
+        mount(0).write_user_id_file(user_id_content(1));
+        run_for(MassStorageDeviceIdSource::CHANGE_COALESCE_WINDOW * 2);
+
+        EXPECT_EQ(user_identification_ids({0}), identified_ids());
+        EXPECT_EQ(1U, statistic("file.reads"));
+
+        mount_watcher().add(mount(0).root());
+
+        ASSERT_TRUE(run_until([&] { return identified_ids().size() == 2; }));
+        EXPECT_EQ(user_identification_ids({0, 1}), identified_ids());
+        EXPECT_EQ(2U, statistic("file.reads"));
+
+        // The file is monitored again, with the key of the new read.
+        mount(0).rewrite_user_id_file(user_id_content(1));
+
+        ASSERT_TRUE(run_until([&] { return statistic("file.unchanged_skipped") == 1; }));
+        EXPECT_EQ(2U, statistic("file.reads"));
+        EXPECT_EQ(0U, statistic("file.changes_coalesced"));
+    }
+
+    TEST_F(MassStorageDeviceIdSourceTest, CancelledReadIgnored)
+    {
+        create_mounts(1);
+        mount(0).make_fifo();
+
+        source().enable();
+
+        ASSERT_TRUE(run_until([&] { return mount(0).fifo_read_started(); }));
+        mount_watcher().remove(mount(0).root());
+
+        // The read is cancelled, its late result is not used.
+        mount(0).write_fifo(user_id_content(0));
+        run_for(std::chrono::milliseconds(100));
+
+        EXPECT_TRUE(identified_ids().empty());
+        EXPECT_EQ(0U, statistic("file.reads"));
+        EXPECT_EQ(1U, statistic("mount_scan.mounts"));
+    }
+
+    TEST_F(MassStorageDeviceIdSourceTest, ReadTimedOut)
+    {
+        Common::ScopedSilentLogHandler log_handler;
+
+        create_mounts(2);
+        mount(0).make_fifo();
+        mount(1).write_user_id_file(user_id_content(1));
+
+        source().enable();
+
+        // The FIFO is never written, the scan goes on when its read is cancelled.
+        ASSERT_TRUE(run_until([&] { return statistic("mount_scan.mounts") == 2; },
+                              MassStorageDeviceIdSource::READ_TIMEOUT * 2));
+        EXPECT_EQ(user_identification_ids({1}), identified_ids());
+        EXPECT_EQ(1U, statistic("file.reads"));
+    }
 }
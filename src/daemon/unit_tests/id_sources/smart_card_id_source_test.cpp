@@ -0,0 +1,295 @@
+// Copyright (C) 2019 Luxoft Sweden AB
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+//
+// SPDX-License-Identifier: MPL-2.0
+
+#include "daemon/id_sources/smart_card_id_source.h"
+
+#include <glibmm.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "common/scoped_silent_log_handler.h"
+#include "daemon/id_source.h"
+#include "daemon/pcsc_context.h"
+#include "daemon/unit_tests/fake_pcsc_backend.h"
+
+namespace
+{
+    // Counts allocations in all threads while set.
+    std::atomic<bool> counting_allocations{false};
+    std::atomic<std::size_t> num_counted_allocations{0};
+}
+
+void *operator new(std::size_t size)
+{
+    if (counting_allocations.load()) {
+        num_counted_allocations++;
+    }
+
+    void *memory = std::malloc(size == 0 ? 1 : size); // NOLINT(cppcoreguidelines-no-malloc)
+
+    if (!memory) {
+        throw std::bad_alloc();
+    }
+
+    return memory;
+}
+
+void operator delete(void *memory) noexcept
+{
+    std::free(memory); // NOLINT(cppcoreguidelines-no-malloc)
+}
+
+void operator delete(void *memory, std::size_t /*size*/) noexcept
+{
+    std::free(memory); // NOLINT(cppcoreguidelines-no-malloc)
+}
+
+namespace UserIdentificationManager::Daemon
+{
+    namespace
+    {
+        const std::vector<std::uint8_t> MIFARE_CLASSIC_1K_ATR = {
+            0x3b, 0x8f, 0x80, 0x01, 0x80, 0x4f, 0x0c, 0xa0, 0x00, 0x00,
+            0x03, 0x06, 0x03, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x6a};
+        // Suggests reading the NDEF message, see Atr::classify().
+        const std::vector<std::uint8_t> CARD_EMULATION_ATR = {0x3b, 0x80, 0x80, 0x01, 0x01};
+
+        std::uint64_t statistic(const Statistics &statistics, const std::string &name)
+        {
+            for (const auto &[statistic_name, value] : statistics) {
+                if (statistic_name == name) {
+                    return value;
+                }
+            }
+
+            ADD_FAILURE() << "No statistic named " << name;
+
+            return 0;
+        }
+
+        std::string reader_name(unsigned int reader)
+        {
+            return "Reader " + std::to_string(reader);
+        }
+
+        std::vector<std::uint8_t> uid(unsigned int reader, unsigned int tap)
+        {
+            return {std::uint8_t(reader), 0x00, std::uint8_t(tap >> 8), std::uint8_t(tap)};
+        }
+
+        std::string user_identification_id(unsigned int reader, unsigned int tap)
+        {
+            constexpr char HEX_DIGITS[] = "0123456789abcdef";
+            std::string id = "SCARD-";
+
+            for (std::uint8_t byte : uid(reader, tap)) {
+                id += HEX_DIGITS[byte >> 4];
+                id += HEX_DIGITS[byte & 0x0f];
+            }
+
+            return id;
+        }
+
+        // Stops counting allocations when a user is identified, what happens after that, e.g. in
+        // IdSource::Group, is not part of identifying a card.
+        class CountingStopListener : public IdSource::Listener
+        {
+        public:
+            explicit CountingStopListener(Glib::RefPtr<Glib::MainLoop> main_loop) :
+                main_loop_(std::move(main_loop))
+            {
+            }
+
+            void user_identified(const IdSource::IdentifiedUser &identified_user) override
+            {
+                counting_allocations = false;
+
+                identified_ids.emplace_back(identified_user.user_identification_id.view());
+                main_loop_->quit();
+            }
+
+            std::vector<std::string> identified_ids;
+
+        private:
+            Glib::RefPtr<Glib::MainLoop> main_loop_;
+        };
+    }
+
+    TEST(SmartCardIdSource, CardIdentifiedWithoutAllocatingMemory)
+    {
+        Common::ScopedSilentLogHandler log_handler;
+        FakePCSCBackend backend;
+
+        backend.add_reader(reader_name(0));
+
+        PCSCContext pcsc_context(backend);
+        SmartCardIdSource source(pcsc_context);
+        Glib::RefPtr<Glib::MainLoop> main_loop = Glib::MainLoop::create();
+        CountingStopListener listener(main_loop);
+
+        source.set_listener(&listener);
+        source.enable();
+
+        // First tap interns the reader, sets up its context, memoizes the UID strategy and
+        // caches the connection.
+        ASSERT_TRUE(backend.wait_until_waiting_for_card(reader_name(0)));
+        backend.insert_card(reader_name(0), MIFARE_CLASSIC_1K_ATR, uid(0, 0));
+        main_loop->run();
+        ASSERT_TRUE(backend.wait_until_card_read(reader_name(0)));
+        backend.remove_card(reader_name(0));
+
+        // Count from when pcsc-lite reports the second card until the listener is called.
+        ASSERT_TRUE(backend.wait_until_waiting_for_card(reader_name(0)));
+        backend.set_status_change_hook([] { counting_allocations = true; });
+        backend.insert_card(reader_name(0), MIFARE_CLASSIC_1K_ATR, uid(0, 1));
+        main_loop->run();
+        backend.set_status_change_hook({});
+
+        EXPECT_EQ(0U, num_counted_allocations.load());
+        EXPECT_EQ(std::vector<std::string>(
+                      {user_identification_id(0, 0), user_identification_id(0, 1)}),
+                  listener.identified_ids);
+
+        source.disable();
+    }
+
+    TEST(SmartCardIdSource, UsersIdentifiedWhenCardsTappedOnManyReaders)
+    {
+        constexpr unsigned int NUM_READERS = 4;
+        constexpr unsigned int TAPS_PER_READER = 100;
+        constexpr unsigned int NUM_TAPS = NUM_READERS * TAPS_PER_READER;
+
+        Common::ScopedSilentLogHandler log_handler;
+        FakePCSCBackend backend;
+
+        for (unsigned int reader = 0; reader < NUM_READERS; reader++) {
+            backend.add_reader(reader_name(reader));
+        }
+
+        PCSCContext pcsc_context(backend);
+        IdSource::Group::Sources sources;
+        sources.emplace_back(std::make_unique<SmartCardIdSource>(pcsc_context));
+        IdSource::Group group(std::move(sources));
+
+        Glib::RefPtr<Glib::MainLoop> main_loop = Glib::MainLoop::create();
+        std::set<std::string> identified_ids;
+        unsigned int num_identified = 0;
+
+        group.user_identified_signal().connect([&](const IdSource::IdentifiedUser &user) {
+            identified_ids.emplace(user.user_identification_id.view());
+            num_identified++;
+        });
+        group.enable_all();
+
+        std::atomic<unsigned int> num_readers_done{0};
+        std::vector<std::thread> tap_threads;
+
+        for (unsigned int reader = 0; reader < NUM_READERS; reader++) {
+            tap_threads.emplace_back([&, reader] {
+                for (unsigned int tap = 0; tap < TAPS_PER_READER; tap++) {
+                    if (!backend.wait_until_waiting_for_card(reader_name(reader))) {
+                        break;
+                    }
+                    backend.insert_card(
+                        reader_name(reader), MIFARE_CLASSIC_1K_ATR, uid(reader, tap));
+                    if (!backend.wait_until_card_read(reader_name(reader))) {
+                        break;
+                    }
+                    backend.remove_card(reader_name(reader));
+                }
+
+                num_readers_done++;
+            });
+        }
+
+        auto all_taps_accounted_for = [&] {
+            Statistics statistics = group.statistics();
+
+            return num_readers_done == NUM_READERS &&
+                   num_identified + statistic(statistics, "SCARD.uid_queue.dropped") >= NUM_TAPS;
+        };
+        auto start = std::chrono::steady_clock::now();
+
+        Glib::signal_timeout().connect(
+            [&] {
+                if (all_taps_accounted_for() ||
+                    std::chrono::steady_clock::now() - start > std::chrono::seconds(30)) {
+                    main_loop->quit();
+                    return false;
+                }
+                return true;
+            },
+            10);
+
+        main_loop->run();
+
+        for (std::thread &tap_thread : tap_threads) {
+            tap_thread.join();
+        }
+
+        Statistics statistics = group.statistics();
+
+        // Every tap is delivered, also when several are waiting for the main loop.
+        EXPECT_EQ(0U, statistic(statistics, "SCARD.uid_queue.dropped"));
+        EXPECT_EQ(NUM_TAPS, num_identified);
+        EXPECT_EQ(NUM_TAPS, identified_ids.size());
+
+        for (unsigned int reader = 0; reader < NUM_READERS; reader++) {
+            for (unsigned int tap = 0; tap < TAPS_PER_READER; tap++) {
+                EXPECT_EQ(1U, identified_ids.count(user_identification_id(reader, tap)));
+            }
+        }
+
+        group.disable_all();
+    }
+
+    TEST(SmartCardIdSource, NdefMessageIdsNeverCollideWithUIDs)
+    {
+        FakePCSCBackend backend;
+
+        backend.add_reader(reader_name(0));
+
+        PCSCContext pcsc_context(backend);
+        SmartCardIdSource source(pcsc_context);
+        Glib::RefPtr<Glib::MainLoop> main_loop = Glib::MainLoop::create();
+        CountingStopListener listener(main_loop);
+
+        source.set_listener(&listener);
+        source.enable();
+
+        ASSERT_TRUE(backend.wait_until_waiting_for_card(reader_name(0)));
+        backend.insert_card(reader_name(0), MIFARE_CLASSIC_1K_ATR, uid(0, 0));
+        main_loop->run();
+        ASSERT_TRUE(backend.wait_until_card_read(reader_name(0)));
+        backend.remove_card(reader_name(0));
+
+        // A phone or writable tag with the UID of the card as NDEF message.
+        ASSERT_TRUE(backend.wait_until_waiting_for_card(reader_name(0)));
+        backend.insert_card(reader_name(0), CARD_EMULATION_ATR, uid(0, 1), uid(0, 0));
+        main_loop->run();
+
+        std::string card_id = user_identification_id(0, 0);
+        std::string ndef_message_id = "SCARD-NDEF-" + card_id.substr(card_id.find('-') + 1);
+
+        EXPECT_EQ(std::vector<std::string>({card_id, ndef_message_id}), listener.identified_ids);
+
+        source.disable();
+    }
+}
@@ -11,7 +11,10 @@
 #include <glibmm.h>
 #include <gtest/gtest.h>
 
+#include <chrono>
+#include <set>
 #include <thread>
+#include <utility>
 #include <vector>
 
 namespace UserIdentificationManager::Daemon
@@ -63,4 +66,250 @@ namespace UserIdentificationManager::Daemon
         EXPECT_EQ(std::this_thread::get_id(), callback_thread_id);
         EXPECT_NE(std::this_thread::get_id(), push_thread_id);
     }
+
+    TEST(IdleQueue, BatchCallbackCalledOnceWithAllPushedValues)
+    {
+        Glib::RefPtr<Glib::MainLoop> main_loop = Glib::MainLoop::create();
+        IdleQueue<int> idle_queue;
+        std::vector<std::vector<int>> batches;
+
+        idle_queue.set_batch_callback([&](IdleQueue<int>::Batch batch) {
+            batches.emplace_back(batch.begin(), batch.end());
+            main_loop->quit();
+        });
+
+        idle_queue.push(1);
+        idle_queue.push(2);
+        idle_queue.push(3);
+
+        main_loop->run();
+
+        EXPECT_EQ(std::vector<std::vector<int>>({{1, 2, 3}}), batches);
+    }
+
+    TEST(IdleQueue, BatchBuffersReused)
+    {
+        constexpr unsigned int NUM_BATCHES = 10;
+        Glib::RefPtr<Glib::MainLoop> main_loop = Glib::MainLoop::create();
+        IdleQueue<int> idle_queue;
+        std::set<const int *> buffers;
+        unsigned int num_batches = 0;
+
+        idle_queue.set_batch_callback([&](IdleQueue<int>::Batch batch) {
+            buffers.insert(batch.begin());
+
+            if (++num_batches == NUM_BATCHES) {
+                main_loop->quit();
+            } else {
+                idle_queue.push(int(num_batches));
+                idle_queue.push(int(num_batches));
+            }
+        });
+
+        idle_queue.push(0);
+
+        main_loop->run();
+
+        EXPECT_LE(buffers.size(), 2U);
+    }
+
+    TEST(IdleQueue, PushFailsWhenFull)
+    {
+        Glib::RefPtr<Glib::MainLoop> main_loop = Glib::MainLoop::create();
+        IdleQueue<int> idle_queue(2);
+        std::vector<int> popped_values;
+
+        idle_queue.set_callback([&](int i) {
+            popped_values.emplace_back(i);
+
+            if (popped_values.size() == 2) {
+                main_loop->quit();
+            }
+        });
+
+        EXPECT_TRUE(idle_queue.push(1));
+        EXPECT_TRUE(idle_queue.push(2));
+        EXPECT_FALSE(idle_queue.push(3));
+
+        main_loop->run();
+
+        EXPECT_EQ(std::vector<int>({1, 2}), popped_values);
+
+        EXPECT_TRUE(idle_queue.push(4));
+    }
+
+    TEST(IdleQueue, DropNewestCountsDropped)
+    {
+        using Queue = IdleQueue<int>;
+
+        Queue idle_queue(2, G_PRIORITY_DEFAULT, Queue::OverflowPolicy::DROP_NEWEST);
+
+        EXPECT_TRUE(idle_queue.push(1));
+        EXPECT_TRUE(idle_queue.push(2));
+        EXPECT_FALSE(idle_queue.push(3));
+        EXPECT_FALSE(idle_queue.push(4));
+
+        EXPECT_EQ(2U, idle_queue.dropped_count());
+        EXPECT_EQ(0U, idle_queue.coalesced_count());
+    }
+
+    TEST(IdleQueue, DropOldest)
+    {
+        using Queue = IdleQueue<int>;
+
+        Glib::RefPtr<Glib::MainLoop> main_loop = Glib::MainLoop::create();
+        Queue idle_queue(2, G_PRIORITY_DEFAULT, Queue::OverflowPolicy::DROP_OLDEST);
+        std::vector<int> popped_values;
+
+        idle_queue.set_batch_callback([&](Queue::Batch batch) {
+            popped_values.assign(batch.begin(), batch.end());
+            main_loop->quit();
+        });
+
+        EXPECT_TRUE(idle_queue.push(1));
+        EXPECT_TRUE(idle_queue.push(2));
+        EXPECT_TRUE(idle_queue.push(3));
+        EXPECT_TRUE(idle_queue.push(4));
+
+        main_loop->run();
+
+        EXPECT_EQ(std::vector<int>({3, 4}), popped_values);
+        EXPECT_EQ(2U, idle_queue.dropped_count());
+    }
+
+    TEST(IdleQueue, CoalesceByKey)
+    {
+        using KeyValue = std::pair<int, char>;
+        using Queue = IdleQueue<KeyValue>;
+
+        Glib::RefPtr<Glib::MainLoop> main_loop = Glib::MainLoop::create();
+        Queue idle_queue(3,
+                         G_PRIORITY_DEFAULT,
+                         Queue::OverflowPolicy::COALESCE_BY_KEY,
+                         [](const KeyValue &a, const KeyValue &b) { return a.first == b.first; });
+        std::vector<KeyValue> popped_values;
+
+        idle_queue.set_batch_callback([&](Queue::Batch batch) {
+            popped_values.assign(batch.begin(), batch.end());
+            main_loop->quit();
+        });
+
+        // Not coalesced while there is room.
+        EXPECT_TRUE(idle_queue.push({1, 'a'}));
+        EXPECT_TRUE(idle_queue.push({2, 'b'}));
+        EXPECT_TRUE(idle_queue.push({1, 'c'}));
+        EXPECT_EQ(0U, idle_queue.coalesced_count());
+
+        EXPECT_TRUE(idle_queue.push({2, 'd'}));
+        EXPECT_EQ(1U, idle_queue.coalesced_count());
+
+        // No value with the same key, oldest dropped.
+        EXPECT_TRUE(idle_queue.push({3, 'e'}));
+        EXPECT_EQ(1U, idle_queue.dropped_count());
+
+        main_loop->run();
+
+        EXPECT_EQ(std::vector<KeyValue>({{2, 'd'}, {1, 'c'}, {3, 'e'}}), popped_values);
+        EXPECT_EQ(1U, idle_queue.coalesced_count());
+        EXPECT_EQ(1U, idle_queue.dropped_count());
+    }
+
+    TEST(IdleQueue, ManyProducerThreads)
+    {
+        constexpr unsigned int NUM_PRODUCERS = 16;
+        constexpr unsigned int VALUES_PER_PRODUCER = 5000;
+        Glib::RefPtr<Glib::MainLoop> main_loop = Glib::MainLoop::create();
+        IdleQueue<unsigned int> idle_queue(64);
+        std::vector<std::thread> producers;
+        std::vector<unsigned int> next_expected(NUM_PRODUCERS, 0);
+        unsigned int num_popped = 0;
+        bool in_order = true;
+
+        idle_queue.set_callback([&](unsigned int value) {
+            unsigned int producer = value / VALUES_PER_PRODUCER;
+
+            if (next_expected[producer] != value % VALUES_PER_PRODUCER) {
+                in_order = false;
+            }
+
+            next_expected[producer] = value % VALUES_PER_PRODUCER + 1;
+
+            if (++num_popped == NUM_PRODUCERS * VALUES_PER_PRODUCER) {
+                main_loop->quit();
+            }
+        });
+
+        for (unsigned int p = 0; p < NUM_PRODUCERS; p++) {
+            producers.emplace_back([&idle_queue, p] {
+                for (unsigned int i = 0; i < VALUES_PER_PRODUCER; i++) {
+                    unsigned int value = p * VALUES_PER_PRODUCER + i;
+
+                    while (!idle_queue.push(std::move(value))) {
+                        std::this_thread::yield();
+                    }
+                }
+            });
+        }
+
+        main_loop->run();
+
+        for (std::thread &producer : producers) {
+            producer.join();
+        }
+
+        EXPECT_EQ(NUM_PRODUCERS * VALUES_PER_PRODUCER, num_popped);
+        EXPECT_TRUE(in_order);
+    }
+
+    TEST(IdleQueue, DispatchedWhileMainLoopBusy)
+    {
+        constexpr unsigned int NUM_VALUES = 50;
+        constexpr unsigned int TIMEOUT_MS = 10000;
+
+        Glib::RefPtr<Glib::MainLoop> main_loop = Glib::MainLoop::create();
+        IdleQueue<unsigned int> idle_queue;
+        std::vector<unsigned int> popped;
+
+        idle_queue.set_callback([&](unsigned int value) {
+            popped.emplace_back(value);
+
+            if (popped.size() == NUM_VALUES) {
+                main_loop->quit();
+            }
+        });
+
+        // Simulate a main loop that always has something to do at default priority, e.g. steady
+        // D-Bus traffic. An idle source would never be dispatched.
+        auto busy_function = [](void * /*unused*/) -> gboolean {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            return G_SOURCE_CONTINUE;
+        };
+        guint busy_source_id = g_idle_add_full(G_PRIORITY_DEFAULT, busy_function, nullptr, nullptr);
+
+        auto timeout_function = [](void *loop) -> gboolean {
+            static_cast<Glib::MainLoop *>(loop)->quit();
+            return G_SOURCE_REMOVE;
+        };
+        guint timeout_source_id = g_timeout_add(TIMEOUT_MS, timeout_function, main_loop.get());
+
+        std::thread thread([&] {
+            for (unsigned int i = 0; i < NUM_VALUES; i++) {
+                unsigned int value = i;
+
+                idle_queue.push(std::move(value));
+                std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            }
+        });
+
+        main_loop->run();
+
+        thread.join();
+        g_source_remove(busy_source_id);
+        if (popped.size() == NUM_VALUES) {
+            g_source_remove(timeout_source_id);
+        }
+
+        // Not dispatched at all before the timeout if starved by the busy source.
+        ASSERT_EQ(NUM_VALUES, popped.size());
+    }
 }
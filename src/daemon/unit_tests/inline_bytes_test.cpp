@@ -0,0 +1,79 @@
+// Copyright (C) 2019 Luxoft Sweden AB
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+//
+// SPDX-License-Identifier: MPL-2.0
+
+#include "daemon/inline_bytes.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace UserIdentificationManager::Daemon
+{
+    namespace
+    {
+        using Bytes = InlineBytes<4>;
+
+        std::vector<std::uint8_t> to_vector(const Bytes &bytes)
+        {
+            return {bytes.begin(), bytes.end()};
+        }
+    }
+
+    TEST(InlineBytes, EmptyByDefault)
+    {
+        Bytes bytes;
+
+        EXPECT_TRUE(bytes.empty());
+        EXPECT_EQ(0U, bytes.size());
+        EXPECT_EQ(bytes.begin(), bytes.end());
+    }
+
+    TEST(InlineBytes, AssignUpToCapacity)
+    {
+        const std::uint8_t data[] = {0x01, 0x02, 0x03, 0x04};
+        Bytes bytes;
+
+        EXPECT_TRUE(bytes.assign(data, 2));
+        EXPECT_EQ(std::vector<std::uint8_t>({0x01, 0x02}), to_vector(bytes));
+
+        EXPECT_TRUE(bytes.assign(data, 4));
+        EXPECT_EQ(std::vector<std::uint8_t>({0x01, 0x02, 0x03, 0x04}), to_vector(bytes));
+    }
+
+    TEST(InlineBytes, AssignBeyondCapacityRefused)
+    {
+        const std::uint8_t data[] = {0x01, 0x02, 0x03, 0x04, 0x05};
+        Bytes bytes = {0xaa};
+
+        EXPECT_FALSE(bytes.assign(data, 5));
+        EXPECT_EQ(std::vector<std::uint8_t>({0xaa}), to_vector(bytes));
+    }
+
+    TEST(InlineBytes, ResizeClampedToCapacity)
+    {
+        Bytes bytes;
+
+        bytes.data()[0] = 0x01;
+        bytes.data()[1] = 0x02;
+        bytes.resize(2);
+        EXPECT_EQ(std::vector<std::uint8_t>({0x01, 0x02}), to_vector(bytes));
+
+        bytes.resize(100);
+        EXPECT_EQ(4U, bytes.size());
+    }
+
+    TEST(InlineBytes, ComparedByContent)
+    {
+        EXPECT_EQ(Bytes({0x01, 0x02}), Bytes({0x01, 0x02}));
+        EXPECT_NE(Bytes({0x01, 0x02}), Bytes({0x01, 0x02, 0x00}));
+        EXPECT_LT(Bytes({0x01, 0x02}), Bytes({0x01, 0x03}));
+        EXPECT_LT(Bytes({0x01}), Bytes({0x01, 0x00}));
+        EXPECT_FALSE(Bytes({0x01}) < Bytes({0x01}));
+    }
+}
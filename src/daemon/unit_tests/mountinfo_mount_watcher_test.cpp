@@ -0,0 +1,254 @@
+// Copyright (C) 2019 Luxoft Sweden AB
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+//
+// SPDX-License-Identifier: MPL-2.0
+
+#include "daemon/mountinfo_mount_watcher.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "common/scoped_silent_log_handler.h"
+#include "common/scoped_temp_file.h"
+
+namespace UserIdentificationManager::Daemon
+{
+    namespace
+    {
+        const std::string ROOT_LINE = "22 1 8:2 / / rw,relatime shared:1 - ext4 /dev/sda2 rw\n";
+        const std::string BOOT_LINE =
+            "24 22 8:1 / /boot rw,relatime shared:2 - ext4 /dev/sda1 rw\n";
+        const std::string PROC_LINE = "23 22 0:21 / /proc rw,nosuid shared:12 - proc proc rw\n";
+        const std::string USB_LINE =
+            "40 22 8:17 / /media/usb rw,nosuid shared:30 - vfat /dev/sdb1 rw,fmask=0022\n";
+        const std::string USB_REMOUNTED_LINE =
+            "40 22 8:17 / /media/usb ro,nosuid shared:30 - vfat /dev/sdb1 ro,fmask=0022\n";
+        const std::string USB_MOVED_LINE =
+            "40 22 8:17 / /media/stick rw,nosuid shared:30 - vfat /dev/sdb1 rw,fmask=0022\n";
+        // Same mount ID as USB_LINE, which was unmounted, for another device.
+        const std::string USB_REPLACED_LINE =
+            "40 22 8:33 / /media/usb rw,nosuid shared:30 - vfat /dev/sdc1 rw,fmask=0022\n";
+        const std::string SD_LINE =
+            "41 22 179:1 / /media/sd\\040card rw,nosuid - ext4 /dev/mmcblk0p1 rw\n";
+
+        class MountinfoMountWatcherTest : public testing::Test
+        {
+        public:
+            using Roots = std::vector<std::string>;
+
+            void write(const std::string &contents)
+            {
+                std::ofstream(file_.path(), std::ios::trunc) << contents;
+            }
+
+            void watch()
+            {
+                watcher_ = std::make_unique<MountinfoMountWatcher>(file_.path());
+
+                watcher_->signal_mount_added().connect(
+                    [this](const std::string &root) { added_.emplace_back(root); });
+                watcher_->signal_mount_removed().connect(
+                    [this](const std::string &root) { removed_.emplace_back(root); });
+            }
+
+            MountinfoMountWatcher &watcher()
+            {
+                return *watcher_;
+            }
+
+            const Roots &added() const
+            {
+                return added_;
+            }
+
+            const Roots &removed() const
+            {
+                return removed_;
+            }
+
+        private:
+            Common::ScopedTempFile file_{ROOT_LINE + PROC_LINE};
+            std::unique_ptr<MountinfoMountWatcher> watcher_;
+            Roots added_;
+            Roots removed_;
+        };
+    }
+
+    TEST(MountinfoMountWatcherParser, Line)
+    {
+        auto mount = MountinfoMountWatcher::Parser::parse_line(
+            "40 22 8:17 / /media/usb rw,nosuid shared:30 master:2 - vfat /dev/sdb1 rw");
+        ASSERT_TRUE(mount.has_value());
+        EXPECT_EQ(40u, mount->id);
+        EXPECT_EQ("8:17", mount->device);
+        EXPECT_EQ("/dev/sdb1", mount->source);
+        EXPECT_EQ("/media/usb", mount->mount_point);
+        EXPECT_TRUE(mount->user_visible);
+
+        mount = MountinfoMountWatcher::Parser::parse_line(
+            "23 22 0:21 / /proc rw,nosuid - proc proc rw");
+        ASSERT_TRUE(mount.has_value());
+        EXPECT_EQ("/proc", mount->mount_point);
+        EXPECT_FALSE(mount->user_visible);
+
+        mount = MountinfoMountWatcher::Parser::parse_line(
+            "24 22 8:1 / /boot rw,relatime - ext4 /dev/sda1 rw");
+        ASSERT_TRUE(mount.has_value());
+        EXPECT_EQ("/boot", mount->mount_point);
+        EXPECT_FALSE(mount->user_visible);
+
+        mount = MountinfoMountWatcher::Parser::parse_line(
+            "42 22 0:40 / /media/ram rw,relatime - tmpfs tmpfs rw");
+        ASSERT_TRUE(mount.has_value());
+        EXPECT_FALSE(mount->user_visible);
+    }
+
+    TEST(MountinfoMountWatcherParser, UserVisible)
+    {
+        EXPECT_TRUE(MountinfoMountWatcher::Parser::is_user_visible("/media/usb"));
+        EXPECT_TRUE(MountinfoMountWatcher::Parser::is_user_visible("/media/user/usb"));
+        EXPECT_TRUE(MountinfoMountWatcher::Parser::is_user_visible("/run/media/user/usb"));
+        EXPECT_FALSE(MountinfoMountWatcher::Parser::is_user_visible("/"));
+        EXPECT_FALSE(MountinfoMountWatcher::Parser::is_user_visible("/boot"));
+        EXPECT_FALSE(MountinfoMountWatcher::Parser::is_user_visible("/home"));
+        EXPECT_FALSE(MountinfoMountWatcher::Parser::is_user_visible("/media"));
+        EXPECT_FALSE(MountinfoMountWatcher::Parser::is_user_visible("/mediausb"));
+        EXPECT_FALSE(MountinfoMountWatcher::Parser::is_user_visible("/run/mount/usb"));
+        EXPECT_FALSE(MountinfoMountWatcher::Parser::is_user_visible("/media/.hidden/usb"));
+    }
+
+    TEST(MountinfoMountWatcherParser, MalformedLine)
+    {
+        Common::ScopedSilentLogHandler log_handler;
+
+        EXPECT_FALSE(MountinfoMountWatcher::Parser::parse_line("").has_value());
+        EXPECT_FALSE(MountinfoMountWatcher::Parser::parse_line("x 22 8:17 / /media/usb rw - vfat "
+                                                               "/dev/sdb1 rw")
+                         .has_value());
+        EXPECT_FALSE(MountinfoMountWatcher::Parser::parse_line("40 22 8:17 / /media/usb rw vfat "
+                                                               "/dev/sdb1 rw")
+                         .has_value());
+        EXPECT_FALSE(
+            MountinfoMountWatcher::Parser::parse_line("40 22 8:17 / /media/usb rw -").has_value());
+    }
+
+    TEST(MountinfoMountWatcherParser, Unescape)
+    {
+        EXPECT_EQ("/media/sd card", MountinfoMountWatcher::Parser::unescape("/media/sd\\040card"));
+        EXPECT_EQ("a\\b", MountinfoMountWatcher::Parser::unescape("a\\134b"));
+        EXPECT_EQ("a\tb\n", MountinfoMountWatcher::Parser::unescape("a\\011b\\012"));
+        EXPECT_EQ("a\\04", MountinfoMountWatcher::Parser::unescape("a\\04"));
+        EXPECT_EQ("a\\089", MountinfoMountWatcher::Parser::unescape("a\\089"));
+    }
+
+    TEST_F(MountinfoMountWatcherTest, OnlyUserVisibleMountsReported)
+    {
+        write(ROOT_LINE + BOOT_LINE + PROC_LINE + USB_LINE + SD_LINE);
+        watch();
+
+        EXPECT_EQ(Roots({"/media/usb", "/media/sd card"}), watcher().mounts());
+        EXPECT_TRUE(added().empty());
+    }
+
+    TEST_F(MountinfoMountWatcherTest, AddedAndRemoved)
+    {
+        watch();
+
+        write(ROOT_LINE + PROC_LINE + USB_LINE + SD_LINE);
+        watcher().poll();
+        EXPECT_EQ(Roots({"/media/usb", "/media/sd card"}), added());
+        EXPECT_TRUE(removed().empty());
+
+        write(ROOT_LINE + PROC_LINE + SD_LINE);
+        watcher().poll();
+        EXPECT_EQ(Roots({"/media/usb"}), removed());
+        EXPECT_EQ(Roots({"/media/sd card"}), watcher().mounts());
+    }
+
+    TEST_F(MountinfoMountWatcherTest, UnchangedNotReported)
+    {
+        write(ROOT_LINE + PROC_LINE + USB_LINE);
+        watch();
+
+        watcher().poll();
+        write(ROOT_LINE + USB_REMOUNTED_LINE);
+        watcher().poll();
+
+        EXPECT_TRUE(added().empty());
+        EXPECT_TRUE(removed().empty());
+    }
+
+    TEST_F(MountinfoMountWatcherTest, MovedMountRemovedAndAdded)
+    {
+        write(ROOT_LINE + USB_LINE);
+        watch();
+
+        write(ROOT_LINE + USB_MOVED_LINE);
+        watcher().poll();
+
+        EXPECT_EQ(Roots({"/media/usb"}), removed());
+        EXPECT_EQ(Roots({"/media/stick"}), added());
+    }
+
+    TEST_F(MountinfoMountWatcherTest, ReusedIdRemovedAndAdded)
+    {
+        write(ROOT_LINE + USB_LINE);
+        watch();
+
+        write(ROOT_LINE + USB_REPLACED_LINE);
+        watcher().poll();
+
+        EXPECT_EQ(Roots({"/media/usb"}), removed());
+        EXPECT_EQ(Roots({"/media/usb"}), added());
+    }
+
+    TEST(MountinfoMountWatcher, MissingFile)
+    {
+        Common::ScopedSilentLogHandler log_handler;
+        MountinfoMountWatcher watcher("/nonexistent/mountinfo");
+
+        EXPECT_TRUE(watcher.mounts().empty());
+        watcher.poll();
+        EXPECT_TRUE(watcher.mounts().empty());
+    }
+
+    TEST(MountinfoMountWatcher, ReopenedAfterReadError)
+    {
+        Common::ScopedSilentLogHandler log_handler;
+        std::string directory = "/tmp/mountinfo_mount_watcher_test_XXXXXX";
+        ASSERT_NE(nullptr, mkdtemp(directory.data()));
+        std::string path = directory + "/mountinfo";
+
+        // Opening a directory succeeds but reading it fails.
+        ASSERT_EQ(0, mkdir(path.c_str(), 0700));
+        MountinfoMountWatcher watcher(path);
+        std::vector<std::string> added;
+        watcher.signal_mount_added().connect(
+            [&added](const std::string &root) { added.emplace_back(root); });
+
+        ASSERT_EQ(0, rmdir(path.c_str()));
+        std::ofstream(path) << ROOT_LINE + USB_LINE;
+
+        Glib::RefPtr<Glib::MainContext> main_context = Glib::MainContext::get_default();
+
+        while (added.empty()) {
+            main_context->iteration(true);
+        }
+
+        EXPECT_EQ(std::vector<std::string>({"/media/usb"}), added);
+
+        unlink(path.c_str());
+        rmdir(directory.c_str());
+    }
+}
@@ -0,0 +1,111 @@
+// Copyright (C) 2019 Luxoft Sweden AB
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+//
+// SPDX-License-Identifier: MPL-2.0
+
+#include "daemon/mpsc_ring_buffer.h"
+
+#include <gtest/gtest.h>
+
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+namespace UserIdentificationManager::Daemon
+{
+    TEST(MPSCRingBuffer, CapacityRoundedUpToPowerOfTwo)
+    {
+        EXPECT_EQ(1U, MPSCRingBuffer<int>(0).capacity());
+        EXPECT_EQ(1U, MPSCRingBuffer<int>(1).capacity());
+        EXPECT_EQ(4U, MPSCRingBuffer<int>(3).capacity());
+        EXPECT_EQ(16U, MPSCRingBuffer<int>(16).capacity());
+        EXPECT_EQ(32U, MPSCRingBuffer<int>(17).capacity());
+    }
+
+    TEST(MPSCRingBuffer, PopFromEmptyFails)
+    {
+        MPSCRingBuffer<int> ring_buffer(4);
+        int value = 0;
+
+        EXPECT_FALSE(ring_buffer.try_pop(value));
+    }
+
+    TEST(MPSCRingBuffer, PushToFullFailsAndLeavesValueUntouched)
+    {
+        MPSCRingBuffer<std::vector<int>> ring_buffer(2);
+        std::vector<int> value = {1, 2, 3};
+
+        EXPECT_TRUE(ring_buffer.try_push({1}));
+        EXPECT_TRUE(ring_buffer.try_push({2}));
+        EXPECT_FALSE(ring_buffer.try_push(std::move(value)));
+        EXPECT_EQ(std::vector<int>({1, 2, 3}), value);
+    }
+
+    TEST(MPSCRingBuffer, PoppedInPushOrderAcrossWrapAround)
+    {
+        MPSCRingBuffer<int> ring_buffer(4);
+        std::vector<int> popped_values;
+        int value = 0;
+
+        for (int i = 0; i < 10; i++) {
+            EXPECT_TRUE(ring_buffer.try_push(int(i)));
+            EXPECT_TRUE(ring_buffer.try_push(int(i + 100)));
+            EXPECT_TRUE(ring_buffer.try_pop(value));
+            popped_values.push_back(value);
+            EXPECT_TRUE(ring_buffer.try_pop(value));
+            popped_values.push_back(value);
+        }
+
+        EXPECT_FALSE(ring_buffer.try_pop(value));
+
+        for (int i = 0; i < 10; i++) {
+            EXPECT_EQ(i, popped_values[std::size_t(i) * 2]);
+            EXPECT_EQ(i + 100, popped_values[std::size_t(i) * 2 + 1]);
+        }
+    }
+
+    TEST(MPSCRingBuffer, ManyProducersOneConsumer)
+    {
+        constexpr unsigned int NUM_PRODUCERS = 8;
+        constexpr unsigned int VALUES_PER_PRODUCER = 10000;
+        MPSCRingBuffer<unsigned int> ring_buffer(16);
+        std::vector<std::thread> producers;
+        std::vector<unsigned int> next_expected(NUM_PRODUCERS, 0);
+
+        for (unsigned int p = 0; p < NUM_PRODUCERS; p++) {
+            producers.emplace_back([&ring_buffer, p] {
+                for (unsigned int i = 0; i < VALUES_PER_PRODUCER; i++) {
+                    while (!ring_buffer.try_push(p * VALUES_PER_PRODUCER + i)) {
+                        std::this_thread::yield();
+                    }
+                }
+            });
+        }
+
+        unsigned int value = 0;
+
+        for (unsigned int popped = 0; popped < NUM_PRODUCERS * VALUES_PER_PRODUCER;) {
+            if (!ring_buffer.try_pop(value)) {
+                std::this_thread::yield();
+                continue;
+            }
+
+            unsigned int producer = value / VALUES_PER_PRODUCER;
+
+            ASSERT_LT(producer, NUM_PRODUCERS);
+            EXPECT_EQ(next_expected[producer], value % VALUES_PER_PRODUCER);
+
+            next_expected[producer] = value % VALUES_PER_PRODUCER + 1;
+            popped++;
+        }
+
+        for (std::thread &producer : producers) {
+            producer.join();
+        }
+
+        EXPECT_FALSE(ring_buffer.try_pop(value));
+    }
+}
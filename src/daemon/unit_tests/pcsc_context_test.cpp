@@ -0,0 +1,320 @@
+// Copyright (C) 2019 Luxoft Sweden AB
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+//
+// SPDX-License-Identifier: MPL-2.0
+
+#include "daemon/pcsc_context.h"
+
+#include <glibmm.h>
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "common/scoped_silent_log_handler.h"
+#include "daemon/unit_tests/fake_pcsc_backend.h"
+
+namespace UserIdentificationManager::Daemon
+{
+    namespace
+    {
+        using Bytes = std::vector<std::uint8_t>;
+
+        const Bytes MIFARE_CLASSIC_1K_ATR = {0x3b, 0x8f, 0x80, 0x01, 0x80, 0x4f, 0x0c,
+                                             0xa0, 0x00, 0x00, 0x03, 0x06, 0x03, 0x00,
+                                             0x01, 0x00, 0x00, 0x00, 0x00, 0x6a};
+
+        std::uint64_t statistic(const Statistics &statistics, const std::string &name)
+        {
+            for (const auto &[statistic_name, value] : statistics) {
+                if (statistic_name == name) {
+                    return value;
+                }
+            }
+
+            ADD_FAILURE() << "No statistic named " << name;
+
+            return 0;
+        }
+
+        class PCSCContextTest : public testing::Test
+        {
+        public:
+            using ExtractedUIDs = std::vector<std::pair<std::string, Bytes>>;
+
+            PCSCContextTest()
+            {
+                backend_.add_reader("Reader 0");
+            }
+
+            FakePCSCBackend &backend()
+            {
+                return backend_;
+            }
+
+            PCSCContext &context()
+            {
+                return context_;
+            }
+
+            // Enable UID extraction and run the main loop until num_uids UIDs are extracted.
+            ExtractedUIDs run_until_extracted(std::size_t num_uids)
+            {
+                Glib::RefPtr<Glib::MainLoop> main_loop = Glib::MainLoop::create();
+                ExtractedUIDs extracted_uids;
+
+                context_.uid_extract_enable([&](PCSCContext::UIDQueue::Batch batch) {
+                    for (const PCSCContext::ExtractedUID &extracted_uid : batch) {
+                        extracted_uids.emplace_back(
+                            context_.reader_name(extracted_uid.reader_id),
+                            Bytes(extracted_uid.uid.begin(), extracted_uid.uid.end()));
+                    }
+
+                    if (extracted_uids.size() >= num_uids) {
+                        main_loop->quit();
+                    }
+                });
+
+                main_loop->run();
+                context_.uid_extract_disable();
+
+                return extracted_uids;
+            }
+
+        private:
+            FakePCSCBackend backend_;
+            PCSCContext context_{backend_};
+        };
+    }
+
+    TEST_F(PCSCContextTest, UIDExtractedFromInsertedCard)
+    {
+        context().uid_extract_enable([](auto /*batch*/) {});
+        ASSERT_TRUE(backend().wait_until_waiting_for_card("Reader 0"));
+        backend().insert_card("Reader 0", MIFARE_CLASSIC_1K_ATR, {0x01, 0x02, 0x03, 0x04});
+
+        EXPECT_EQ(ExtractedUIDs({{"Reader 0", {0x01, 0x02, 0x03, 0x04}}}), run_until_extracted(1));
+    }
+
+    TEST_F(PCSCContextTest, UIDExtractedFromHotpluggedReader)
+    {
+        context().uid_extract_enable([](auto /*batch*/) {});
+        ASSERT_TRUE(backend().wait_until_waiting_for_card("Reader 0"));
+        backend().add_reader("Reader 1");
+        ASSERT_TRUE(backend().wait_until_waiting_for_card("Reader 1"));
+        backend().insert_card("Reader 1", MIFARE_CLASSIC_1K_ATR, {0xaa, 0xbb, 0xcc, 0xdd});
+
+        EXPECT_EQ(ExtractedUIDs({{"Reader 1", {0xaa, 0xbb, 0xcc, 0xdd}}}), run_until_extracted(1));
+    }
+
+    TEST_F(PCSCContextTest, ConnectionReusedForNextCard)
+    {
+        Glib::RefPtr<Glib::MainLoop> main_loop = Glib::MainLoop::create();
+        unsigned int num_extracted = 0;
+
+        // The next card is presented when the UID of the first has been passed on, by then the
+        // connection is cached.
+        context().uid_extract_enable([&](PCSCContext::UIDQueue::Batch batch) {
+            num_extracted += batch.size();
+
+            if (num_extracted == 1) {
+                backend().remove_card("Reader 0");
+                EXPECT_TRUE(backend().wait_until_waiting_for_card("Reader 0"));
+                backend().insert_card(
+                    "Reader 0", MIFARE_CLASSIC_1K_ATR, {0x02, 0x00, 0x00, 0x00});
+            } else {
+                main_loop->quit();
+            }
+        });
+
+        ASSERT_TRUE(backend().wait_until_waiting_for_card("Reader 0"));
+        backend().insert_card("Reader 0", MIFARE_CLASSIC_1K_ATR, {0x01, 0x00, 0x00, 0x00});
+        main_loop->run();
+        context().uid_extract_disable();
+
+        Statistics statistics = context().statistics();
+
+        EXPECT_EQ(1U, statistic(statistics, "connect.established"));
+        EXPECT_EQ(1U, statistic(statistics, "connect.reused"));
+    }
+
+    TEST_F(PCSCContextTest, ReadersReadInParallel)
+    {
+        backend().set_transmit_blocked(true);
+        backend().add_reader("Reader 1");
+        context().uid_extract_enable([](auto /*batch*/) {});
+        ASSERT_TRUE(backend().wait_until_waiting_for_card("Reader 0"));
+        ASSERT_TRUE(backend().wait_until_waiting_for_card("Reader 1"));
+
+        backend().insert_card("Reader 0", MIFARE_CLASSIC_1K_ATR, {0x01, 0x00, 0x00, 0x00});
+        backend().insert_card("Reader 1", MIFARE_CLASSIC_1K_ATR, {0x02, 0x00, 0x00, 0x00});
+
+        // Both cards are read at the same time.
+        ASSERT_TRUE(backend().wait_until_transmitting(2));
+        backend().set_transmit_blocked(false);
+
+        EXPECT_EQ(2U, run_until_extracted(2).size());
+    }
+
+    TEST_F(PCSCContextTest, TimedOutReadDiscarded)
+    {
+        Common::ScopedSilentLogHandler log_handler;
+
+        backend().set_transmit_latency(std::chrono::milliseconds(1500));
+        context().uid_extract_enable([](auto /*batch*/) {});
+        ASSERT_TRUE(backend().wait_until_waiting_for_card("Reader 0"));
+        backend().insert_card("Reader 0", MIFARE_CLASSIC_1K_ATR, {0x01, 0x00, 0x00, 0x00});
+        ASSERT_TRUE(backend().wait_until_card_read("Reader 0"));
+
+        // The late result is discarded, the next card is read on a new context.
+        backend().set_transmit_latency(std::chrono::microseconds(0));
+        backend().remove_card("Reader 0");
+        ASSERT_TRUE(backend().wait_until_waiting_for_card("Reader 0"));
+        backend().insert_card("Reader 0", MIFARE_CLASSIC_1K_ATR, {0x02, 0x00, 0x00, 0x00});
+
+        EXPECT_EQ(ExtractedUIDs({{"Reader 0", {0x02, 0x00, 0x00, 0x00}}}), run_until_extracted(1));
+        EXPECT_EQ(1U, statistic(context().statistics(), "reader_pool.timeouts"));
+    }
+
+    TEST_F(PCSCContextTest, ThreadOnlyRunsWhileEnabled)
+    {
+        EXPECT_EQ(0U, backend().num_contexts());
+
+        context().uid_extract_enable([](auto /*batch*/) {});
+        ASSERT_TRUE(backend().wait_until_waiting_for_card("Reader 0"));
+        EXPECT_EQ(1U, backend().num_contexts());
+
+        context().uid_extract_disable();
+
+        EXPECT_EQ(0U, backend().num_contexts());
+    }
+
+    TEST_F(PCSCContextTest, DisableNotDelayedByLostCancels)
+    {
+        context().uid_extract_enable([](auto /*batch*/) {});
+        ASSERT_TRUE(backend().wait_until_waiting_for_card("Reader 0"));
+        backend().set_num_cancels_lost(3);
+
+        // SCardGetStatusChange() waits without timeout, only a retried cancel stops the thread.
+        context().uid_extract_disable();
+
+        EXPECT_EQ(0U, backend().num_contexts());
+    }
+
+    TEST_F(PCSCContextTest, DisableNotDelayedByStuckDriver)
+    {
+        Common::ScopedSilentLogHandler log_handler;
+
+        backend().set_transmit_blocked(true);
+        context().uid_extract_enable([](auto /*batch*/) {});
+        ASSERT_TRUE(backend().wait_until_waiting_for_card("Reader 0"));
+        backend().insert_card("Reader 0", MIFARE_CLASSIC_1K_ATR, {0x01, 0x02, 0x03, 0x04});
+        ASSERT_TRUE(backend().wait_until_transmitting(1));
+
+        // SCardCancel() does not interrupt SCardTransmit(), so the worker is abandoned.
+        context().uid_extract_disable();
+
+        EXPECT_EQ(1U, backend().num_transmits());
+        EXPECT_EQ(1U, statistic(context().statistics(), "reader_pool.abandoned"));
+
+        // The abandoned worker releases the context of the reader when done.
+        backend().set_transmit_blocked(false);
+        EXPECT_TRUE(backend().wait_until_contexts_released());
+    }
+
+    TEST_F(PCSCContextTest, ReaderContextsReleasedWhenDisabled)
+    {
+        context().uid_extract_enable([](auto /*batch*/) {});
+        ASSERT_TRUE(backend().wait_until_waiting_for_card("Reader 0"));
+        backend().insert_card("Reader 0", MIFARE_CLASSIC_1K_ATR, {0x01, 0x02, 0x03, 0x04});
+
+        EXPECT_EQ(1U, run_until_extracted(1).size());
+        EXPECT_EQ(0U, backend().num_contexts());
+
+        // Readers, and their contexts, are created again when enabled again.
+        backend().remove_card("Reader 0");
+        context().uid_extract_enable([](auto /*batch*/) {});
+        ASSERT_TRUE(backend().wait_until_waiting_for_card("Reader 0"));
+        backend().insert_card("Reader 0", MIFARE_CLASSIC_1K_ATR, {0x02, 0x00, 0x00, 0x00});
+
+        EXPECT_EQ(ExtractedUIDs({{"Reader 0", {0x02, 0x00, 0x00, 0x00}}}), run_until_extracted(1));
+        EXPECT_EQ(0U, backend().num_contexts());
+    }
+
+    TEST_F(PCSCContextTest, ReconnectedWhenServiceRestarts)
+    {
+        Common::ScopedSilentLogHandler log_handler;
+
+        context().uid_extract_enable([](auto /*batch*/) {});
+        ASSERT_TRUE(backend().wait_until_waiting_for_card("Reader 0"));
+
+        backend().set_service_running(false);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        backend().set_service_running(true);
+
+        ASSERT_TRUE(backend().wait_until_waiting_for_card("Reader 0"));
+        backend().insert_card("Reader 0", MIFARE_CLASSIC_1K_ATR, {0x01, 0x02, 0x03, 0x04});
+
+        EXPECT_EQ(ExtractedUIDs({{"Reader 0", {0x01, 0x02, 0x03, 0x04}}}), run_until_extracted(1));
+
+        Statistics statistics = context().statistics();
+
+        EXPECT_EQ(2U, statistic(statistics, "pcscd.connected"));
+        EXPECT_EQ(1U, statistic(statistics, "pcscd.lost"));
+    }
+
+    TEST_F(PCSCContextTest, CardInsertedWhileServiceDownNoticed)
+    {
+        Common::ScopedSilentLogHandler log_handler;
+
+        context().uid_extract_enable([](auto /*batch*/) {});
+        ASSERT_TRUE(backend().wait_until_waiting_for_card("Reader 0"));
+
+        backend().set_service_running(false);
+        backend().insert_card("Reader 0", MIFARE_CLASSIC_1K_ATR, {0x01, 0x02, 0x03, 0x04});
+        backend().set_service_running(true);
+
+        EXPECT_EQ(ExtractedUIDs({{"Reader 0", {0x01, 0x02, 0x03, 0x04}}}), run_until_extracted(1));
+    }
+
+    TEST_F(PCSCContextTest, ConnectRetriedWithBackoffUntilServiceStarts)
+    {
+        Common::ScopedSilentLogHandler log_handler;
+
+        backend().set_service_running(false);
+        context().uid_extract_enable([](auto /*batch*/) {});
+
+        // Attempts keep being made, after 0, 100 and 300 ms.
+        ASSERT_TRUE(backend().wait_until_establish_failed(3));
+        EXPECT_GE(statistic(context().statistics(), "pcscd.connect_failed"), 3U);
+
+        backend().set_service_running(true);
+        ASSERT_TRUE(backend().wait_until_waiting_for_card("Reader 0"));
+        backend().insert_card("Reader 0", MIFARE_CLASSIC_1K_ATR, {0x01, 0x02, 0x03, 0x04});
+
+        EXPECT_EQ(ExtractedUIDs({{"Reader 0", {0x01, 0x02, 0x03, 0x04}}}), run_until_extracted(1));
+        EXPECT_EQ(1U, statistic(context().statistics(), "pcscd.connected"));
+    }
+
+    TEST_F(PCSCContextTest, DisableNotDelayedByBackoff)
+    {
+        Common::ScopedSilentLogHandler log_handler;
+        // Disabling only returns if it interrupts the backoff.
+        PCSCContext context(backend(), std::chrono::hours(1));
+
+        backend().set_service_running(false);
+        context.uid_extract_enable([](auto /*batch*/) {});
+        ASSERT_TRUE(backend().wait_until_establish_failed(1));
+
+        context.uid_extract_disable();
+
+        EXPECT_EQ(1U, statistic(context.statistics(), "pcscd.connect_failed"));
+    }
+}
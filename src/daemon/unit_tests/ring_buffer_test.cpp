@@ -0,0 +1,160 @@
+// Copyright (C) 2019 Luxoft Sweden AB
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+//
+// SPDX-License-Identifier: MPL-2.0
+
+#include "daemon/ring_buffer.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace UserIdentificationManager::Daemon
+{
+    namespace
+    {
+        using Values = std::vector<int>;
+
+        Values values(const RingBuffer<int> &ring_buffer)
+        {
+            RingBuffer<int>::View view = ring_buffer.view();
+
+            return {view.begin(), view.end()};
+        }
+    }
+
+    TEST(RingBuffer, EmptyAfterConstruction)
+    {
+        RingBuffer<int> ring_buffer(3);
+
+        EXPECT_EQ(3u, ring_buffer.capacity());
+        EXPECT_TRUE(ring_buffer.empty());
+        EXPECT_TRUE(ring_buffer.view().empty());
+    }
+
+    TEST(RingBuffer, PushUntilFull)
+    {
+        RingBuffer<int> ring_buffer(3);
+
+        ring_buffer.push(1);
+        ring_buffer.push(2);
+        EXPECT_EQ(Values({1, 2}), values(ring_buffer));
+
+        ring_buffer.push(3);
+        EXPECT_EQ(Values({1, 2, 3}), values(ring_buffer));
+    }
+
+    TEST(RingBuffer, PushWhenFullOverwritesOldest)
+    {
+        RingBuffer<int> ring_buffer(3);
+
+        for (int i = 1; i <= 7; i++) {
+            ring_buffer.push(i);
+        }
+
+        EXPECT_EQ(3u, ring_buffer.size());
+        EXPECT_EQ(Values({5, 6, 7}), values(ring_buffer));
+
+        RingBuffer<int>::View view = ring_buffer.view();
+        EXPECT_EQ(5, view[0]);
+        EXPECT_EQ(7, view[2]);
+    }
+
+    TEST(RingBuffer, ZeroCapacityKeepsNothing)
+    {
+        RingBuffer<int> ring_buffer(0);
+
+        ring_buffer.push(1);
+        EXPECT_TRUE(ring_buffer.empty());
+    }
+
+    TEST(RingBuffer, IncreaseCapacityKeepsValues)
+    {
+        RingBuffer<int> ring_buffer(3);
+
+        for (int i = 1; i <= 4; i++) {
+            ring_buffer.push(i);
+        }
+
+        ring_buffer.set_capacity(5);
+        EXPECT_EQ(Values({2, 3, 4}), values(ring_buffer));
+
+        ring_buffer.push(5);
+        ring_buffer.push(6);
+        ring_buffer.push(7);
+        EXPECT_EQ(Values({3, 4, 5, 6, 7}), values(ring_buffer));
+    }
+
+    TEST(RingBuffer, DecreaseCapacityKeepsNewest)
+    {
+        RingBuffer<int> ring_buffer(4);
+
+        for (int i = 1; i <= 6; i++) {
+            ring_buffer.push(i);
+        }
+
+        ring_buffer.set_capacity(2);
+        EXPECT_EQ(Values({5, 6}), values(ring_buffer));
+
+        ring_buffer.push(7);
+        EXPECT_EQ(Values({6, 7}), values(ring_buffer));
+    }
+
+    TEST(RingBuffer, Clear)
+    {
+        RingBuffer<int> ring_buffer(2);
+
+        ring_buffer.push(1);
+        ring_buffer.push(2);
+        ring_buffer.push(3);
+        ring_buffer.clear();
+        EXPECT_TRUE(ring_buffer.empty());
+
+        ring_buffer.push(4);
+        EXPECT_EQ(Values({4}), values(ring_buffer));
+    }
+
+    TEST(RingBuffer, ViewLast)
+    {
+        RingBuffer<int> ring_buffer(4);
+
+        for (int i = 1; i <= 6; i++) {
+            ring_buffer.push(i);
+        }
+
+        RingBuffer<int>::View view = ring_buffer.view();
+        EXPECT_EQ(Values({5, 6}), Values(view.last(2).begin(), view.last(2).end()));
+        EXPECT_EQ(Values({3, 4, 5, 6}), Values(view.last(4).begin(), view.last(4).end()));
+        EXPECT_EQ(Values({3, 4, 5, 6}), Values(view.last(10).begin(), view.last(10).end()));
+        EXPECT_TRUE(view.last(0).empty());
+    }
+
+    TEST(RingBuffer, ViewIteratorIsRandomAccess)
+    {
+        RingBuffer<int> ring_buffer(4);
+
+        // Wraps around the end of the storage.
+        for (int i = 1; i <= 6; i++) {
+            ring_buffer.push(i * 10);
+        }
+
+        RingBuffer<int>::View view = ring_buffer.view();
+        RingBuffer<int>::View::const_iterator begin = view.begin();
+        RingBuffer<int>::View::const_iterator end = view.end();
+
+        EXPECT_EQ(4, end - begin);
+        EXPECT_EQ(begin + 3, 3 + begin);
+        EXPECT_EQ(50, (2 + begin)[0]);
+        EXPECT_TRUE(begin < end && begin <= end && end > begin && end >= begin);
+        EXPECT_TRUE(begin <= begin && begin >= begin);
+        EXPECT_FALSE(begin > begin || begin < begin);
+
+        EXPECT_EQ(begin + 2, std::lower_bound(begin, end, 45));
+        EXPECT_EQ(begin + 3, std::upper_bound(begin, end, 50));
+        EXPECT_TRUE(std::binary_search(begin, end, 60));
+    }
+}
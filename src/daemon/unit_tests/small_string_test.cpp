@@ -0,0 +1,83 @@
+// Copyright (C) 2019 Luxoft Sweden AB
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+//
+// SPDX-License-Identifier: MPL-2.0
+
+#include "daemon/small_string.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <string>
+#include <string_view>
+
+namespace UserIdentificationManager::Daemon
+{
+    namespace
+    {
+        using String = SmallString<8>;
+    }
+
+    TEST(SmallString, EmptyByDefault)
+    {
+        String string;
+
+        EXPECT_TRUE(string.empty());
+        EXPECT_STREQ("", string.c_str());
+    }
+
+    TEST(SmallString, AppendWithinInlineCapacity)
+    {
+        String string = "SCARD";
+
+        string.append("-");
+        string.append("01");
+
+        EXPECT_EQ("SCARD-01", string.view());
+        EXPECT_EQ(8U, string.size());
+        EXPECT_EQ(8U, std::strlen(string.c_str()));
+    }
+
+    TEST(SmallString, AppendBeyondInlineCapacity)
+    {
+        String string = "SCARD-01";
+
+        string.append("020304");
+
+        EXPECT_EQ("SCARD-01020304", string.view());
+        EXPECT_STREQ("SCARD-01020304", string.c_str());
+
+        string.append("05");
+
+        EXPECT_EQ("SCARD-0102030405", string.view());
+    }
+
+    TEST(SmallString, ConstructedBeyondInlineCapacity)
+    {
+        String string = std::string("MSD-0123456789");
+
+        EXPECT_EQ("MSD-0123456789", string.view());
+    }
+
+    TEST(SmallString, ClearReturnsToInline)
+    {
+        String string = "MSD-0123456789";
+
+        string.clear();
+        EXPECT_TRUE(string.empty());
+        EXPECT_STREQ("", string.c_str());
+
+        string.append("MSD-01");
+        EXPECT_EQ("MSD-01", string.view());
+    }
+
+    TEST(SmallString, ComparedByContent)
+    {
+        EXPECT_EQ(String("MSD-0123456789"), String(std::string_view("MSD-0123456789")));
+        EXPECT_NE(String("MSD-01"), String("MSD-0123456789"));
+        EXPECT_NE(String("MSD-01"), String("MSD-02"));
+    }
+}
@@ -0,0 +1,188 @@
+// Copyright (C) 2019 Luxoft Sweden AB
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+//
+// SPDX-License-Identifier: MPL-2.0
+
+#include "daemon/uid_extractor.h"
+
+#include <winscard.h>
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "common/scoped_silent_log_handler.h"
+#include "daemon/unit_tests/fake_pcsc_backend.h"
+
+namespace UserIdentificationManager::Daemon
+{
+    namespace
+    {
+        using Bytes = std::vector<std::uint8_t>;
+
+        const Bytes MIFARE_CLASSIC_1K_ATR = {0x3b, 0x8f, 0x80, 0x01, 0x80, 0x4f, 0x0c,
+                                             0xa0, 0x00, 0x00, 0x03, 0x06, 0x03, 0x00,
+                                             0x01, 0x00, 0x00, 0x00, 0x00, 0x6a};
+        const Bytes MIFARE_DESFIRE_ATR = {0x3b, 0x81, 0x80, 0x01, 0x80, 0x80};
+        const Bytes ISO_14443_B_ATR = {
+            0x3b, 0x88, 0x80, 0x01, 0x00, 0x00, 0x00, 0x00, 0x33, 0x81, 0x81, 0x00, 0x3a};
+        const Bytes CARD_EMULATION_ATR = {0x3b, 0x80, 0x80, 0x01, 0x01};
+
+        constexpr char ACS_READER_NAME[] = "ACS ACR122U PICC Interface 00 00";
+        constexpr char OTHER_READER_NAME[] = "Generic Contactless Reader 00 00";
+
+        std::uint64_t statistic(const Statistics &statistics, const std::string &name)
+        {
+            for (const auto &[statistic_name, value] : statistics) {
+                if (statistic_name == name) {
+                    return value;
+                }
+            }
+
+            ADD_FAILURE() << "No statistic named " << name;
+
+            return 0;
+        }
+
+        class UIDExtractorTest : public testing::Test
+        {
+        public:
+            UIDExtractorTest()
+            {
+                backend_.add_reader(ACS_READER_NAME);
+                backend_.add_reader(OTHER_READER_NAME);
+                backend_.establish_context(context_);
+            }
+
+            ~UIDExtractorTest() override
+            {
+                backend_.release_context(context_);
+            }
+
+            FakePCSCBackend &backend()
+            {
+                return backend_;
+            }
+
+            UIDExtractor &extractor()
+            {
+                return extractor_;
+            }
+
+            std::optional<UIDExtractor::Result> extract(ReaderId reader_id,
+                                                        const std::string &reader_name,
+                                                        const Bytes &atr)
+            {
+                Atr::Bytes atr_bytes;
+                atr_bytes.assign(atr.data(), atr.size());
+
+                return extractor_.extract(context_, reader_id, reader_name, atr_bytes);
+            }
+
+            std::uint64_t failures(const std::string &strategy_name) const
+            {
+                return statistic(extractor_.statistics(),
+                                 "uid_strategy." + strategy_name + ".failure");
+            }
+
+        private:
+            FakePCSCBackend backend_;
+            UIDExtractor extractor_{backend_};
+            SCARDCONTEXT context_ = 0;
+        };
+    }
+
+    TEST_F(UIDExtractorTest, UIDExtractedWithGetData)
+    {
+        backend().insert_card(OTHER_READER_NAME, MIFARE_CLASSIC_1K_ATR, {0x01, 0x02, 0x03, 0x04});
+
+        auto result = extract(0, OTHER_READER_NAME, MIFARE_CLASSIC_1K_ATR);
+
+        ASSERT_TRUE(result);
+        EXPECT_EQ(Bytes({0x01, 0x02, 0x03, 0x04}), Bytes(result->uid.begin(), result->uid.end()));
+        EXPECT_FALSE(result->ndef_message);
+        EXPECT_EQ(1U, statistic(extractor().statistics(), "uid_strategy.get_data.success"));
+    }
+
+    TEST_F(UIDExtractorTest, NdefMessageMarkedAsSuch)
+    {
+        const Bytes message = {0xd1, 0x01, 0x04, 0x54, 0x02, 0x65, 0x6e, 0x31};
+
+        backend().insert_card(
+            OTHER_READER_NAME, CARD_EMULATION_ATR, {0x08, 0x11, 0x22, 0x33}, message);
+
+        auto result = extract(0, OTHER_READER_NAME, CARD_EMULATION_ATR);
+
+        ASSERT_TRUE(result);
+        EXPECT_EQ(message, Bytes(result->uid.begin(), result->uid.end()));
+        EXPECT_TRUE(result->ndef_message);
+
+        // Without an NDEF message, the random UID is all there is.
+        backend().remove_card(OTHER_READER_NAME);
+        backend().insert_card(OTHER_READER_NAME, CARD_EMULATION_ATR, {0x08, 0x44, 0x55, 0x66});
+
+        result = extract(0, OTHER_READER_NAME, CARD_EMULATION_ATR);
+
+        ASSERT_TRUE(result);
+        EXPECT_EQ(Bytes({0x08, 0x44, 0x55, 0x66}), Bytes(result->uid.begin(), result->uid.end()));
+        EXPECT_FALSE(result->ndef_message);
+    }
+
+    TEST_F(UIDExtractorTest, TooLongNdefMessageNotUsed)
+    {
+        Common::ScopedSilentLogHandler log_handler;
+
+        backend().insert_card(OTHER_READER_NAME,
+                              CARD_EMULATION_ATR,
+                              {},
+                              Bytes(UIDExtractor::UID::capacity() + 1, 0x42));
+
+        EXPECT_FALSE(extract(0, OTHER_READER_NAME, CARD_EMULATION_ATR));
+        EXPECT_EQ(1U, failures("iso_14443_4_select_read"));
+    }
+
+    TEST_F(UIDExtractorTest, NdefMessageOnlyReadWhenSuggestedByCardTable)
+    {
+        Common::ScopedSilentLogHandler log_handler;
+
+        // Get Data fails for cards without UID. Neither the storage card, the ISO 14443-4 card
+        // in the table nor the one not in it has the NDEF message read.
+        for (const Bytes &atr : {MIFARE_CLASSIC_1K_ATR, MIFARE_DESFIRE_ATR, ISO_14443_B_ATR}) {
+            backend().remove_card(OTHER_READER_NAME);
+            backend().insert_card(OTHER_READER_NAME, atr, {});
+
+            EXPECT_FALSE(extract(0, OTHER_READER_NAME, atr));
+        }
+
+        EXPECT_EQ(3U, failures("get_data"));
+        EXPECT_EQ(0U, failures("iso_14443_4_select_read"));
+
+        backend().remove_card(OTHER_READER_NAME);
+        backend().insert_card(OTHER_READER_NAME, CARD_EMULATION_ATR, {});
+
+        EXPECT_FALSE(extract(0, OTHER_READER_NAME, CARD_EMULATION_ATR));
+        EXPECT_EQ(4U, failures("get_data"));
+        EXPECT_EQ(1U, failures("iso_14443_4_select_read"));
+    }
+
+    TEST_F(UIDExtractorTest, DirectTransmitOnlySentToAcsReaders)
+    {
+        Common::ScopedSilentLogHandler log_handler;
+
+        backend().insert_card(OTHER_READER_NAME, MIFARE_CLASSIC_1K_ATR, {});
+
+        EXPECT_FALSE(extract(0, OTHER_READER_NAME, MIFARE_CLASSIC_1K_ATR));
+        EXPECT_EQ(0U, failures("acs_direct_transmit"));
+
+        backend().insert_card(ACS_READER_NAME, MIFARE_CLASSIC_1K_ATR, {});
+
+        EXPECT_FALSE(extract(1, ACS_READER_NAME, MIFARE_CLASSIC_1K_ATR));
+        EXPECT_EQ(1U, failures("acs_direct_transmit"));
+    }
+}